@@ -0,0 +1,832 @@
+#include "exprparse.hpp"
+#include "exprparse_shm.hpp"
+#include "exprparse_workload.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// Micro benchmarks of parsing and evaluation.
+// Build with -DEXPRPARSE_BUILD_BENCHMARK=ON and run bench/exprparse_bench.
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    volatile double sink; // Keeps results alive
+
+    // Hardware counters of the calling thread in user space, opened as one group so that they count the same
+    // instructions. Counters missing in virtual machines and containers only drop their column. When the kernel
+    // multiplexes the group with other events, counts are scaled by the time enabled over the time running.
+    class Counters {
+    public:
+        enum Event { Cycles, Instructions, BranchMisses, L1Misses, LLCMisses, Count };
+
+        double per_call[Count] = {}; // Of the last measurement
+        bool   available[Count] = {};
+        double running = 1;          // Fraction of the last measurement the group was counting, below 1 if multiplexed
+
+        Counters()
+        {
+            #ifdef __linux__
+            const std::uint64_t l1_read_miss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            Open(Cycles,       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            Open(Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            Open(BranchMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+            Open(L1Misses,     PERF_TYPE_HW_CACHE, l1_read_miss);
+            Open(LLCMisses,    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            #else
+            _error = "not supported on this platform";
+            #endif
+        }
+
+        ~Counters()
+        {
+            #ifdef __linux__
+            for (int fd : _fds)
+                if (fd >= 0)
+                    close(fd);
+            #endif
+        }
+
+        bool Any() const { return available[Cycles] || available[Instructions] || available[BranchMisses] || available[L1Misses] || available[LLCMisses]; }
+        const std::string &Error() const { return _error; }
+
+        void Start()
+        {
+            #ifdef __linux__
+            if (_leader >= 0) {
+                ioctl(_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+            #endif
+        }
+
+        void Stop(std::size_t calls)
+        {
+            #ifdef __linux__
+            if (_leader < 0)
+                return;
+            ioctl(_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+            // Number of events, time enabled, time running, then the values in the order the events were opened
+            std::uint64_t data[3 + Count] = {};
+            ssize_t bytes = read(_leader, data, sizeof(data));
+            std::uint64_t events = data[0], enabled = data[1], active = data[2];
+
+            bool valid = bytes >= static_cast<ssize_t>((3 + _order.size()) * sizeof(std::uint64_t)) && events == _order.size();
+            running = valid && enabled > 0 ? static_cast<double>(active) / enabled : 0;
+            for (int i = 0; i < Count; i++)
+                per_call[i] = 0;
+            for (std::size_t k = 0; valid && active > 0 && k < _order.size(); k++)
+                per_call[_order[k]] = static_cast<double>(data[3 + k]) * enabled / active / calls;
+            #else
+            (void)calls;
+            #endif
+        }
+
+    private:
+        #ifdef __linux__
+        void Open(Event event, std::uint32_t type, std::uint64_t config)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size           = sizeof(attr);
+            attr.type           = type;
+            attr.config         = config;
+            attr.disabled       = _leader < 0; // Members follow the leader
+            attr.exclude_kernel = 1;           // Allowed with perf_event_paranoid up to 2
+            attr.exclude_hv     = 1;
+            attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            _fds[event] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, _leader, 0));
+            available[event] = _fds[event] >= 0;
+            if (!available[event]) {
+                if (_error.empty())
+                    _error = std::strerror(errno);
+                return;
+            }
+
+            if (_leader < 0)
+                _leader = _fds[event];
+            _order.push_back(event);
+        }
+
+        int _fds[Count] = { -1, -1, -1, -1, -1 };
+        int _leader     = -1;
+
+        std::vector<Event> _order; // Events of the group in the order of read
+        #endif
+
+        std::string _error;
+    };
+
+    Counters counters;
+
+    int failures = 0; // Of the checks, the exit code is nonzero if any failed
+
+    template<typename F>
+    double NanosecondsPerCall(F &&f, std::size_t iterations)
+    {
+        for (std::size_t i = 0; i < iterations / 10; i++) // Warm up
+            f();
+
+        counters.Start();
+        auto start = Clock::now();
+        for (std::size_t i = 0; i < iterations; i++)
+            f();
+        auto stop = Clock::now();
+        counters.Stop(iterations);
+
+        return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+    }
+
+    // Counters of the last measurement, with misses divided by the units (nodes or rows) of one call
+    void ReportCounters(const char *unit, double units_per_call)
+    {
+        if (!counters.Any())
+            return;
+
+        auto column = [&](Counters::Event event, const char *name) {
+            if (counters.available[event])
+                std::printf(", %.3f %s", counters.per_call[event] / units_per_call, name);
+        };
+
+        if (counters.running <= 0) {
+            std::printf("  %-28s counters not scheduled, the PMU is in use by other events\n", "");
+            return;
+        }
+
+        std::printf("  %-28s", "");
+        if (counters.available[Counters::Cycles] && counters.available[Counters::Instructions] && counters.per_call[Counters::Cycles] > 0)
+            std::printf(" IPC %.2f,", counters.per_call[Counters::Instructions] / counters.per_call[Counters::Cycles]);
+        std::printf(" per %s", unit);
+        column(Counters::Cycles, "cycles");
+        column(Counters::BranchMisses, "branch misses");
+        column(Counters::L1Misses, "L1D misses");
+        column(Counters::LLCMisses, "LLC misses");
+        if (counters.running < 0.999)
+            std::printf(" (multiplexed, scaled from %.0f%% of the time)", 100 * counters.running);
+        std::printf("\n");
+    }
+
+    void Report(const char *name, double ns, double baseline = 0)
+    {
+        if (baseline > 0)
+            std::printf("  %-28s %10.1f ns  (%+.1f%%)\n", name, ns, 100 * (ns / baseline - 1));
+        else
+            std::printf("  %-28s %10.1f ns\n", name, ns);
+    }
+
+    void BenchExpression(const char *source, std::size_t iterations)
+    {
+        exprparse::Expression<double> e;
+
+        auto x = std::make_shared<double>(1.5);
+        auto y = std::make_shared<double>(2.5);
+        e.RegisterVariable("x", x);
+        e.RegisterVariable("y", y);
+        e.RegisterFunction("sqrt", [](double v) { return std::sqrt(v); });
+
+        std::printf("%s\n", source);
+
+        double parse = NanosecondsPerCall([&]() { e.Parse(source); }, iterations / 100);
+        double nodes = static_cast<double>(e.WorstCaseOperations().nodes);
+        Report("Parse", parse);
+        ReportCounters("node", nodes);
+
+        exprparse::Status status;
+        double eval = NanosecondsPerCall([&]() { sink = e.Eval(status); }, iterations);
+        Report("Eval", eval);
+        ReportCounters("node", nodes);
+
+        exprparse::EvalBudget budget;
+        budget.max_operations = 1u << 20;
+        double budgeted = NanosecondsPerCall([&]() { sink = e.Eval(status, budget); }, iterations);
+        Report("Eval with budget", budgeted, eval);
+
+        std::atomic<bool> cancel(false);
+        budget.cancel = &cancel;
+        double cancellable = NanosecondsPerCall([&]() { sink = e.Eval(status, budget); }, iterations);
+        Report("Eval with budget and cancel", cancellable, eval);
+    }
+
+    void BenchReduction(std::size_t size, std::size_t iterations)
+    {
+        exprparse::Expression<double> e;
+
+        auto w = std::make_shared<std::vector<double>>(size, 0.5);
+        auto x = std::make_shared<std::vector<double>>(size, 1.5);
+        e.RegisterArray("w", w);
+        e.RegisterArray("x", x);
+
+        std::string chain;
+        for (std::size_t i = 0; i < size; i++)
+            chain += (i ? "+w[" : "w[") + std::to_string(i) + "]*x[" + std::to_string(i) + "]";
+
+        std::printf("Sum of %zu products\n", size);
+
+        exprparse::Status status;
+        e.SetOptimizations(exprparse::Optimize_None);
+        e.Parse(chain);
+        double written = NanosecondsPerCall([&]() { sink = e.Eval(status); }, iterations);
+        Report("Eval as written", written);
+        ReportCounters("element", static_cast<double>(size));
+
+        e.SetOptimizations(exprparse::Optimize_Reductions);
+        e.Parse(chain);
+        Report("Eval rewritten to dot", NanosecondsPerCall([&]() { sink = e.Eval(status); }, iterations), written);
+        ReportCounters("element", static_cast<double>(size));
+
+        e.Parse("dot(w, x)");
+        Report("Eval dot(w, x)", NanosecondsPerCall([&]() { sink = e.Eval(status); }, iterations), written);
+        ReportCounters("element", static_cast<double>(size));
+    }
+
+    // Counts grid points of [-2, 2]^2 where the expression is at most zero, either by evaluating every
+    // point or by subdividing the grid and skipping blocks whose bounds decide the sign for all points
+    struct Sampler {
+        exprparse::Expression<double>         &e;
+        exprparse::IntervalExpression<double> &bounds;
+        std::shared_ptr<double>                x, y;
+        std::size_t                            size;
+        std::size_t                            evaluations = 0;
+
+        double Coordinate(std::size_t i) const { return -2 + 4 * (i + 0.5) / size; }
+
+        std::size_t CountPoints(std::size_t x0, std::size_t x1, std::size_t y0, std::size_t y1)
+        {
+            std::size_t count = 0;
+            exprparse::Status status;
+            for (std::size_t i = x0; i < x1; i++) {
+                for (std::size_t j = y0; j < y1; j++) {
+                    *x = Coordinate(i);
+                    *y = Coordinate(j);
+                    count += e.Eval(status) <= 0;
+                    evaluations++;
+                }
+            }
+            return count;
+        }
+
+        std::size_t CountPruned(std::size_t x0, std::size_t x1, std::size_t y0, std::size_t y1)
+        {
+            if ((x1 - x0) * (y1 - y0) <= 4)
+                return CountPoints(x0, x1, y0, y1);
+
+            exprparse::Interval<double> box[2] = { { Coordinate(x0), Coordinate(x1 - 1) }, { Coordinate(y0), Coordinate(y1 - 1) } };
+            exprparse::Status status;
+            exprparse::Interval<double> range = bounds.Eval(box, status);
+            evaluations++;
+
+            if (range.upper <= 0)
+                return (x1 - x0) * (y1 - y0);
+            if (range.lower > 0)
+                return 0;
+
+            std::size_t xm = (x0 + x1) / 2, ym = (y0 + y1) / 2;
+            return CountPruned(x0, xm, y0, ym) + CountPruned(xm, x1, y0, ym) + CountPruned(x0, xm, ym, y1) + CountPruned(xm, x1, ym, y1);
+        }
+    };
+
+    void BenchIntervals(const char *source, std::size_t size)
+    {
+        exprparse::Expression<double> e;
+        exprparse::IntervalExpression<double> bounds;
+
+        auto x = std::make_shared<double>(0);
+        auto y = std::make_shared<double>(0);
+        e.RegisterVariable("x", x);
+        e.RegisterVariable("y", y);
+        e.Parse(source);
+        bounds.Compile(e);
+
+        std::printf("%s over a %zux%zu grid\n", source, size, size);
+
+        // Slots follow the order of first use, x before y in these sources
+        Sampler sampler = { e, bounds, x, y, size };
+        std::size_t points, pruned;
+
+        points = sampler.CountPoints(0, size, 0, size);
+        std::size_t point_evaluations = sampler.evaluations;
+
+        sampler.evaluations = 0;
+        pruned = sampler.CountPruned(0, size, 0, size);
+
+        std::printf("  %zu points inside, %zu with pruning\n", points, pruned);
+        std::printf("  %zu evaluations, %zu with pruning\n", point_evaluations, sampler.evaluations);
+
+        double all        = NanosecondsPerCall([&]() { sink = sampler.CountPoints(0, size, 0, size); }, 5);
+        double subdivided = NanosecondsPerCall([&]() { sink = sampler.CountPruned(0, size, 0, size); }, 20);
+        Report("Every point", all);
+        Report("Pruned by intervals", subdivided, all);
+
+        // Single boxes against blocks of boxes in structure of arrays layout
+        const std::size_t rows = 4096;
+        std::vector<double> lower_x(rows), upper_x(rows), lower_y(rows), upper_y(rows), lower(rows), upper(rows);
+        for (std::size_t i = 0; i < rows; i++) {
+            lower_x[i] = -2 + 4.0 * i / rows;
+            upper_x[i] = lower_x[i] + 0.01;
+            lower_y[i] = 1 - 2.0 * i / rows;
+            upper_y[i] = lower_y[i] + 0.01;
+        }
+
+        const double *lower_columns[2] = { lower_x.data(), lower_y.data() };
+        const double *upper_columns[2] = { upper_x.data(), upper_y.data() };
+        exprparse::Status status;
+
+        double scalar = NanosecondsPerCall([&]() {
+            for (std::size_t i = 0; i < rows; i++) {
+                exprparse::Interval<double> box[2] = { { lower_x[i], upper_x[i] }, { lower_y[i], upper_y[i] } };
+                sink = bounds.Eval(box, status).upper;
+            }
+        }, 200) / rows;
+        Report("Interval per box", scalar);
+        ReportCounters("row", rows);
+
+        double batch = NanosecondsPerCall([&]() { bounds.EvalBatch(lower_columns, upper_columns, rows, lower.data(), upper.data(), status); }, 200) / rows;
+        Report("Interval per box, batched", batch, scalar);
+        ReportCounters("row", rows);
+    }
+
+    // Reduction and interval kernels of every instruction set the processor supports
+    void BenchIsa(std::size_t size)
+    {
+        exprparse::Expression<double> e;
+
+        auto w = std::make_shared<std::vector<double>>(size);
+        auto x = std::make_shared<std::vector<double>>(size);
+        for (std::size_t i = 0; i < size; i++) {
+            (*w)[i] = std::sin(0.1 * i);
+            (*x)[i] = std::cos(0.3 * i);
+        }
+        e.RegisterArray("w", w);
+        e.RegisterArray("x", x);
+
+        exprparse::Expression<double> f;
+        f.RegisterVariable("x", std::make_shared<double>(0));
+        f.RegisterVariable("y", std::make_shared<double>(0));
+        f.Parse("(x*x + y - 1.5) * (x - y*y) - 0.25");
+
+        exprparse::IntervalExpression<double> bounds;
+        bounds.Compile(f);
+
+        std::vector<double> lower_x(size), upper_x(size), lower_y(size), upper_y(size), lower(size), upper(size);
+        for (std::size_t i = 0; i < size; i++) {
+            lower_x[i] = -2 + 4.0 * i / size;
+            upper_x[i] = lower_x[i] + 0.01;
+            lower_y[i] = 1 - 2.0 * i / size;
+            upper_y[i] = lower_y[i] + 0.01;
+        }
+        const double *lower_columns[2] = { lower_x.data(), lower_y.data() };
+        const double *upper_columns[2] = { upper_x.data(), upper_y.data() };
+
+        exprparse::Isa detected = exprparse::DetectedIsa();
+        std::printf("Kernels over %zu elements, detected %s\n", size, exprparse::IsaName(detected));
+
+        exprparse::Status status;
+        double dot_baseline = 0, interval_baseline = 0;
+        for (int isa = exprparse::Isa_Generic; isa <= detected; isa++) {
+            exprparse::SetIsa(static_cast<exprparse::Isa>(isa));
+            std::string name = exprparse::IsaName(exprparse::ActiveIsa());
+
+            e.Parse("dot(w, x)");
+            double dot = NanosecondsPerCall([&]() { sink = e.Eval(status); }, 20000);
+            Report(("dot " + name).c_str(), dot, dot_baseline);
+            ReportCounters("element", static_cast<double>(size));
+
+            double interval = NanosecondsPerCall([&]() { bounds.EvalBatch(lower_columns, upper_columns, size, lower.data(), upper.data(), status); }, 2000) / size;
+            Report(("interval batch " + name).c_str(), interval, interval_baseline);
+            ReportCounters("row", 1);
+
+            if (isa == exprparse::Isa_Generic) {
+                dot_baseline      = dot;
+                interval_baseline = interval;
+            }
+        }
+
+        exprparse::SetIsa(detected);
+    }
+
+    // Error sweep and speed of one approximation against the standard library, the reference in long double.
+    // The maximum relative error must be within the documented bound
+    template<typename Approx, typename Batch, typename Exact, typename Reference>
+    void BenchApproximation(const char *name, double bound, const std::vector<double> &points, Approx approx, Batch batch, Exact exact, Reference reference)
+    {
+        std::vector<double> batched(points.size());
+
+        // Of the scalar function, which may fuse multiply-adds under the compiler flags, and of the kernels of every
+        // supported instruction set
+        double max_relative = 0, max_ulps = 0, worst = 0;
+        exprparse::Isa detected = exprparse::DetectedIsa();
+        for (int isa = exprparse::Isa_Generic; isa <= detected; isa++) {
+            exprparse::SetIsa(static_cast<exprparse::Isa>(isa));
+            batch(points.data(), batched.data(), points.size());
+
+            for (std::size_t i = 0; i < points.size(); i++) {
+                double x = points[i];
+                long double r = reference(static_cast<long double>(x));
+                if (!(std::fabs(r) >= std::numeric_limits<double>::min()) || std::fabs(r) > std::numeric_limits<double>::max())
+                    continue; // Relative errors of denormal, zero and overflowing results are not bounded
+
+                for (double y : { approx(x), batched[i] }) {
+                    double error = static_cast<double>(std::fabs((static_cast<long double>(y) - r) / r));
+                    double ulp   = std::nextafter(std::fabs(static_cast<double>(r)), INFINITY) - std::fabs(static_cast<double>(r));
+                    double ulps  = static_cast<double>(std::fabs(static_cast<long double>(y) - r) / ulp);
+
+                    if (!(error <= max_relative)) {
+                        max_relative = error;
+                        worst        = x;
+                    }
+                    max_ulps = std::max(max_ulps, ulps);
+                }
+            }
+        }
+        exprparse::SetIsa(detected);
+
+        std::printf("%s: max relative error %.3g (%.2f ulp) at %.17g over %zu points\n", name, max_relative, max_ulps, worst, points.size());
+        if (!(max_relative <= bound)) {
+            std::printf("  FAILED: above the documented bound %.3g\n", bound);
+            failures++;
+        }
+
+        std::vector<double> out(points.size());
+        double std_time = NanosecondsPerCall([&]() {
+            for (std::size_t i = 0; i < points.size(); i++)
+                out[i] = exact(points[i]);
+        }, 10) / points.size();
+        double scalar_time = NanosecondsPerCall([&]() {
+            for (std::size_t i = 0; i < points.size(); i++)
+                out[i] = approx(points[i]);
+        }, 10) / points.size();
+        double batch_time = NanosecondsPerCall([&]() { batch(points.data(), out.data(), points.size()); }, 10) / points.size();
+        sink = out[points.size() / 2];
+
+        Report("Standard library", std_time);
+        Report("Approximation", scalar_time, std_time);
+        Report("Approximation over arrays", batch_time, std_time);
+    }
+
+    void BenchApproximations(std::size_t size)
+    {
+        exprparse::workload::Random random(42);
+        auto uniform = [&](double lower, double upper) {
+            std::vector<double> points(size);
+            for (auto &x : points)
+                x = lower + (upper - lower) * random.Uniform();
+            return points;
+        };
+
+        // Arguments of every magnitude: uniform exponent including denormals, and mantissa
+        std::vector<double> positive(size);
+        for (auto &x : positive)
+            x = std::ldexp(1 + random.Uniform(), static_cast<int>(random.Index(2098)) - 1074);
+
+        // Next to multiples of pi / 2, where sin or cos is close to zero
+        std::vector<double> roots(size);
+        for (auto &x : roots) {
+            x = static_cast<double>(random.Index(1000000)) * 1.57079632679489661923;
+            for (std::size_t steps = random.Index(4); steps > 0; steps--)
+                x = std::nextafter(x, random.Index(2) ? INFINITY : -INFINITY);
+        }
+
+        auto concat = [](std::vector<double> a, const std::vector<double> &b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        };
+
+        namespace approx = exprparse::approx;
+        BenchApproximation("exp", 1.5e-16, concat(uniform(-745, 709.78), uniform(-1, 1)),
+            [](double x) { return approx::Exp(x); }, [](const double *x, double *y, std::size_t n) { approx::Exp(x, y, n); },
+            [](double x) { return std::exp(x); }, [](long double x) { return std::exp(x); });
+        BenchApproximation("log", 1.5e-16, concat(positive, uniform(0.5, 2)),
+            [](double x) { return approx::Log(x); }, [](const double *x, double *y, std::size_t n) { approx::Log(x, y, n); },
+            [](double x) { return std::log(x); }, [](long double x) { return std::log(x); });
+        BenchApproximation("sin", 4e-16, concat(concat(uniform(-1.6e6, 1.6e6), uniform(-10, 10)), roots),
+            [](double x) { return approx::Sin(x); }, [](const double *x, double *y, std::size_t n) { approx::Sin(x, y, n); },
+            [](double x) { return std::sin(x); }, [](long double x) { return std::sin(x); });
+        BenchApproximation("cos", 4e-16, concat(concat(uniform(-1.6e6, 1.6e6), uniform(-10, 10)), roots),
+            [](double x) { return approx::Cos(x); }, [](const double *x, double *y, std::size_t n) { approx::Cos(x, y, n); },
+            [](double x) { return std::cos(x); }, [](long double x) { return std::cos(x); });
+        BenchApproximation("tanh", 3e-16, concat(uniform(-20, 20), uniform(-1, 1)),
+            [](double x) { return approx::Tanh(x); }, [](const double *x, double *y, std::size_t n) { approx::Tanh(x, y, n); },
+            [](double x) { return std::tanh(x); }, [](long double x) { return std::tanh(x); });
+    }
+
+    // Table lookups as a node of the tree, against the same interpolation in a registered function
+    // that searches the grid with std::upper_bound, and over arrays
+    void BenchTables(std::size_t points, std::size_t size)
+    {
+        std::vector<double> grid(points), values(points);
+        for (std::size_t i = 0; i < points; i++) {
+            grid[i]   = 10.0 * i / (points - 1);
+            values[i] = std::sin(grid[i]);
+        }
+
+        exprparse::workload::Random random(7);
+        std::vector<double> arguments(size), out(size);
+        for (auto &x : arguments)
+            x = 10 * random.Uniform();
+
+        auto linear = [grid, values](double x) {
+            x = std::min(std::max(x, grid.front()), grid.back());
+            std::size_t i = std::min<std::size_t>(std::upper_bound(grid.begin(), grid.end(), x) - grid.begin(), grid.size() - 1) - 1;
+            return values[i] + (x - grid[i]) * (values[i + 1] - values[i]) / (grid[i + 1] - grid[i]);
+        };
+
+        std::printf("Tables of %zu points over %zu arguments\n", points, size);
+
+        exprparse::Status status;
+        auto x = std::make_shared<double>(0);
+        double baseline = 0;
+
+        for (int kind = 0; kind < 4; kind++) {
+            auto table = std::make_shared<exprparse::Table<double>>();
+            auto interpolation = kind % 2 ? exprparse::Table<double>::Cubic : exprparse::Table<double>::Linear;
+            if (kind < 2)
+                table->SetUniform(0, grid[1], values, interpolation);
+            else
+                table->SetGrid(grid, values, interpolation);
+
+            exprparse::Expression<double> e;
+            e.RegisterVariable("x", x);
+            e.RegisterFunction("f", linear);
+            e.RegisterTable("t", table);
+
+            std::string name = std::string(kind < 2 ? "uniform " : "grid ") + (kind % 2 ? "cubic" : "linear");
+            if (kind == 0) {
+                e.Parse("f(x)");
+                baseline = NanosecondsPerCall([&]() {
+                    for (std::size_t i = 0; i < size; i++) {
+                        *x     = arguments[i];
+                        out[i] = e.Eval(status);
+                    }
+                }, 10) / size;
+                Report("function, upper_bound", baseline);
+            }
+
+            e.Parse("t(x)");
+            double node = NanosecondsPerCall([&]() {
+                for (std::size_t i = 0; i < size; i++) {
+                    *x     = arguments[i];
+                    out[i] = e.Eval(status);
+                }
+            }, 10) / size;
+            double batch = NanosecondsPerCall([&]() { table->Eval(arguments.data(), out.data(), size); }, 10) / size;
+            sink = out[size / 2];
+
+            Report(("table " + name).c_str(), node, baseline);
+            Report(("table " + name + ", arrays").c_str(), batch, baseline);
+        }
+    }
+
+    // Parse and evaluation of a generated corpus, the evaluation over every row of its input data
+    void BenchWorkload(const char *name, const exprparse::workload::Options &options)
+    {
+        exprparse::workload::Workload workload = exprparse::workload::Generate(options);
+
+        exprparse::Expression<double> e;
+        workload.Register(e);
+
+        std::size_t nodes = 0, max_depth = 0;
+        std::vector<exprparse::CompactExpression<double>> compact(workload.sources.size());
+        for (std::size_t i = 0; i < workload.sources.size(); i++) {
+            e.Parse(workload.sources[i]);
+            compact[i].Compile(e);
+            nodes    += e.WorstCaseOperations().nodes;
+            max_depth = std::max(max_depth, workload.depths[i]);
+        }
+
+        std::printf("%s: %zu expressions, %zu nodes, depth up to %zu, %zu rows (seed %llu)\n", name, workload.sources.size(),
+            nodes, max_depth, workload.rows, static_cast<unsigned long long>(options.seed));
+
+        double parse = NanosecondsPerCall([&]() {
+            for (auto &source : workload.sources)
+                e.Parse(source);
+        }, 20) / workload.sources.size();
+        Report("Parse per expression", parse);
+        ReportCounters("node", static_cast<double>(nodes) / workload.sources.size());
+
+        std::vector<exprparse::Expression<double>> trees(workload.sources.size());
+        for (std::size_t i = 0; i < trees.size(); i++) {
+            workload.Register(trees[i]);
+            trees[i].Parse(workload.sources[i]);
+        }
+
+        exprparse::Status status;
+        double eval = NanosecondsPerCall([&]() {
+            for (std::size_t row = 0; row < workload.rows; row++) {
+                workload.Load(row);
+                for (auto &tree : trees)
+                    sink = tree.Eval(status);
+            }
+        }, 5) / workload.rows;
+        Report("Eval per row", eval);
+        ReportCounters("node", static_cast<double>(nodes));
+
+        double compact_eval = NanosecondsPerCall([&]() {
+            for (std::size_t row = 0; row < workload.rows; row++) {
+                workload.Load(row);
+                for (auto &c : compact)
+                    sink = c.Eval(status);
+            }
+        }, 5) / workload.rows;
+        Report("Compact eval per row", compact_eval, eval);
+        ReportCounters("node", static_cast<double>(nodes));
+    }
+
+    // Startup of a worker process that parses a corpus into its own trees, against one that maps the
+    // compact bytecode published in shared memory
+    void BenchSharedStore(const exprparse::workload::Options &options)
+    {
+        exprparse::workload::Workload workload = exprparse::workload::Generate(options);
+
+        exprparse::Expression<double> e;
+        workload.Register(e);
+
+        exprparse::shm::Publisher<double> publisher;
+        for (std::size_t i = 0; i < workload.sources.size(); i++) {
+            e.Parse(workload.sources[i]);
+            publisher.Add("f" + std::to_string(i), e);
+        }
+
+        std::string name = "/exprparse_bench." + std::to_string(getpid());
+        if (publisher.Publish(name) != exprparse::Success) {
+            std::printf("Shared memory store: cannot publish %s\n", name.c_str());
+            return;
+        }
+
+        std::printf("Shared memory store: %zu expressions, %zu bytes shared\n", workload.sources.size(), publisher.PublishedBytes());
+
+        std::vector<exprparse::Expression<double>> trees(workload.sources.size());
+        double parse = NanosecondsPerCall([&]() {
+            for (std::size_t i = 0; i < trees.size(); i++) {
+                workload.Register(trees[i]);
+                trees[i].Parse(workload.sources[i]);
+            }
+        }, 5);
+
+        std::size_t tree_bytes = 0;
+        for (auto &tree : trees)
+            tree_bytes += tree.MemoryUsage();
+
+        exprparse::shm::Store<double> store;
+        double open = NanosecondsPerCall([&]() { store.Open(name, e); }, 50);
+
+        std::printf("  %-28s %10.1f us  %zu bytes per process\n", "Parse corpus", parse / 1000, tree_bytes);
+        std::printf("  %-28s %10.1f us  %zu bytes shared\n", "Open store", open / 1000, store.SharedMemoryUsage());
+
+        std::vector<std::size_t> indices(workload.sources.size());
+        for (std::size_t i = 0; i < indices.size(); i++)
+            store.Find("f" + std::to_string(i), indices[i]);
+
+        exprparse::Status status;
+        double eval = NanosecondsPerCall([&]() {
+            for (std::size_t row = 0; row < workload.rows; row++) {
+                workload.Load(row);
+                for (auto &tree : trees)
+                    sink = tree.Eval(status);
+            }
+        }, 5) / workload.rows;
+        Report("Eval per row", eval);
+
+        double shared_eval = NanosecondsPerCall([&]() {
+            for (std::size_t row = 0; row < workload.rows; row++) {
+                workload.Load(row);
+                for (std::size_t index : indices)
+                    sink = store.Eval(index, status);
+            }
+        }, 5) / workload.rows;
+        Report("Shared store eval per row", shared_eval, eval);
+
+        exprparse::shm::Remove(name);
+    }
+
+    // Pathological input must be rejected in time linear in its length. The budget per character is two orders of
+    // magnitude above the measured time, also of unoptimized builds, and far below any quadratic behavior
+    constexpr double rejection_budget = 1000; // Nanoseconds per character
+
+    void BenchRejection(const char *name, const std::string &source, std::size_t iterations)
+    {
+        exprparse::Expression<double> e;
+        e.RegisterVariable("x", std::make_shared<double>(0));
+
+        std::printf("%s (%zu characters)\n", name, source.size());
+
+        exprparse::Status status = exprparse::Success;
+        double parse = NanosecondsPerCall([&]() { status = e.Parse(source); }, iterations);
+        Report(status != exprparse::Success ? "Parse (rejected)" : "Parse", parse);
+
+        double budget = rejection_budget * source.size();
+        if (status == exprparse::Success || parse > budget) {
+            std::printf("  FAILED: status %d, budget %.1f ns\n", status, budget);
+            failures++;
+        }
+    }
+
+    // Random token sequences with a surplus of opening brackets, unary operators and calls, and random characters
+    std::string Pathological(exprparse::workload::Random &random, std::size_t length, bool tokens)
+    {
+        static const char *const pieces[] = { "(", "(", "-", "sin(", "x*(", "x+", "1e308^", ")", "x" };
+        static const char characters[]    = "()+-*/^x1e.,! ";
+
+        std::string source;
+        while (source.size() < length) {
+            if (tokens)
+                source += pieces[random.Index(sizeof(pieces) / sizeof(pieces[0]))];
+            else
+                source += characters[random.Index(sizeof(characters) - 1)];
+        }
+        return source;
+    }
+
+    void BenchRejections(std::size_t length, std::size_t iterations)
+    {
+        std::string chain = "x";
+        while (chain.size() < length)
+            chain += "-x";
+
+        std::string calls;
+        while (calls.size() < length / 2)
+            calls += "sin(";
+        calls += "x" + std::string(calls.size() / 4, ')');
+
+        BenchRejection("Nested brackets", std::string(length, '(') + "x" + std::string(length, ')'), iterations);
+        BenchRejection("Subtraction chain", chain, iterations);
+        BenchRejection("Unary minus chain", std::string(length, '-') + "x", iterations);
+        BenchRejection("Nested calls", calls, iterations);
+        BenchRejection("Long identifier", std::string(length, 'a'), iterations);
+
+        exprparse::workload::Random random(42);
+        for (int i = 0; i < 4; i++) {
+            BenchRejection("Random tokens", Pathological(random, length, true), iterations);
+            BenchRejection("Random characters", Pathological(random, length, false), iterations);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // Only the checks, quick enough for ctest
+    bool check = argc == 2 && std::strcmp(argv[1], "--check") == 0;
+    if (argc > 1 && !check) {
+        std::fprintf(stderr, "usage: exprparse_bench [--check]\n");
+        return 2;
+    }
+
+    if (check) {
+        BenchRejections(100000, 10);
+        BenchApproximations(1u << 16);
+
+        std::printf("%s\n", failures ? "FAILED" : "passed");
+        return failures ? 1 : 0;
+    }
+
+    if (!counters.Any())
+        std::printf("Hardware counters unavailable (%s), reporting time only\n\n", counters.Error().c_str());
+
+    BenchExpression("x + y", 10000000);
+    BenchExpression("(x * y + 3) / (x - y) - sqrt(x * x + y * y)", 5000000);
+    BenchExpression("x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y+x*y", 1000000);
+    BenchReduction(256, 200000);
+    BenchIntervals("x*x + y*y - 1", 1024);
+    BenchIntervals("(x*x + y - 1.5) * (x - y*y) - 0.25", 1024);
+    BenchIsa(4096);
+    BenchApproximations(1u << 20);
+    BenchTables(1024, 1u << 16);
+
+    exprparse::workload::Options options;
+    options.expressions = 200;
+    options.operators   = 32;
+
+    const std::pair<const char *, exprparse::workload::Shape> shapes[] = {
+        { "Balanced corpus", exprparse::workload::Shape::Balanced },
+        { "Left-deep corpus", exprparse::workload::Shape::LeftDeep },
+        { "Right-deep corpus", exprparse::workload::Shape::RightDeep },
+        { "Random corpus", exprparse::workload::Shape::Random },
+    };
+    for (auto &shape : shapes) {
+        options.shape = shape.second;
+        BenchWorkload(shape.first, options);
+    }
+
+    options.shape       = exprparse::workload::Shape::Random;
+    options.expressions = 2000;
+    options.rows        = 64;
+    BenchSharedStore(options);
+
+    BenchRejections(100000, 100);
+
+    if (failures)
+        std::printf("%d checks FAILED\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+#ifndef _exprparse_workload_h_
+#define _exprparse_workload_h_
+
+#include "exprparse.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Seeded generator of synthetic expressions and input data for benchmarks.
+// The same options and seed produce the same corpus on every platform: the generator uses its own
+// random number generator instead of the implementation-defined standard distributions.
+
+namespace exprparse {
+    namespace workload {
+
+        enum class Shape {
+            Balanced,  // Operators split evenly between both operands
+            LeftDeep,  // ((a + b) + c) + d, as accumulated by code generators
+            RightDeep, // a + b + c + d as typed, which the parser builds right-deep
+            Random     // Operators split uniformly at random
+        };
+
+        struct Options {
+            std::uint64_t seed        = 1;
+            std::size_t   expressions = 100;
+            std::size_t   operators   = 16; // Binary operators per expression, which has operators + 1 leaves
+            std::size_t   max_depth   = 64; // Chains that would get deeper fall back to balanced splits, calls add to it
+            Shape         shape       = Shape::Balanced;
+
+            // Relative weights of the binary operators
+            double add = 1, sub = 1, mul = 1, div = 1;
+
+            double      constant_density = 0.25; // Probability that a leaf is a constant instead of a variable
+            std::size_t variables        = 4;    // Named x0, x1, ...
+            double      function_density = 0.1;  // Probability that an operand is wrapped in a function call
+
+            std::vector<std::string> functions = { "sin", "cos", "tanh" }; // Registered by Workload::Register
+            std::size_t              rows      = 1024; // Rows of input data, values in [0.5, 2)
+        };
+
+        class Random { // splitmix64
+        public:
+            explicit Random(std::uint64_t seed) : _state(seed) {}
+
+            std::uint64_t Next()
+            {
+                std::uint64_t z = (_state += 0x9E3779B97F4A7C15ull);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                return z ^ (z >> 31);
+            }
+
+            double      Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); } // [0, 1)
+            std::size_t Index(std::size_t n) { return static_cast<std::size_t>(Next() % n); }
+
+        private:
+            std::uint64_t _state;
+        };
+
+        struct Workload {
+            std::vector<std::string> sources;
+            std::vector<std::size_t> depths;  // Depth of the syntax tree of each source
+            std::vector<std::string> variable_names;
+            std::vector<std::vector<double>> columns; // Input data, one column per variable
+            std::vector<std::string> functions;
+            std::size_t rows = 0;
+
+            std::vector<std::shared_ptr<double>> variables; // Registered by Register, set by Load
+
+            // Registers the variables and functions of the workload in e
+            void Register(Expression<double> &e)
+            {
+                if (variables.size() != variable_names.size()) {
+                    variables.clear();
+                    for (std::size_t i = 0; i < variable_names.size(); i++)
+                        variables.push_back(std::make_shared<double>(0));
+                }
+
+                for (std::size_t i = 0; i < variable_names.size(); i++)
+                    e.RegisterVariable(variable_names[i], variables[i]);
+
+                for (auto &name : functions) {
+                    if (name == "sin")       e.RegisterFunction(name, [](double v) { return std::sin(v); });
+                    else if (name == "cos")  e.RegisterFunction(name, [](double v) { return std::cos(v); });
+                    else if (name == "tanh") e.RegisterFunction(name, [](double v) { return std::tanh(v); });
+                    else if (name == "exp")  e.RegisterFunction(name, [](double v) { return std::exp(v); });
+                    else if (name == "sqrt") e.RegisterFunction(name, [](double v) { return std::sqrt(std::fabs(v)); });
+                    else                     e.RegisterFunction(name, [](double v) { return v; });
+                }
+            }
+
+            // Sets the registered variables to a row of the input data
+            void Load(std::size_t row)
+            {
+                for (std::size_t i = 0; i < variables.size(); i++)
+                    *variables[i] = columns[i][row];
+            }
+        };
+
+        class Generator {
+        public:
+            explicit Generator(const Options &options) : _options(options), _random(options.seed) {}
+
+            Workload Generate()
+            {
+                Workload workload;
+
+                for (std::size_t i = 0; i < _options.variables; i++)
+                    workload.variable_names.push_back("x" + std::to_string(i));
+                workload.functions = _options.functions;
+                workload.rows      = _options.rows;
+
+                for (std::size_t i = 0; i < _options.expressions; i++) {
+                    Generated expression = Subtree(_options.operators, 1);
+                    workload.sources.push_back(expression.text);
+                    workload.depths.push_back(expression.depth);
+                }
+
+                workload.columns.assign(_options.variables, std::vector<double>(_options.rows));
+                for (auto &column : workload.columns)
+                    for (auto &value : column)
+                        value = 0.5 + 1.5 * _random.Uniform();
+
+                return workload;
+            }
+
+        private:
+            struct Generated {
+                std::string text;
+                char        op    = '\0'; // Top-level operator, '\0' for leaves and calls
+                std::size_t depth = 1;
+            };
+
+            Generated Subtree(std::size_t operators, std::size_t depth)
+            {
+                Generated node = operators ? Operator(operators, depth) : Leaf();
+
+                if (depth > 1 && !_options.functions.empty() && _random.Uniform() < _options.function_density) {
+                    node.text  = _options.functions[_random.Index(_options.functions.size())] + "(" + node.text + ")";
+                    node.op    = '\0';
+                    node.depth += 1;
+                }
+                return node;
+            }
+
+            Generated Leaf()
+            {
+                Generated leaf;
+                if (_options.variables == 0 || _random.Uniform() < _options.constant_density) {
+                    char text[16];
+                    std::snprintf(text, sizeof(text), "%.2f", 0.25 + 0.25 * _random.Index(16));
+                    leaf.text = text;
+                }
+                else {
+                    leaf.text = "x" + std::to_string(_random.Index(_options.variables));
+                }
+                return leaf;
+            }
+
+            Generated Operator(std::size_t operators, std::size_t depth)
+            {
+                std::size_t rest = operators - 1, left = 0;
+
+                Shape shape = _options.shape;
+                if (depth + operators >= _options.max_depth) // A chain would get too deep
+                    shape = Shape::Balanced;
+
+                switch (shape) {
+                    case Shape::Balanced:  left = rest / 2; break;
+                    case Shape::LeftDeep:  left = rest; break;
+                    case Shape::RightDeep: left = 0; break;
+                    case Shape::Random:    left = _random.Index(rest + 1); break;
+                }
+
+                Generated node;
+                node.op = PickOperator();
+
+                Generated l = Subtree(left, depth + 1);
+                Generated r = Subtree(rest - left, depth + 1);
+
+                if (node.op == '-' && l.text == r.text) // Would be zero, and fail as a divisor
+                    node.op = '+';
+
+                // The parser splits at the first + or - outside brackets, otherwise at the first * or /,
+                // so only operands that would be split first need brackets
+                bool additive = node.op == '+' || node.op == '-';
+                bool bracket_left  = additive ? IsAdditive(l.op) : l.op != '\0';
+                bool bracket_right = additive ? false : IsAdditive(r.op);
+
+                node.text  = (bracket_left ? "(" + l.text + ")" : l.text) + " " + node.op + " " + (bracket_right ? "(" + r.text + ")" : r.text);
+                node.depth = 1 + std::max(l.depth, r.depth);
+                return node;
+            }
+
+            char PickOperator()
+            {
+                double total = _options.add + _options.sub + _options.mul + _options.div;
+                double pick  = _random.Uniform() * total;
+
+                if (pick < _options.add) return '+';
+                if (pick < _options.add + _options.sub) return '-';
+                if (pick < _options.add + _options.sub + _options.mul) return '*';
+                return '/';
+            }
+
+            static bool IsAdditive(char op) { return op == '+' || op == '-'; }
+
+            Options _options;
+            Random  _random;
+        };
+
+        inline Workload Generate(const Options &options) { return Generator(options).Generate(); }
+    }
+}
+
+#endif // _exprparse_workload_h_
@@ -8,6 +8,19 @@
 #include <algorithm>    // std::remove
 #include <type_traits>  // std::is_floating_point
 #include <functional>   // std::function
+#include <set>          // std::set
+#include <vector>       // std::vector
+#include <thread>       // std::thread
+#include <atomic>       // std::atomic
+#include <mutex>        // std::mutex
+#include <cctype>       // std::isalnum
+#include <cstdint>      // std::uint8_t, std::uint16_t
+#include <cstring>      // std::memcpy, std::memcmp
+#include <cmath>        // std::signbit, std::sqrt
+#include <limits>       // std::numeric_limits
+#include <cstdio>       // std::snprintf
+#include <cstdlib>      // std::getenv
+#include <unordered_map> // std::unordered_map
 
 #ifdef EP_DEBUG
 #include <iostream>     // std::cout
@@ -18,6 +31,23 @@
 #define EP_LOG(x)
 #endif
 
+// Kernels are compiled for several instruction sets and selected at first use, on x86 with GCC or Clang
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define EP_ISA_DISPATCH
+#define EP_KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define EP_KERNEL_INLINE inline
+#endif
+
+// Kernels never contract multiply-adds, so that every instruction set computes bit-identical results. GCC
+// contracts after inlining, under the options of the kernel sets; Clang when generating the code of the
+// expressions, under the pragma around the kernels.
+#if defined(__GNUC__) && !defined(__clang__)
+#define EP_KERNEL_EXACT __attribute__((optimize("fp-contract=off")))
+#else
+#define EP_KERNEL_EXACT
+#endif
+
 namespace exprparse {
 
     enum Status {
@@ -30,21 +60,342 @@ namespace exprparse {
 
         Error_Not_Compiled,
         Error_Division_By_Zero,
+        Error_Index_Out_Of_Bounds,
 
         Error_Unregistered_Symbol,
         Error_Syntax_Error,
+        Error_Limit_Exceeded,
+
+        Error_Dependency_Cycle,
+
+        Error_Compilation_Failed,
+        Error_Load_Failed,
+
+        Error_Budget_Exceeded,
+        Error_Cancelled,
+
+        Error_Unsupported,
+        Error_Invalid_Table,
+        Error_Invalid_Checkpoint,
+        Error_Invalid_Range,
+        Error_Foreign_Term,
 
         Error_Unknown
 
     };
 
 
+    // Worst-case work of one evaluation. The tree has no loops or branches, so every
+    // node is evaluated exactly once and these counts are exact bounds.
+    struct OperationCount {
+        std::size_t nodes          = 0;
+        std::size_t operators      = 0;
+        std::size_t function_calls = 0; // Calls into registered functions, their cost is not bounded by the library
+        std::size_t elements       = 0; // Array elements read by reductions
+        std::size_t depth          = 0; // Recursion depth of the evaluation
+    };
+
+
+    // Limits of the input accepted by Expression<T>::Parse, checked in a linear pre-scan
+    // before parsing so that adversarial input is rejected early with Error_Limit_Exceeded
+    struct ParseLimits {
+        std::size_t max_length            = static_cast<std::size_t>(-1);
+        std::size_t max_depth             = 4096; // Nesting of the syntax tree, bounds parser and evaluator recursion
+        std::size_t max_nodes             = static_cast<std::size_t>(-1);
+        std::size_t max_identifier_length = static_cast<std::size_t>(-1);
+        std::size_t max_window            = 1 << 20; // Rows of history of lag and rolling functions, allocated when parsing
+        std::size_t max_window_state      = 1 << 22; // Rows of history of all lag and rolling functions of an expression
+    };
+
+
+    // Rewrites applied to parsed and built expressions, see Expression::SetOptimizations
+    enum Optimization : unsigned {
+        Optimize_None       = 0,
+        // Opt-in: long sums of array elements or element products become sum/dot. The kernels reassociate the
+        // additions, so results can differ in the last bits, and a sum of negative zeros becomes +0
+        Optimize_Reductions = 1u << 0,
+        Optimize_Checks     = 1u << 1, // Division and index checks proven unnecessary by variable ranges are removed
+    };
+
+
+    // Instruction sets the reduction and interval kernels are compiled for, see SetIsa
+    enum Isa {
+        Isa_Generic, // Baseline of the compiler flags
+        Isa_SSE4_2,
+        Isa_AVX2,
+        Isa_AVX512,
+    };
+
+
+
+    // Limits of a single evaluation, for expressions from untrusted sources
+    struct EvalBudget {
+        std::size_t              max_operations = static_cast<std::size_t>(-1);
+        const std::atomic<bool> *cancel         = nullptr; // Evaluation stops with Error_Cancelled once set
+        std::size_t              check_interval = 64;      // Operations between polls of cancel
+    };
+
+
+
+    // Static cost model of Expression::Explain, in estimated cycles of one evaluation
+    struct CostModel {
+        double node     = 3;   // Virtual call and pointer chase of every node of the tree
+        double add      = 1;   // + and -
+        double multiply = 1;
+        double divide   = 12;
+        double check    = 1;   // Compare and branch of a division or index check
+        double load     = 1;   // Read of a variable, element or local
+        double element  = 0.5; // Per element of a reduction, vectorized
+        double function = 20;  // Registered function without a hint
+        double table    = 6;   // Interpolation in a table with a uniform grid
+        double window   = 6;   // Row of lag, ema or a rolling window, amortized
+
+        std::map<std::string, double> function_hints; // Cycles of registered functions by name
+    };
+
+    struct CostEstimate {
+        double      cycles = 0;
+        std::size_t memory = 0; // Bytes of nodes and data read by one evaluation
+        std::size_t nodes  = 0;
+    };
+
+
+
+    // State of the lag, ema and rolling functions of an expression, see Expression::Checkpoint.
+    // Values are stored in the machine's representation, for resuming on the same platform.
+    struct StateCheckpoint {
+        std::vector<std::uint8_t> data;
+    };
+
+
+
+    // Closed range of values, unbounded ends are infinite
+    template<typename T>
+    struct Interval {
+        T lower = T(0);
+        T upper = T(0);
+    };
+
+
+
+    // Check left in a parsed expression, see Expression::RuntimeChecks
+    template<typename T>
+    struct RuntimeCheck {
+        enum Kind { Division, Index };
+
+        Kind        kind;
+        std::string operand; // Divisor or index
+        Interval<T> range;   // Range of the operand derived from the declared variable ranges
+    };
+
+
+    template<typename T>
+    class Table;
+
+
     namespace _internal {
 
+        class ScopedIncrement {
+        public:
+            ScopedIncrement(std::size_t &value) : _value(value) { _value++; }
+            ~ScopedIncrement() { _value--; }
+
+        private:
+            std::size_t &_value;
+        };
+
+        // Immutable map of registered symbols of one kind, a hash trie of 32-way nodes. Inserting returns a new
+        // map that copies only the nodes on the path to the new entry and shares everything else, so registering
+        // a symbol copies O(log n) small nodes however many symbols the previous versions hold.
+        template<typename V>
+        class SymbolMap {
+        public:
+            typedef std::pair<const std::string, V> Entry;
+
+            const Entry *Find(const std::string &name) const
+            {
+                std::size_t hash = std::hash<std::string>()(name);
+                const Node *node = _root.get();
+
+                for (unsigned shift = 0; node; shift += fanout_bits) {
+                    if (shift >= hash_bits) { // Bucket of equal hashes
+                        for (auto &entry : node->entries)
+                            if (entry->first == name)
+                                return entry.get();
+                        return nullptr;
+                    }
+
+                    std::uint32_t bit = std::uint32_t(1) << ((hash >> shift) & fanout_mask);
+                    if (!(node->bitmap & bit))
+                        return nullptr;
+
+                    std::size_t slot = Slot(node->bitmap, bit);
+                    if (!node->children[slot]) {
+                        const Entry *entry = node->entries[slot].get();
+                        return entry->first == name ? entry : nullptr;
+                    }
+                    node = node->children[slot].get();
+                }
+                return nullptr;
+            }
+
+            bool Contains(const std::string &name) const { return Find(name) != nullptr; }
+
+            std::size_t Size() const { return _size; }
+
+            // Copy with name added, or replaced if present
+            SymbolMap Insert(const std::string &name, const V &value) const
+            {
+                bool added = true;
+                SymbolMap result;
+                result._root = Insert(_root.get(), std::make_shared<const Entry>(name, value), std::hash<std::string>()(name), 0, added);
+                result._size = _size + (added ? 1 : 0);
+                return result;
+            }
+
+            // Calls f(entry) in name order
+            template<typename F>
+            void ForEach(F f) const
+            {
+                std::vector<const Entry *> entries;
+                entries.reserve(_size);
+                Collect(_root.get(), entries);
+
+                std::sort(entries.begin(), entries.end(), [](const Entry *a, const Entry *b) { return a->first < b->first; });
+                for (auto *entry : entries)
+                    f(*entry);
+            }
+
+        private:
+            static const unsigned    fanout_bits = 5;
+            static const std::size_t fanout_mask = (1u << fanout_bits) - 1;
+            static const unsigned    hash_bits   = sizeof(std::size_t) * 8;
+
+            // Slot i holds a subtree in children[i] or, if that is empty, an entry in entries[i].
+            // Nodes below the last hash bits are buckets holding only entries.
+            struct Node {
+                std::uint32_t                             bitmap = 0;
+                std::vector<std::shared_ptr<const Node>>  children;
+                std::vector<std::shared_ptr<const Entry>> entries;
+            };
+
+            static std::size_t Slot(std::uint32_t bitmap, std::uint32_t bit)
+            {
+                std::uint32_t below = bitmap & (bit - 1);
+                std::size_t count = 0;
+                for (; below; below &= below - 1)
+                    count++;
+                return count;
+            }
+
+            static std::shared_ptr<const Node> Insert(const Node *node, const std::shared_ptr<const Entry> &entry, std::size_t hash,
+                unsigned shift, bool &added)
+            {
+                auto copy = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+
+                if (shift >= hash_bits) {
+                    for (auto &existing : copy->entries)
+                        if (existing->first == entry->first) {
+                            existing = entry;
+                            added    = false;
+                            return copy;
+                        }
+                    copy->entries.push_back(entry);
+                    return copy;
+                }
+
+                std::uint32_t bit  = std::uint32_t(1) << ((hash >> shift) & fanout_mask);
+                std::size_t   slot = Slot(copy->bitmap, bit);
+
+                if (!(copy->bitmap & bit)) {
+                    copy->bitmap |= bit;
+                    copy->children.insert(copy->children.begin() + slot, nullptr);
+                    copy->entries.insert(copy->entries.begin() + slot, entry);
+                }
+                else if (copy->children[slot]) {
+                    copy->children[slot] = Insert(copy->children[slot].get(), entry, hash, shift + fanout_bits, added);
+                }
+                else if (copy->entries[slot]->first == entry->first) {
+                    copy->entries[slot] = entry;
+                    added = false;
+                }
+                else { // Pushes both entries one level down
+                    auto &existing = copy->entries[slot];
+                    auto  child    = Insert(nullptr, existing, std::hash<std::string>()(existing->first), shift + fanout_bits, added);
+                    copy->children[slot] = Insert(child.get(), entry, hash, shift + fanout_bits, added);
+                    existing.reset();
+                }
+                return copy;
+            }
+
+            static void Collect(const Node *node, std::vector<const Entry *> &entries)
+            {
+                if (!node)
+                    return;
+                for (std::size_t i = 0; i < node->entries.size(); i++) {
+                    if (i < node->children.size() && node->children[i])
+                        Collect(node->children[i].get(), entries);
+                    else
+                        entries.push_back(node->entries[i].get());
+                }
+            }
+
+            std::shared_ptr<const Node> _root;
+            std::size_t                 _size = 0;
+        };
+
+        // Cancellation state of a budgeted evaluation. The operation budget itself is checked
+        // before evaluating, since the number of evaluated nodes is known after parsing.
+        class EvalContext {
+        public:
+            EvalContext(const EvalBudget &budget)
+                : _cancel(budget.cancel), _interval(budget.check_interval == 0 ? 1 : budget.check_interval), _until_check(_interval) {}
+
+            // Accounts for operations, false once evaluation has to stop
+            bool Tick(Status &status, std::size_t operations = 1)
+            {
+                if (_stopped)
+                    return false;
+
+                if (operations < _until_check) {
+                    _until_check -= operations;
+                    return true;
+                }
+
+                _until_check = _interval;
+                if (_cancel && _cancel->load(std::memory_order_relaxed)) {
+                    status   = Error_Cancelled;
+                    _stopped = true;
+                    return false;
+                }
+
+                return true;
+            }
+
+            bool Stopped() const { return _stopped; }
+
+        private:
+            const std::atomic<bool> *_cancel;
+            std::size_t              _interval;
+            std::size_t              _until_check;
+            bool                     _stopped = false;
+        };
+
+        inline bool &RealtimeFlag()
+        {
+            static thread_local bool flag = false;
+            return flag;
+        }
+
+        enum class NodeType { Operator, Variable, Constant, Function, Cached, Element, Reduction, Let, Local, Table, Window };
+
         template<typename T>
         class Node {
         public:
             virtual T Eval(Status &status) const = 0;
+            virtual T Eval(Status &status, EvalContext &context) const = 0;
+
+            virtual NodeType Type() const = 0;
         };
 
 
@@ -58,10 +409,41 @@ namespace exprparse {
 
             virtual T Eval(Status &status) const override
             {
-
                 T leftValue  = _left->Eval(status);
                 T rightValue = _right->Eval(status);
 
+                return Apply(leftValue, rightValue, status);
+            }
+
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                if (!context.Tick(status))
+                    return T(0);
+
+                T leftValue  = _left->Eval(status, context);
+                T rightValue = _right->Eval(status, context);
+                if (context.Stopped())
+                    return T(0);
+
+                return Apply(leftValue, rightValue, status);
+            }
+
+            virtual NodeType Type() const override { return NodeType::Operator; }
+
+            void LinkLeft(const std::shared_ptr<Node<T>>  &left)  { _left  = left; }
+            void LinkRight(const std::shared_ptr<Node<T>> &right) { _right = right; }
+
+            // Cleared when the divisor is proven to be nonzero
+            void SetCheckDivisor(bool check) { _check_divisor = check; }
+
+            Operator                        Op()           const { return _operator; }
+            const std::shared_ptr<Node<T>> &Left()         const { return _left; }
+            const std::shared_ptr<Node<T>> &Right()        const { return _right; }
+            bool                            CheckDivisor() const { return _check_divisor; }
+
+        private:
+            T Apply(T leftValue, T rightValue, Status &status) const
+            {
                 switch (_operator) {
                     
                     // TODO?: Use derived classes for each operator instead of enum + switch
@@ -75,7 +457,7 @@ namespace exprparse {
                         return leftValue * rightValue;
 
                     case Operator::Div:
-                        if(rightValue == T(0))
+                        if(_check_divisor && rightValue == T(0))
                         {
                             status = Error_Division_By_Zero;
                             return T(0);
@@ -88,11 +470,9 @@ namespace exprparse {
                 }
             }
 
-            void LinkLeft(const std::shared_ptr<Node<T>>  &left)  { _left  = left; }
-            void LinkRight(const std::shared_ptr<Node<T>> &right) { _right = right; }
-
         private:
             Operator _operator;
+            bool     _check_divisor = true;
 
             std::shared_ptr<Node<T>> _left;
             std::shared_ptr<Node<T>> _right;
@@ -103,11 +483,18 @@ namespace exprparse {
         template<typename T>
         class VariableNode : public Node<T> {
         public:
-            VariableNode(const std::shared_ptr<T> &value) : _value(value) {}
+            VariableNode(const std::string &name, const std::shared_ptr<T> &value) : _name(name), _value(value) {}
+
+            virtual T Eval(Status &) const override { return *_value; }
+            virtual T Eval(Status &status, EvalContext &context) const override { return context.Tick(status) ? *_value : T(0); }
 
-            virtual T Eval(Status &status) const override { return *_value; }
+            virtual NodeType Type() const override { return NodeType::Variable; }
+
+            const std::string        &Name()  const { return _name; }
+            const std::shared_ptr<T> &Value() const { return _value; }
 
         private:
+            std::string        _name;
             std::shared_ptr<T> _value;
         };
 
@@ -118,7 +505,12 @@ namespace exprparse {
         public:
             ConstantNode(T value) : _value(value) {}
 
-            virtual T Eval(Status &status) const override { return _value; }
+            virtual T Eval(Status &) const override { return _value; }
+            virtual T Eval(Status &status, EvalContext &context) const override { return context.Tick(status) ? _value : T(0); }
+
+            virtual NodeType Type() const override { return NodeType::Constant; }
+
+            T Value() const { return _value; }
 
         private:
             const T _value;
@@ -129,335 +521,6157 @@ namespace exprparse {
         template<typename T>
         class FunctionNode : public Node<T> {
         public:
-            FunctionNode(const std::function<T(T)> &function) : _function(function) {}
+            FunctionNode(const std::string &name, const std::function<T(T)> &function) : _name(name), _function(function) {}
 
             virtual T Eval(Status &status) const override { return _function(_argument->Eval(status)); }
 
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                if (!context.Tick(status))
+                    return T(0);
+
+                T argument = _argument->Eval(status, context);
+                if (context.Stopped()) // Skip the call, it may be expensive
+                    return T(0);
+
+                return _function(argument);
+            }
+
+            virtual NodeType Type() const override { return NodeType::Function; }
+
             void LinkArgument(const std::shared_ptr<Node<T>> &arg) { _argument = arg; }
 
+            const std::string              &Name()     const { return _name; }
+            const std::function<T(T)>      &Function() const { return _function; }
+            const std::shared_ptr<Node<T>> &Argument() const { return _argument; }
+
         private:
+            std::string         _name;
             std::function<T(T)> _function;
             std::shared_ptr<Node<T>> _argument;
         };
-    }
 
 
 
-    template<typename T>
-    class Expression {
-        
-        static_assert(std::is_floating_point<T>::value, "T is not floating point type");
+        // Lookup in a registered interpolation table, called directly instead of through std::function
+        template<typename T>
+        class TableNode : public Node<T> {
+        public:
+            TableNode(const std::string &name, const std::shared_ptr<const Table<T>> &table) : _name(name), _table(table) {}
 
-    public:
-        Status RegisterVariable(const std::string &name, const std::shared_ptr<T> &variable)
-        {
-            EP_LOG("Registering variable " << name);
+            virtual T Eval(Status &status) const override { return _table->Eval(_argument->Eval(status)); }
 
-            // Check for function with same name
-            auto it = _functions.find(name);
-            if (it != _functions.end())
-                return Error_Variable_Function_Name_Clash;
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                if (!context.Tick(status))
+                    return T(0);
 
-            // Try inserting new variable
-            auto pair = _symbols.try_emplace(name, variable);
-            return pair.second ? Success : Error_Variable_Already_Registered;
-            //          ^^^^^^ --- False if key-value pair already exists
-        }
+                T argument = _argument->Eval(status, context);
+                return context.Stopped() ? T(0) : _table->Eval(argument);
+            }
 
-        Status RegisterFunction(const std::string &name, const std::function<T(T)> &function)
-        {
-            EP_LOG("Registering function " << name);
+            virtual NodeType Type() const override { return NodeType::Table; }
 
-            // Check for variable with same name
-            auto it = _symbols.find(name);
-            if (it != _symbols.end())
-                return Error_Variable_Function_Name_Clash;
+            void LinkArgument(const std::shared_ptr<Node<T>> &arg) { _argument = arg; }
 
-            // Try inserting new function
-            auto pair = _functions.try_emplace(name, function);
-            return pair.second ? Success : Error_Function_Already_Registered;
-            //          ^^^^^^ --- False if key-value pair already exists
-        }
+            const std::string                    &Name()     const { return _name; }
+            const std::shared_ptr<const Table<T>> &GetTable() const { return _table; }
+            const std::shared_ptr<Node<T>>        &Argument() const { return _argument; }
 
-        T Eval(Status &status) const
-        {
-            EP_LOG("Evaluating expression");
+        private:
+            std::string                     _name;
+            std::shared_ptr<const Table<T>> _table;
+            std::shared_ptr<Node<T>>        _argument;
+        };
 
-            if (!_base) { // The AST is empty
-                status = Error_Not_Compiled;
-                return T(0);
-            } 
 
-            status = Success;
-            return _base->Eval(status);
-        }
 
-        Status Parse(std::string expr_string);
+        // Element of an array variable, at a constant index checked when parsing
+        // or at a computed index checked when evaluating
+        template<typename T>
+        class ElementNode : public Node<T> {
+        public:
+            ElementNode(const std::string &name, const std::shared_ptr<std::vector<T>> &array, std::size_t index)
+                : _name(name), _array(array), _index(index) {}
 
-    private:
-        std::shared_ptr<_internal::Node<T>> ParseSubString(
-            std::string::const_iterator begin, std::string::const_iterator end, Status &status
-        #ifdef EP_DEBUG
-        , int rec_depth
-        #endif    
-        );
+            ElementNode(const std::string &name, const std::shared_ptr<std::vector<T>> &array, const std::shared_ptr<Node<T>> &index)
+                : _name(name), _array(array), _index(0), _index_node(index) {}
 
-    private:
-        std::map<std::string, std::shared_ptr<T>> _symbols;
-        std::map<std::string, std::function<T(T)>> _functions;
+            virtual T Eval(Status &status) const override
+            {
+                if (!_index_node)
+                    return _array->data()[_index];
 
-        std::shared_ptr<_internal::Node<T>> _base;
-    };
+                return Lookup(_index_node->Eval(status), status);
+            }
 
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                if (!context.Tick(status))
+                    return T(0);
 
-#ifdef EP_DEBUG
-#define _exprparse_parse_substring(b, e, s) ParseSubString(b, e, s, rec_depth + 1)
-#else
-#define _exprparse_parse_substring(b, e, s) ParseSubString(b, e, s)
-#endif
+                if (!_index_node)
+                    return _array->data()[_index];
 
-    template<typename T>
-    Status Expression<T>::Parse(std::string expr_string)
-    {
-        EP_LOG("Parsing expression");
+                T index = _index_node->Eval(status, context);
+                return context.Stopped() ? T(0) : Lookup(index, status);
+            }
 
-        // Remove blank spaces
-        auto new_end = std::remove(expr_string.begin(), expr_string.end(), ' ');
+            virtual NodeType Type() const override { return NodeType::Element; }
 
-        // Parse
-        Status status = Success;
-        _base = ParseSubString(expr_string.begin(), new_end, status
-        #ifdef EP_DEBUG
-        , 0
-        #endif
-        );
+            const std::string                      &Name()      const { return _name; }
+            const std::shared_ptr<std::vector<T>>  &Array()     const { return _array; }
+            std::size_t                             Index()     const { return _index; }     // Constant index
+            const std::shared_ptr<Node<T>>         &IndexNode() const { return _index_node; } // Computed index, empty if constant
 
-        if (status != Success) // Clear the AST since it's invalid
-            _base.reset();
+            void LinkIndex(const std::shared_ptr<Node<T>> &index) { _index_node = index; }
 
-        return status;
-    }
+            // Cleared when the computed index is proven to be in bounds
+            void SetCheckIndex(bool check) { _check_index = check; }
+            bool CheckIndex() const { return _check_index; }
 
+        private:
+            T Lookup(T index, Status &status) const
+            {
+                // Fractional indices are truncated, NaN fails the comparison
+                if (_check_index && !(index >= T(0) && index < T(_array->size()))) {
+                    status = Error_Index_Out_Of_Bounds;
+                    return T(0);
+                }
+                return _array->data()[static_cast<std::size_t>(index)];
+            }
 
+        private:
+            std::string                     _name;
+            std::shared_ptr<std::vector<T>> _array;
+            std::size_t                     _index;
+            std::shared_ptr<Node<T>>        _index_node;
+            bool                            _check_index = true;
+        };
 
-#define _exprparse_parse_error(error) {\
-EP_LOG_INDENT();\
-EP_LOG(#error);\
-status = error;\
-return nullptr;\
-}
 
-    template<typename T>
-    std::shared_ptr<_internal::Node<T>> Expression<T>::ParseSubString(
-        std::string::const_iterator begin, std::string::const_iterator end, Status &status
-        #ifdef EP_DEBUG
-        , int rec_depth
-        #endif  
-        )
-    {
-        EP_LOG_INDENT();
-        #ifdef EP_DEBUG
-        rec_depth++;
-        #endif
-        EP_LOG("SUB_EXPR '" << std::string(begin, end) << "'");
 
-        auto it                   = begin;
-        int  bracket_depth        = 0;     
-        char operator_symbol      = '\0';
-        bool found_plus_or_minus  = false; // +/- has precedence over *// when constructing tree
+#if defined(__clang__)
+#pragma float_control(push)
+#pragma clang fp contract(off)
+#endif
 
-        while (it != end) {
-            
-            if (*it == '(') bracket_depth++;
-            if (*it == ')') bracket_depth--;
+        namespace kernels {
 
-            if (bracket_depth == 0) { // Only look for operator if outside paranthesis
+            // Reductions over contiguous storage with independent accumulators, which
+            // breaks the dependency chain between additions and lets the compiler vectorize
 
-                if (*it == '+' || *it == '-')
-                {
-                    found_plus_or_minus = true;
-                    operator_symbol     = *it;
+            const std::size_t lanes = 8;
 
-                    EP_LOG_INDENT();
-                    EP_LOG("OPERATOR " << *it);
-                    break;
-                }
+            template<typename T>
+            EP_KERNEL_INLINE T Sum(const T *a, std::size_t n)
+            {
+                T acc[lanes] = {};
+                std::size_t i = 0;
+                for (; i + lanes <= n; i += lanes)
+                    for (std::size_t k = 0; k < lanes; k++)
+                        acc[k] += a[i + k];
+
+                T sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+                for (; i < n; i++)
+                    sum += a[i];
+                return sum;
             }
 
-            it++;
+            template<typename T>
+            EP_KERNEL_INLINE T Dot(const T *a, const T *b, std::size_t n)
+            {
+                T acc[lanes] = {};
+                std::size_t i = 0;
+                for (; i + lanes <= n; i += lanes)
+                    for (std::size_t k = 0; k < lanes; k++)
+                        acc[k] += a[i + k] * b[i + k];
+
+                T sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+                for (; i < n; i++)
+                    sum += a[i] * b[i];
+                return sum;
+            }
+
+            template<typename T>
+            EP_KERNEL_INLINE T Max(const T *a, std::size_t n)
+            {
+                T acc[lanes];
+                for (std::size_t k = 0; k < lanes; k++)
+                    acc[k] = -std::numeric_limits<T>::infinity();
+
+                std::size_t i = 0;
+                for (; i + lanes <= n; i += lanes)
+                    for (std::size_t k = 0; k < lanes; k++)
+                        acc[k] = a[i + k] > acc[k] ? a[i + k] : acc[k];
+
+                T max = acc[0];
+                for (std::size_t k = 1; k < lanes; k++)
+                    max = acc[k] > max ? acc[k] : max;
+                for (; i < n; i++)
+                    max = a[i] > max ? a[i] : max;
+                return max;
+            }
+
+            template<typename T>
+            EP_KERNEL_INLINE T Min(const T *a, std::size_t n)
+            {
+                T acc[lanes];
+                for (std::size_t k = 0; k < lanes; k++)
+                    acc[k] = std::numeric_limits<T>::infinity();
+
+                std::size_t i = 0;
+                for (; i + lanes <= n; i += lanes)
+                    for (std::size_t k = 0; k < lanes; k++)
+                        acc[k] = a[i + k] < acc[k] ? a[i + k] : acc[k];
+
+                T min = acc[0];
+                for (std::size_t k = 1; k < lanes; k++)
+                    min = acc[k] < min ? acc[k] : min;
+                for (; i < n; i++)
+                    min = a[i] < min ? a[i] : min;
+                return min;
+            }
         }
 
-        if (bracket_depth != 0) // Start- and end brackets should cancel out
-            _exprparse_parse_error(Error_Syntax_Error);
 
-        if (!found_plus_or_minus) { // Only pick * or / operators if + or - aren't found
-            
-            it = begin;
-            while (it != end) {
-            
-                if (*it == '(') bracket_depth++;
-                if (*it == ')') bracket_depth--;
 
-                if (bracket_depth == 0) { // Only look for operator if outside paranthesis
+        namespace interval {
 
-                    if (*it == '*' || *it == '/')
-                    {
-                        operator_symbol = *it;
+            // Outward rounding by at least one ulp. Unlike std::nextafter this is branch free
+            // arithmetic, so loops over batches of intervals vectorize. Infinite ends are kept.
+            // The smallest normal number moves zero ends without denormal operands, which are slow in AVX-512.
+            template<typename T>
+            inline T Down(T x)
+            {
+                T r = x - (std::fabs(x) * std::numeric_limits<T>::epsilon() + std::numeric_limits<T>::min());
+                return r == r ? r : x;
+            }
 
-                        EP_LOG_INDENT();
-                        EP_LOG("OPERATOR " << *it);
-                        break;
-                    }
+            template<typename T>
+            inline T Up(T x)
+            {
+                T r = x + (std::fabs(x) * std::numeric_limits<T>::epsilon() + std::numeric_limits<T>::min());
+                return r == r ? r : x;
+            }
+
+            // Product where zero times infinity is zero, as for the ends of intervals. A NaN product of operands
+            // without NaN can only be that case. Both sides of each select are computed first and every select
+            // has a single condition, which lets compilers turn them into vector blends.
+            template<typename T>
+            inline T Mul(T x, T y)
+            {
+                T p = x * y, s = x + y;
+                T zero = s == s ? T(0) : p;
+                return p == p ? p : zero;
+            }
+
+            template<typename T>
+            inline T Min4(T a, T b, T c, T d)
+            {
+                T ab = b < a ? b : a, cd = d < c ? d : c;
+                return cd < ab ? cd : ab;
+            }
+
+            template<typename T>
+            inline T Max4(T a, T b, T c, T d)
+            {
+                T ab = a < b ? b : a, cd = c < d ? d : c;
+                return ab < cd ? cd : ab;
+            }
+
+            template<typename T>
+            inline void Add(T al, T au, T bl, T bu, T &l, T &u)
+            {
+                l = Down(al + bl);
+                u = Up(au + bu);
+            }
+
+            template<typename T>
+            inline void Sub(T al, T au, T bl, T bu, T &l, T &u)
+            {
+                l = Down(al - bu);
+                u = Up(au - bl);
+            }
+
+            template<typename T>
+            inline void Multiply(T al, T au, T bl, T bu, T &l, T &u)
+            {
+                T p1 = Mul(al, bl), p2 = Mul(al, bu), p3 = Mul(au, bl), p4 = Mul(au, bu);
+                l = Down(Min4(p1, p2, p3, p4));
+                u = Up(Max4(p1, p2, p3, p4));
+            }
+
+            // x * x of the same operand, never negative unlike the product of independent intervals
+            template<typename T>
+            inline void Square(T al, T au, T &l, T &u)
+            {
+                T ll = al * al, uu = au * au;
+                T low_ll = Down(ll), low_uu = Down(uu);
+                T low = au < T(0) ? low_uu : T(0);
+                l = al > T(0) ? low_ll : low;
+                u = Up(ll < uu ? uu : ll);
+            }
+
+            // Points where the divisor is zero are excluded, they fail with Error_Division_By_Zero
+            // when evaluated. A divisor of exactly [0, 0] has no valid points and reports that error.
+            template<typename T>
+            inline bool Divide(T al, T au, T bl, T bu, T &l, T &u)
+            {
+                const T infinity = std::numeric_limits<T>::infinity();
+
+                if (bl > T(0) || bu < T(0)) {
+                    T q1 = al / bl, q2 = al / bu, q3 = au / bl, q4 = au / bu;
+                    l = Down(Min4(q1, q2, q3, q4));
+                    u = Up(Max4(q1, q2, q3, q4));
+                    return true;
                 }
 
-                it++;
+                if (bl == T(0) && bu == T(0)) {
+                    l = u = T(0);
+                    return false;
+                }
+
+                if (bl == T(0)) // [0, d] divides like multiplying with [1/d, inf]
+                    Multiply(al, au, Down(T(1) / bu), infinity, l, u);
+                else if (bu == T(0)) // [c, 0] like [-inf, 1/c]
+                    Multiply(al, au, -infinity, Up(T(1) / bl), l, u);
+                else {
+                    l = -infinity;
+                    u = infinity;
+                }
+                return true;
             }
         }
 
-        if (operator_symbol != '\0') {
 
-            using namespace _internal;
 
-            std::shared_ptr<OperatorNode<T>> node;
+        // Approximations of elementary functions in double precision without branches or table lookups,
+        // so loops over them vectorize. Reduction to a small interval followed by the polynomials of fdlibm.
+        namespace approx {
 
-            switch (operator_symbol) {
-                case '+':
-                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Add);
-                    EP_LOG_INDENT();
-                    EP_LOG("ADD_NODE");
-                    break;
+            const double shifter = 6755399441055744.0; // 1.5 * 2^52, adding it rounds to an integer held in the low bits
 
-                case '-':
-                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Sub);
-                    EP_LOG_INDENT();
-                    EP_LOG("SUB_NODE");
-                    break;
+            EP_KERNEL_INLINE std::uint64_t Bits(double x)
+            {
+                std::uint64_t bits;
+                std::memcpy(&bits, &x, sizeof(bits));
+                return bits;
+            }
 
-                case '*':
-                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Mul);
-                    EP_LOG_INDENT();
-                    EP_LOG("MUL_NODE");
-                    break;
+            EP_KERNEL_INLINE double FromBits(std::uint64_t bits)
+            {
+                double x;
+                std::memcpy(&x, &bits, sizeof(x));
+                return x;
+            }
 
-                case '/':
-                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Div);
-                    EP_LOG_INDENT();
-                    EP_LOG("DIV_NODE");
-                    break;
+            // 2^n of an integer n in [-1022, 1023]
+            EP_KERNEL_INLINE double Pow2(double n) { return FromBits((Bits(n + shifter) - Bits(shifter) + 1023) << 52); }
 
-                default:
-                    _exprparse_parse_error(Error_Unknown); // What the hell ?
-                    break;
+            EP_KERNEL_INLINE double Exp(double x)
+            {
+                const double log2e  = 1.44269504088896338700e+00;
+                const double ln2_hi = 6.93147180369123816490e-01, ln2_lo = 1.90821492927058770002e-10;
+                const double overflow = 709.782712893383973096, underflow = -745.13321910194110842;
+
+                const double P1 =  1.66666666666666019037e-01, P2 = -2.77777777770155933842e-03, P3 = 6.61375632143793436117e-05;
+                const double P4 = -1.65339022054652515390e-06, P5 =  4.13813679705723846039e-08;
+
+                double xc = x < overflow ? x : overflow; // NaN as well
+                xc = xc > underflow ? xc : underflow;
+
+                // x = k ln2 + r with |r| <= ln2 / 2
+                double k  = (xc * log2e + shifter) - shifter;
+                double hi = xc - k * ln2_hi, lo = k * ln2_lo, r = hi - lo;
+
+                double z = r * r;
+                double c = r - z * (P1 + z * (P2 + z * (P3 + z * (P4 + z * P5))));
+                double y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+
+                double k1 = (k * 0.5 + shifter) - shifter; // Two factors keep both powers normal
+                y = y * Pow2(k1) * Pow2(k - k1);
+
+                y = x > overflow ? std::numeric_limits<double>::infinity() : y;
+                y = x < underflow ? 0.0 : y;
+                return x == x ? y : x;
             }
 
-            if (begin != it) // Right hand side is non-empty
+            EP_KERNEL_INLINE double Log(double x)
             {
-                node->LinkLeft( _exprparse_parse_substring(begin, it, status));
+                const double ln2_hi = 6.93147180369123816490e-01, ln2_lo = 1.90821492927058770002e-10;
+                const double sqrt2  = 1.41421356237309504880;
+
+                const double Lg1 = 6.666666666666735130e-01, Lg2 = 3.999999999940941908e-01, Lg3 = 2.857142874366239149e-01;
+                const double Lg4 = 2.222219843214978396e-01, Lg5 = 1.818357216161805012e-01, Lg6 = 1.531383769920937332e-01;
+                const double Lg7 = 1.479819860511658591e-01;
+
+                // Denormals are scaled into the normal range
+                bool   denormal = x < std::numeric_limits<double>::min();
+                double xs       = denormal ? x * 18014398509481984.0 : x; // 2^54
+                double offset   = denormal ? 1023.0 + 54.0 : 1023.0;
+
+                // x = 2^k m with m in [sqrt(2) / 2, sqrt(2))
+                std::uint64_t bits = Bits(xs);
+                double e = FromBits(Bits(shifter) + (bits >> 52)) - shifter;
+                double m = FromBits((bits & 0x000fffffffffffffull) | 0x3ff0000000000000ull);
+
+                bool   high = m > sqrt2;
+                double k    = high ? e - offset + 1.0 : e - offset;
+                double f    = (high ? m * 0.5 : m) - 1.0;
+
+                double s = f / (2.0 + f), z = s * s, w = z * z;
+                double R    = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7))) + w * (Lg2 + w * (Lg4 + w * Lg6));
+                double hfsq = 0.5 * f * f;
+                double y    = k * ln2_hi - ((hfsq - (s * (hfsq + R) + k * ln2_lo)) - f);
+
+                y = x == std::numeric_limits<double>::infinity() ? x : y;
+                y = x == 0.0 ? -std::numeric_limits<double>::infinity() : y;
+                y = x < 0.0 ? std::numeric_limits<double>::quiet_NaN() : y;
+                return x == x ? y : x;
             }
-            else if (operator_symbol == '-') // Negative sign (-x becomes 0 - x)
+
+            // Largest argument of Sin and Cos, beyond it the reduction by multiples of pi / 2 is not exact
+            const double max_trigonometric = 1.6e6;
+
+            // sin(x + quadrant pi / 2)
+            EP_KERNEL_INLINE double SinQuadrant(double x, std::uint64_t quadrant)
             {
-                EP_LOG_INDENT();
-                EP_LOG("NEGATE")
-                node->LinkLeft(std::make_shared<_internal::ConstantNode<T>>(T(0)));
+                const double two_over_pi = 6.36619772367581382433e-01;
+                const double pio2_1 = 1.57079632673412561417e+00, pio2_2 = 6.07710050630396597660e-11, pio2_3 = 2.02226624871116645580e-21;
+                const double pio2_3t = 8.47842766036889956997e-32;
+
+                const double S1 = -1.66666666666666324348e-01, S2 =  8.33333333332248946124e-03, S3 = -1.98412698298579493134e-04;
+                const double S4 =  2.75573137070700676789e-06, S5 = -2.50507602534068634195e-08, S6 =  1.58969099521155010221e-10;
+
+                const double C1 =  4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03, C3 =  2.48015872894767294178e-05;
+                const double C4 = -2.75573143513906633035e-07, C5 =  2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+
+                // x = k pi / 2 + r with |r| <= pi / 4. The products with the first parts of pi / 2, which have
+                // 33 bits, are exact for |k| < 2^20; the last part keeps r accurate next to the roots.
+                double kd = x * two_over_pi + shifter;
+                double k  = kd - shifter;
+                std::uint64_t q = Bits(kd) + quadrant; // k modulo 4 in the low bits
+
+                double r = (((x - k * pio2_1) - k * pio2_2) - k * pio2_3) - k * pio2_3t;
+                double z = r * r;
+
+                double sin = r + r * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+                double hz  = 0.5 * z, w = 1.0 - hz;
+                double cos = w + (((1.0 - w) - hz) + z * z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6))))));
+
+                double y = (q & 1) ? cos : sin;
+                y = (q & 2) ? -y : y;
+                return std::fabs(x) <= max_trigonometric ? y : std::numeric_limits<double>::quiet_NaN();
             }
-            else // RH is empty but operator is not minus
+
+            EP_KERNEL_INLINE double Sin(double x) { return SinQuadrant(x, 0); }
+            EP_KERNEL_INLINE double Cos(double x) { return SinQuadrant(x, 1); }
+
+            EP_KERNEL_INLINE double Tanh(double x)
             {
-                _exprparse_parse_error(Error_Syntax_Error);
+                const double P0 = -9.64399179425052238628e-01, P1 = -9.92877231001918586564e+01, P2 = -1.61468768441708447952e+03;
+                const double Q0 =  1.12811678491632931402e+02, Q1 =  2.23548839060100448583e+03, Q2 =  4.84406305325125486048e+03;
+
+                // Rational approximation of Cephes near zero, where 1 - 2 / (e^2x + 1) cancels
+                double z     = x * x;
+                double small = x + x * z * ((P0 * z + P1) * z + P2) / (((z + Q0) * z + Q1) * z + Q2);
+
+                double a     = std::fabs(x);
+                double large = 1.0 - 2.0 / (Exp(2.0 * a) + 1.0);
+                large = x < 0.0 ? -large : large;
+
+                return a < 0.625 ? small : large;
             }
+        }
 
-            node->LinkRight(_exprparse_parse_substring(it + 1, end,  status));
-            //                             ^^^^^^ --- plus one to omit operator        
 
-            if (status == Success)
-                return node;
-            else
-                return nullptr;
 
-        } else {
-            
-            // Strip potential brackets
-            if (*begin == '(' && *(end - 1) == ')')
+        // Lookups of interpolation tables, see exprparse::Table. Cells are indexed with 32-bit integers and
+        // every select has precomputed operands, so loops over batches vectorize with gathers.
+        namespace table {
+
+            // Piecewise polynomial of a table, cell i is c[k] + u * (c[k + 1] + ...) with k = i * stride,
+            // where u is the offset of the argument from the start of the cell
+            template<typename T>
+            struct Cells {
+                const T *coefficients;
+                const T *grid;       // Start of every cell, null for uniform grids
+                T        first, last;
+                T        step, inverse;
+                int      last_cell;
+                int      stride;     // 2 for linear, 4 for cubic polynomials
+            };
+
+            template<typename T, int stride>
+            EP_KERNEL_INLINE T Polynomial(const T *c, int k, T u)
             {
-                EP_LOG_INDENT();
-                EP_LOG("STRIP_BRACKETS");
+                return stride == 2 ? c[k] + u * c[k + 1] : c[k] + u * (c[k + 1] + u * (c[k + 2] + u * c[k + 3]));
+            }
 
-                begin++; 
-                end--;
+            // Arguments outside the grid take the end values. NaN selects the first cell, the cell
+            // computed from it would be out of range.
+            template<typename T>
+            EP_KERNEL_INLINE T Clamp(const Cells<T> &cells, T x)
+            {
+                T clamped = x > cells.first ? x : cells.first;
+                return clamped < cells.last ? clamped : cells.last;
+            }
 
-                if (begin == end) // Empty bracket
-                    return std::make_shared<_internal::ConstantNode<T>>(T(0));
+            // Like Clamp but keeps NaN, which then propagates through the offset in the cell
+            template<typename T>
+            EP_KERNEL_INLINE T Offset(const Cells<T> &cells, T x, T start)
+            {
+                T clamped = x < cells.first ? cells.first : x;
+                clamped = clamped > cells.last ? cells.last : clamped;
+                return clamped - start;
+            }
 
-                if (begin > end) 
-                    // Only happens if substring is odd length 
-                    // (meaning start- and end brackets aren't one-to-one)
-                    _exprparse_parse_error(Error_Syntax_Error);
+            // Truncation of the nonnegative position is its floor. Rounding is monotonic, so the cell
+            // never decreases with the argument, which Table::Bounds relies on.
+            template<typename T>
+            EP_KERNEL_INLINE int UniformCell(const Cells<T> &cells, T clamped)
+            {
+                int cell = static_cast<int>((clamped - cells.first) * cells.inverse);
+                return cell < cells.last_cell ? cell : cells.last_cell;
+            }
 
-                return _exprparse_parse_substring(begin, end, status);
+            // Last cell starting at or before the argument, by a binary search whose steps depend only on the size
+            template<typename T>
+            EP_KERNEL_INLINE int GridCell(const Cells<T> &cells, T clamped)
+            {
+                int cell = 0;
+                for (int n = cells.last_cell + 1; n > 1; ) {
+                    int half = n / 2;
+                    cell = cells.grid[cell + half] <= clamped ? cell + half : cell;
+                    n -= half;
+                }
+                return cell;
             }
 
-            // Check for constant
-            std::stringstream ss;
-            ss << std::string(begin, end);
-            T value;
-            ss >> value; // Try converting to T (double / float)
+            template<typename T, int stride>
+            EP_KERNEL_INLINE T Uniform(const Cells<T> &cells, T x)
+            {
+                int cell = UniformCell(cells, Clamp(cells, x));
+                return Polynomial<T, stride>(cells.coefficients, cell * stride, Offset(cells, x, cells.first + static_cast<T>(cell) * cells.step));
+            }
 
-            if (!ss.fail()) {
-                EP_LOG_INDENT();
-                EP_LOG("CONST_NODE " << value);
+            template<typename T, int stride>
+            EP_KERNEL_INLINE T Grid(const Cells<T> &cells, T x)
+            {
+                int cell = GridCell(cells, Clamp(cells, x));
+                return Polynomial<T, stride>(cells.coefficients, cell * stride, Offset(cells, x, cells.grid[cell]));
+            }
+        }
 
-                return std::make_shared<_internal::ConstantNode<T>>(value);
-            } 
-            else 
+
+
+        namespace kernels {
+
+            // Interval operations over blocks of rows, operands and results as separate lower and upper ends
+
+            template<typename T>
+            EP_KERNEL_INLINE void IntervalAdd(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n)
             {
-                // Look for variable
-                auto v_it = _symbols.find(std::string(begin, end));
+                for (std::size_t i = 0; i < n; i++)
+                    interval::Add(al[i], au[i], bl[i], bu[i], l[i], u[i]);
+            }
 
-                if (v_it != _symbols.end())
-                {
-                    EP_LOG_INDENT();
-                    EP_LOG("VAR_NODE " << v_it->first);
+            template<typename T>
+            EP_KERNEL_INLINE void IntervalSub(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n)
+            {
+                for (std::size_t i = 0; i < n; i++)
+                    interval::Sub(al[i], au[i], bl[i], bu[i], l[i], u[i]);
+            }
 
-                    return std::make_shared<_internal::VariableNode<T>>(v_it->second);
-                    //                                           SYMBOL --- ^^^^^^
-                }
+            template<typename T>
+            EP_KERNEL_INLINE void IntervalMultiply(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n)
+            {
+                for (std::size_t i = 0; i < n; i++)
+                    interval::Multiply(al[i], au[i], bl[i], bu[i], l[i], u[i]);
+            }
 
-                // Look for function
-                auto func_end = begin;
+            template<typename T>
+            EP_KERNEL_INLINE void IntervalSquare(const T *al, const T *au, T *l, T *u, std::size_t n)
+            {
+                for (std::size_t i = 0; i < n; i++)
+                    interval::Square(al[i], au[i], l[i], u[i]);
+            }
 
-                // Sub expression must end with left bracket
-                if(*(end - 1) != ')')
-                    _exprparse_parse_error(Error_Syntax_Error);
+            // False if any divisor is exactly [0, 0]
+            template<typename T>
+            EP_KERNEL_INLINE bool IntervalDivide(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n)
+            {
+                bool valid = true;
+                for (std::size_t i = 0; i < n; i++)
+                    valid &= interval::Divide(al[i], au[i], bl[i], bu[i], l[i], u[i]);
+                return valid;
+            }
 
-                // Extract function name before parenthesis
-                while (func_end != end && *func_end != '(')
-                    func_end++;
-                if (*func_end != '(') // Function has no arguments
-                    _exprparse_parse_error(Error_Syntax_Error);
+            // Approximations over arrays, computed in double precision
+#define EP_APPROX_KERNEL(name) \
+            template<typename T> \
+            EP_KERNEL_INLINE void Approx##name(const T *x, T *y, std::size_t n) \
+            { \
+                for (std::size_t i = 0; i < n; i++) \
+                    y[i] = static_cast<T>(approx::name(static_cast<double>(x[i]))); \
+            }
 
-                
-                auto f_it = _functions.find(std::string(begin, func_end));
-                if (f_it != _functions.end())
-                {
-                    EP_LOG_INDENT();
-                    EP_LOG("FUNC_NODE " << f_it->first);
+            EP_APPROX_KERNEL(Exp)
+            EP_APPROX_KERNEL(Log)
+            EP_APPROX_KERNEL(Sin)
+            EP_APPROX_KERNEL(Cos)
+            EP_APPROX_KERNEL(Tanh)
 
-                    auto node = std::make_shared<_internal::FunctionNode<T>>(f_it->second);
+#undef EP_APPROX_KERNEL
 
-                    // Evaluate argument               vvv ---- vvv --- Strip brackets
-                    auto arg = _exprparse_parse_substring(func_end + 1, end - 1, status);
-                    if (status != Success)
-                        return nullptr;
+            // Interpolation table over arrays. The cells are copied and y is restricted, otherwise stores
+            // could alias the coefficients and the gathers would not vectorize.
+            template<typename T>
+            EP_KERNEL_INLINE void TableLookup(const table::Cells<T> &table, const T *x, T *__restrict y, std::size_t n)
+            {
+                const table::Cells<T> cells = table;
 
-                    node->LinkArgument(arg);
-                    return node;
+                if (!cells.grid && cells.stride == 2)
+                    for (std::size_t i = 0; i < n; i++) y[i] = table::Uniform<T, 2>(cells, x[i]);
+                else if (!cells.grid)
+                    for (std::size_t i = 0; i < n; i++) y[i] = table::Uniform<T, 4>(cells, x[i]);
+                else if (cells.stride == 2)
+                    for (std::size_t i = 0; i < n; i++) y[i] = table::Grid<T, 2>(cells, x[i]);
+                else
+                    for (std::size_t i = 0; i < n; i++) y[i] = table::Grid<T, 4>(cells, x[i]);
+            }
 
-                } else {
-                    _exprparse_parse_error(Error_Unregistered_Symbol);
-                }
+            template<typename T>
+            struct KernelSet {
+                T (*sum)(const T *, std::size_t);
+                T (*dot)(const T *, const T *, std::size_t);
+                T (*min)(const T *, std::size_t);
+                T (*max)(const T *, std::size_t);
+
+                void (*interval_add)(const T *, const T *, const T *, const T *, T *, T *, std::size_t);
+                void (*interval_sub)(const T *, const T *, const T *, const T *, T *, T *, std::size_t);
+                void (*interval_multiply)(const T *, const T *, const T *, const T *, T *, T *, std::size_t);
+                void (*interval_square)(const T *, const T *, T *, T *, std::size_t);
+                bool (*interval_divide)(const T *, const T *, const T *, const T *, T *, T *, std::size_t);
+
+                void (*exp)(const T *, T *, std::size_t);
+                void (*log)(const T *, T *, std::size_t);
+                void (*sin)(const T *, T *, std::size_t);
+                void (*cos)(const T *, T *, std::size_t);
+                void (*tanh)(const T *, T *, std::size_t);
+
+                void (*table)(const table::Cells<T> &, const T *, T *, std::size_t);
+            };
+
+            // Copies of the kernels compiled for one instruction set. AVX-512 includes FMA, but multiply-adds are
+            // not contracted (EP_KERNEL_EXACT), so the results match those of the other sets.
+#define EP_KERNEL_SET(isa, ...) \
+            namespace isa { \
+                template<typename T> __VA_ARGS__ \
+                T Sum(const T *a, std::size_t n) { return kernels::Sum(a, n); } \
+                template<typename T> __VA_ARGS__ \
+                T Dot(const T *a, const T *b, std::size_t n) { return kernels::Dot(a, b, n); } \
+                template<typename T> __VA_ARGS__ \
+                T Min(const T *a, std::size_t n) { return kernels::Min(a, n); } \
+                template<typename T> __VA_ARGS__ \
+                T Max(const T *a, std::size_t n) { return kernels::Max(a, n); } \
+                template<typename T> __VA_ARGS__ \
+                void IntervalAdd(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n) { kernels::IntervalAdd(al, au, bl, bu, l, u, n); } \
+                template<typename T> __VA_ARGS__ \
+                void IntervalSub(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n) { kernels::IntervalSub(al, au, bl, bu, l, u, n); } \
+                template<typename T> __VA_ARGS__ \
+                void IntervalMultiply(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n) { kernels::IntervalMultiply(al, au, bl, bu, l, u, n); } \
+                template<typename T> __VA_ARGS__ \
+                void IntervalSquare(const T *al, const T *au, T *l, T *u, std::size_t n) { kernels::IntervalSquare(al, au, l, u, n); } \
+                template<typename T> __VA_ARGS__ \
+                bool IntervalDivide(const T *al, const T *au, const T *bl, const T *bu, T *l, T *u, std::size_t n) { return kernels::IntervalDivide(al, au, bl, bu, l, u, n); } \
+                template<typename T> __VA_ARGS__ \
+                void Exp(const T *x, T *y, std::size_t n) { kernels::ApproxExp(x, y, n); } \
+                template<typename T> __VA_ARGS__ \
+                void Log(const T *x, T *y, std::size_t n) { kernels::ApproxLog(x, y, n); } \
+                template<typename T> __VA_ARGS__ \
+                void Sin(const T *x, T *y, std::size_t n) { kernels::ApproxSin(x, y, n); } \
+                template<typename T> __VA_ARGS__ \
+                void Cos(const T *x, T *y, std::size_t n) { kernels::ApproxCos(x, y, n); } \
+                template<typename T> __VA_ARGS__ \
+                void Tanh(const T *x, T *y, std::size_t n) { kernels::ApproxTanh(x, y, n); } \
+                template<typename T> __VA_ARGS__ \
+                void TableLookup(const table::Cells<T> &cells, const T *x, T *y, std::size_t n) { kernels::TableLookup(cells, x, y, n); } \
+                \
+                template<typename T> \
+                KernelSet<T> Set() \
+                { \
+                    return { &Sum<T>, &Dot<T>, &Min<T>, &Max<T>, \
+                             &IntervalAdd<T>, &IntervalSub<T>, &IntervalMultiply<T>, &IntervalSquare<T>, &IntervalDivide<T>, \
+                             &Exp<T>, &Log<T>, &Sin<T>, &Cos<T>, &Tanh<T>, &TableLookup<T> }; \
+                } \
+            }
+
+            EP_KERNEL_SET(generic, EP_KERNEL_EXACT)
+            #ifdef EP_ISA_DISPATCH
+            EP_KERNEL_SET(sse4_2, __attribute__((target("sse4.2"))) EP_KERNEL_EXACT)
+            EP_KERNEL_SET(avx2, __attribute__((target("avx2"))) EP_KERNEL_EXACT)
+            EP_KERNEL_SET(avx512, __attribute__((target("avx512f"))) EP_KERNEL_EXACT)
+            #endif
+
+#undef EP_KERNEL_SET
+
+#if defined(__clang__)
+#pragma float_control(pop)
+#endif
+
+            // Best instruction set of the processor
+            inline Isa DetectIsa()
+            {
+                #ifdef EP_ISA_DISPATCH
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx512f")) return Isa_AVX512;
+                if (__builtin_cpu_supports("avx2"))    return Isa_AVX2;
+                if (__builtin_cpu_supports("sse4.2"))  return Isa_SSE4_2;
+                #endif
+                return Isa_Generic;
             }
 
+            // Instruction set from EXPRPARSE_ISA (generic, sse4.2, avx2 or avx512) if the processor supports it
+            inline Isa InitialIsa()
+            {
+                Isa detected = DetectIsa();
+
+                const char *forced = std::getenv("EXPRPARSE_ISA");
+                if (!forced)
+                    return detected;
+
+                static const std::map<std::string, Isa> names = {
+                    { "generic", Isa_Generic }, { "sse4.2", Isa_SSE4_2 }, { "avx2", Isa_AVX2 }, { "avx512", Isa_AVX512 }
+                };
+
+                auto it = names.find(forced);
+                return it != names.end() && it->second <= detected ? it->second : detected;
+            }
+
+            inline std::atomic<int> &SelectedIsa()
+            {
+                static std::atomic<int> isa(static_cast<int>(InitialIsa()));
+                return isa;
+            }
+
+            template<typename T>
+            const KernelSet<T> &Kernels()
+            {
+                #ifdef EP_ISA_DISPATCH
+                static const KernelSet<T> sets[] = { generic::Set<T>(), sse4_2::Set<T>(), avx2::Set<T>(), avx512::Set<T>() };
+                return sets[SelectedIsa().load(std::memory_order_relaxed)];
+                #else
+                static const KernelSet<T> set = generic::Set<T>();
+                return set;
+                #endif
+            }
         }
-    }
+
+
+
+        // Built-in reduction over an array (sum, norm2, min, max) or a pair of arrays (dot),
+        // either whole or over a slice created by the optimizer from an explicit chain
+        template<typename T>
+        class ReductionNode : public Node<T> {
+        public:
+            enum class Kind { Sum, Dot, Norm2, Min, Max };
+
+            static bool FromName(const std::string &name, Kind &kind)
+            {
+                static const std::map<std::string, Kind> kinds = {
+                    { "sum", Kind::Sum }, { "dot", Kind::Dot }, { "norm2", Kind::Norm2 }, { "min", Kind::Min }, { "max", Kind::Max }
+                };
+
+                auto it = kinds.find(name);
+                if (it == kinds.end())
+                    return false;
+
+                kind = it->second;
+                return true;
+            }
+
+            static const char *Name(Kind kind)
+            {
+                switch (kind) {
+                    case Kind::Sum:   return "sum";
+                    case Kind::Dot:   return "dot";
+                    case Kind::Norm2: return "norm2";
+                    case Kind::Min:   return "min";
+                    default:          return "max";
+                }
+            }
+
+        public:
+            ReductionNode(Kind kind, const std::string &name, const std::shared_ptr<std::vector<T>> &array,
+                          const std::string &other_name = "", const std::shared_ptr<std::vector<T>> &other = nullptr)
+                : _kind(kind), _name(name), _array(array), _other_name(other_name), _other(other) {}
+
+            // Restricts the reduction to length elements starting at offset (and other_offset for dot)
+            void SetSlice(std::size_t offset, std::size_t other_offset, std::size_t length)
+            {
+                _whole        = false;
+                _offset       = offset;
+                _other_offset = other_offset;
+                _length       = length;
+            }
+
+            virtual T Eval(Status &) const override { return Reduce(); }
+
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                return context.Tick(status, Length() + 1) ? Reduce() : T(0);
+            }
+
+            virtual NodeType Type() const override { return NodeType::Reduction; }
+
+            Kind                                   GetKind()     const { return _kind; }
+            const std::string                     &Name()        const { return _name; }
+            const std::shared_ptr<std::vector<T>> &Array()       const { return _array; }
+            const std::string                     &OtherName()   const { return _other_name; }
+            const std::shared_ptr<std::vector<T>> &Other()       const { return _other; } // Second array of dot
+            bool                                   Whole()       const { return _whole; }
+            std::size_t                            Offset()      const { return _offset; }
+            std::size_t                            OtherOffset() const { return _other_offset; }
+
+            std::size_t Length() const
+            {
+                if (!_whole)
+                    return _length;
+                return _other ? std::min(_array->size(), _other->size()) : _array->size();
+            }
+
+        private:
+            T Reduce() const
+            {
+                const T *a = _array->data() + _offset;
+                std::size_t n = Length();
+
+                switch (_kind) {
+                    case Kind::Sum:   return kernels::Kernels<T>().sum(a, n);
+                    case Kind::Dot:   return kernels::Kernels<T>().dot(a, _other->data() + _other_offset, n);
+                    case Kind::Norm2: return std::sqrt(kernels::Kernels<T>().dot(a, a, n));
+                    case Kind::Min:   return kernels::Kernels<T>().min(a, n);
+                    default:          return kernels::Kernels<T>().max(a, n);
+                }
+            }
+
+        private:
+            Kind                            _kind;
+            std::string                     _name;
+            std::shared_ptr<std::vector<T>> _array;
+            std::string                     _other_name;
+            std::shared_ptr<std::vector<T>> _other;
+
+            bool        _whole        = true;
+            std::size_t _offset       = 0;
+            std::size_t _other_offset = 0;
+            std::size_t _length       = 0;
+        };
+
+
+
+        // Remembers the value of a subtree shared between expressions for one evaluation epoch,
+        // so that it is evaluated once per epoch no matter how many expressions reference it.
+        // The epoch counter is shared with the store, so expressions may outlive it
+        template<typename T>
+        class CachedNode : public Node<T> {
+        public:
+            CachedNode(const std::shared_ptr<Node<T>> &inner, const std::shared_ptr<const std::atomic<std::uint64_t>> &epoch) : _inner(inner), _epoch(epoch) {}
+
+            virtual T Eval(Status &status) const override
+            {
+                std::uint64_t epoch = _epoch->load(std::memory_order_relaxed);
+                if (epoch != _cached_epoch) {
+                    _cached_status = Success;
+                    _cached_value  = _inner->Eval(_cached_status);
+                    _cached_epoch  = epoch;
+                }
+
+                if (_cached_status != Success)
+                    status = _cached_status;
+                return _cached_value;
+            }
+
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                if (!context.Tick(status))
+                    return T(0);
+
+                if (_epoch->load(std::memory_order_relaxed) == _cached_epoch) {
+                    if (_cached_status != Success)
+                        status = _cached_status;
+                    return _cached_value;
+                }
+
+                return _inner->Eval(status, context); // Not cached, it may have been cut short
+            }
+
+            virtual NodeType Type() const override { return NodeType::Cached; }
+
+            const std::shared_ptr<Node<T>> &Inner() const { return _inner; }
+
+        private:
+            std::shared_ptr<Node<T>>                           _inner;
+            std::shared_ptr<const std::atomic<std::uint64_t>> _epoch;
+
+            mutable std::uint64_t _cached_epoch  = static_cast<std::uint64_t>(-1);
+            mutable T             _cached_value  = T(0);
+            mutable Status        _cached_status = Success;
+        };
+
+
+
+        // Value of a let-binding, read from the slot its LetNode stores into
+        template<typename T>
+        class LocalNode : public Node<T> {
+        public:
+            LocalNode(const std::string &name, const std::shared_ptr<T> &slot) : _name(name), _slot(slot) {}
+
+            virtual T Eval(Status &) const override { return *_slot; }
+            virtual T Eval(Status &status, EvalContext &context) const override { return context.Tick(status) ? *_slot : T(0); }
+
+            virtual NodeType Type() const override { return NodeType::Local; }
+
+            const std::string        &Name() const { return _name; }
+            const std::shared_ptr<T> &Slot() const { return _slot; }
+
+        private:
+            std::string        _name;
+            std::shared_ptr<T> _slot;
+        };
+
+
+
+        // Statement name = value; body. The value is computed once per evaluation into the slot
+        // read by the LocalNodes of the body, then the body is evaluated. The slot of an output
+        // is the variable registered by the caller.
+        template<typename T>
+        class LetNode : public Node<T> {
+        public:
+            LetNode(const std::string &name, const std::shared_ptr<T> &slot, bool output = false)
+                : _name(name), _slot(slot), _output(output) {}
+
+            virtual T Eval(Status &status) const override
+            {
+                *_slot = _value->Eval(status);
+                return _body->Eval(status);
+            }
+
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                if (!context.Tick(status))
+                    return T(0);
+
+                T value = _value->Eval(status, context);
+                if (context.Stopped())
+                    return T(0);
+
+                *_slot = value;
+                return _body->Eval(status, context);
+            }
+
+            virtual NodeType Type() const override { return NodeType::Let; }
+
+            void LinkValue(const std::shared_ptr<Node<T>> &value) { _value = value; }
+            void LinkBody(const std::shared_ptr<Node<T>> &body)   { _body  = body; }
+
+            const std::string              &Name()   const { return _name; }
+            const std::shared_ptr<T>       &Slot()   const { return _slot; }
+            bool                            Output() const { return _output; }
+            const std::shared_ptr<Node<T>> &Value()  const { return _value; }
+            const std::shared_ptr<Node<T>> &Body()   const { return _body; }
+
+        private:
+            std::string              _name;
+            std::shared_ptr<T>       _slot;
+            bool                     _output;
+            std::shared_ptr<Node<T>> _value;
+            std::shared_ptr<Node<T>> _body;
+        };
+
+
+
+        // Stateful function of the values its argument takes over successive evaluations, one row per
+        // evaluation: the value k rows ago, an exponential moving average, or the mean, minimum or maximum
+        // of the last n rows. Buffers are allocated when parsing and every row updates in O(1) amortized time.
+        template<typename T>
+        class WindowNode : public Node<T> {
+        public:
+            enum class Kind { Lag, Ema, RollingMean, RollingMin, RollingMax };
+
+            static bool FromName(const std::string &name, Kind &kind)
+            {
+                static const std::map<std::string, Kind> kinds = {
+                    { "lag", Kind::Lag }, { "ema", Kind::Ema }, { "rolling_mean", Kind::RollingMean },
+                    { "rolling_min", Kind::RollingMin }, { "rolling_max", Kind::RollingMax }
+                };
+
+                auto it = kinds.find(name);
+                if (it == kinds.end())
+                    return false;
+
+                kind = it->second;
+                return true;
+            }
+
+            static const char *Name(Kind kind)
+            {
+                switch (kind) {
+                    case Kind::Lag:         return "lag";
+                    case Kind::Ema:         return "ema";
+                    case Kind::RollingMean: return "rolling_mean";
+                    case Kind::RollingMin:  return "rolling_min";
+                    default:                return "rolling_max";
+                }
+            }
+
+            // Smoothing factor in (0, 1] for ema, otherwise a whole number of rows up to max_window
+            static bool ValidParameter(Kind kind, T parameter, std::size_t max_window)
+            {
+                if (kind == Kind::Ema)
+                    return parameter > T(0) && parameter <= T(1);
+
+                return parameter >= T(1) && parameter <= T(max_window) && parameter == std::floor(parameter);
+            }
+
+            // Rows of history kept for a valid parameter
+            static std::size_t Rows(Kind kind, T parameter) { return kind == Kind::Ema ? 0 : static_cast<std::size_t>(parameter); }
+
+        public:
+            WindowNode(Kind kind, T parameter)
+                : _kind(kind), _parameter(parameter), _window(Rows(kind, parameter))
+            {
+                _values.resize(_window);
+                if (kind == Kind::RollingMin || kind == Kind::RollingMax)
+                    _rows.resize(_window);
+            }
+
+            virtual T Eval(Status &status) const override { return Push(_argument->Eval(status)); }
+
+            virtual T Eval(Status &status, EvalContext &context) const override
+            {
+                if (!context.Tick(status))
+                    return T(0);
+
+                T argument = _argument->Eval(status, context);
+                return context.Stopped() ? T(0) : Push(argument);
+            }
+
+            virtual NodeType Type() const override { return NodeType::Window; }
+
+            void LinkArgument(const std::shared_ptr<Node<T>> &arg) { _argument = arg; }
+
+            Kind                            GetKind()   const { return _kind; }
+            T                               Parameter() const { return _parameter; }
+            std::size_t                     Window()    const { return _window; }   // Rows of history, 0 for ema
+            const std::shared_ptr<Node<T>> &Argument()  const { return _argument; }
+
+            // Forgets all rows, as after parsing
+            void Reset()
+            {
+                _count = _position = _head = _size = 0;
+                _sum = _average = T(0);
+            }
+
+            // Appends the state as bytes, see Expression::Checkpoint
+            void Save(std::vector<std::uint8_t> &out) const
+            {
+                auto append = [&out](const void *data, std::size_t size) {
+                    out.insert(out.end(), static_cast<const std::uint8_t *>(data), static_cast<const std::uint8_t *>(data) + size);
+                };
+
+                std::uint8_t  kind     = static_cast<std::uint8_t>(_kind);
+                std::uint64_t state[4] = { _count, _position, _head, _size };
+
+                append(&kind, sizeof(kind));
+                append(&_parameter, sizeof(T));
+                append(state, sizeof(state));
+                append(&_sum, sizeof(T));
+                append(&_average, sizeof(T));
+                append(_values.data(), _values.size() * sizeof(T));
+                append(_rows.data(), _rows.size() * sizeof(std::uint64_t));
+            }
+
+            // Reads a state saved by a node of the same kind and parameter, false otherwise
+            bool Restore(const std::uint8_t *&data, const std::uint8_t *end)
+            {
+                std::size_t size = sizeof(std::uint8_t) + 3 * sizeof(T) + 4 * sizeof(std::uint64_t)
+                                 + _values.size() * sizeof(T) + _rows.size() * sizeof(std::uint64_t);
+                if (static_cast<std::size_t>(end - data) < size)
+                    return false;
+
+                auto read = [&data](void *target, std::size_t bytes) {
+                    std::memcpy(target, data, bytes);
+                    data += bytes;
+                };
+
+                std::uint8_t  kind;
+                T             parameter;
+                std::uint64_t state[4];
+
+                read(&kind, sizeof(kind));
+                read(&parameter, sizeof(T));
+                if (kind != static_cast<std::uint8_t>(_kind) || std::memcmp(&parameter, &_parameter, sizeof(T)) != 0)
+                    return false;
+
+                read(state, sizeof(state));
+                if (state[1] >= std::max<std::size_t>(_window, 1) || state[2] >= std::max<std::size_t>(_window, 1) || state[3] > _window)
+                    return false;
+
+                _count    = state[0];
+                _position = static_cast<std::size_t>(state[1]);
+                _head     = static_cast<std::size_t>(state[2]);
+                _size     = static_cast<std::size_t>(state[3]);
+                read(&_sum, sizeof(T));
+                read(&_average, sizeof(T));
+                read(_values.data(), _values.size() * sizeof(T));
+                read(_rows.data(), _rows.size() * sizeof(std::uint64_t));
+                return true;
+            }
+
+        private:
+            T Push(T x) const
+            {
+                switch (_kind) {
+
+                    case Kind::Lag: { // NaN until k rows have been seen
+                        T lagged = _count >= _window ? _values[_position] : std::numeric_limits<T>::quiet_NaN();
+                        _values[_position] = x;
+                        Advance();
+                        return lagged;
+                    }
+
+                    case Kind::Ema:
+                        _average = _count == 0 ? x : _average + _parameter * (x - _average);
+                        _count++;
+                        return _average;
+
+                    case Kind::RollingMean: { // Over the rows seen so far until the window is full
+                        if (_count >= _window)
+                            _sum -= _values[_position];
+                        _values[_position] = x;
+                        _sum += x;
+                        Advance();
+
+                        // Summed again once per window, so that rounding errors of the updates do not accumulate
+                        if (_position == 0) {
+                            _sum = T(0);
+                            for (T value : _values)
+                                _sum += value;
+                        }
+                        return _sum / static_cast<T>(std::min<std::uint64_t>(_count, _window));
+                    }
+
+                    default: {
+                        // Monotonic deque of the rows that can still become the extreme, front first,
+                        // in a ring of values and row numbers. The front leaves once it is out of the window.
+                        bool max = _kind == Kind::RollingMax;
+
+                        if (_size > 0 && _rows[_head] + _window <= _count) {
+                            _head = _head + 1 == _window ? 0 : _head + 1;
+                            _size--;
+                        }
+
+                        while (_size > 0) {
+                            T back = _values[(_head + _size - 1) % _window];
+                            if (!(max ? back <= x : back >= x))
+                                break;
+                            _size--;
+                        }
+
+                        std::size_t slot = (_head + _size) % _window;
+                        _values[slot] = x;
+                        _rows[slot]   = _count;
+                        _size++;
+                        _count++;
+                        return _values[_head];
+                    }
+                }
+            }
+
+            void Advance() const
+            {
+                _count++;
+                _position = _position + 1 == _window ? 0 : _position + 1;
+            }
+
+        private:
+            Kind        _kind;
+            T           _parameter;
+            std::size_t _window;
+
+            std::shared_ptr<Node<T>> _argument;
+
+            // Evaluation is const, the state of the stream is not
+            mutable std::vector<T>             _values;   // Ring of the last rows, or the values of the deque
+            mutable std::vector<std::uint64_t> _rows;     // Row numbers of the deque
+            mutable std::uint64_t              _count    = 0; // Rows seen
+            mutable std::size_t                _position = 0; // Next slot of the ring
+            mutable std::size_t                _head     = 0; // Front of the deque
+            mutable std::size_t                _size     = 0; // Entries of the deque
+            mutable T                          _sum      = T(0);
+            mutable T                          _average  = T(0);
+        };
+
+
+
+        template<typename T>
+        void CountOperations(const std::shared_ptr<Node<T>> &node, OperationCount &count, std::size_t depth)
+        {
+            count.nodes++;
+            count.depth = std::max(count.depth, depth);
+
+            switch (node->Type()) {
+
+                case NodeType::Operator: {
+                    auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                    count.operators++;
+                    CountOperations(op->Left(), count, depth + 1);
+                    CountOperations(op->Right(), count, depth + 1);
+                    break;
+                }
+
+                case NodeType::Function: {
+                    auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                    count.function_calls++;
+                    CountOperations(func->Argument(), count, depth + 1);
+                    break;
+                }
+
+                case NodeType::Table: // A lookup of bounded cost, counted as a node
+                    CountOperations(std::static_pointer_cast<TableNode<T>>(node)->Argument(), count, depth + 1);
+                    break;
+
+                case NodeType::Window: { // A row may sum the window again or empty the deque
+                    auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                    if (window->GetKind() != WindowNode<T>::Kind::Lag)
+                        count.elements += window->Window();
+                    CountOperations(window->Argument(), count, depth + 1);
+                    break;
+                }
+
+                case NodeType::Cached:
+                    CountOperations(std::static_pointer_cast<CachedNode<T>>(node)->Inner(), count, depth + 1);
+                    break;
+
+                case NodeType::Element: {
+                    auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                    if (element->IndexNode())
+                        CountOperations(element->IndexNode(), count, depth + 1);
+                    break;
+                }
+
+                case NodeType::Reduction:
+                    count.elements += std::static_pointer_cast<ReductionNode<T>>(node)->Length();
+                    break;
+
+                case NodeType::Let: {
+                    auto let = std::static_pointer_cast<LetNode<T>>(node);
+                    CountOperations(let->Value(), count, depth + 1);
+                    CountOperations(let->Body(), count, depth + 1);
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+
+
+
+        template<typename T>
+        void CollectVariables(const std::shared_ptr<Node<T>> &node, std::set<std::string> &variables)
+        {
+            switch (node->Type()) {
+
+                case NodeType::Operator: {
+                    auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                    CollectVariables(op->Left(), variables);
+                    CollectVariables(op->Right(), variables);
+                    break;
+                }
+
+                case NodeType::Variable:
+                    variables.insert(std::static_pointer_cast<VariableNode<T>>(node)->Name());
+                    break;
+
+                case NodeType::Function:
+                    CollectVariables(std::static_pointer_cast<FunctionNode<T>>(node)->Argument(), variables);
+                    break;
+
+                case NodeType::Table:
+                    CollectVariables(std::static_pointer_cast<TableNode<T>>(node)->Argument(), variables);
+                    break;
+
+                case NodeType::Window:
+                    CollectVariables(std::static_pointer_cast<WindowNode<T>>(node)->Argument(), variables);
+                    break;
+
+                case NodeType::Cached:
+                    CollectVariables(std::static_pointer_cast<CachedNode<T>>(node)->Inner(), variables);
+                    break;
+
+                case NodeType::Element: {
+                    auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                    variables.insert(element->Name());
+                    if (element->IndexNode())
+                        CollectVariables(element->IndexNode(), variables);
+                    break;
+                }
+
+                case NodeType::Reduction: {
+                    auto reduction = std::static_pointer_cast<ReductionNode<T>>(node);
+                    variables.insert(reduction->Name());
+                    if (reduction->Other())
+                        variables.insert(reduction->OtherName());
+                    break;
+                }
+
+                case NodeType::Let: { // Locals are not registered variables
+                    auto let = std::static_pointer_cast<LetNode<T>>(node);
+                    CollectVariables(let->Value(), variables);
+                    CollectVariables(let->Body(), variables);
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+
+        // Stateful nodes of a tree, whose state Expression resets and checkpoints, in evaluation order
+        template<typename T>
+        void CollectWindows(const std::shared_ptr<Node<T>> &node, std::vector<std::shared_ptr<WindowNode<T>>> &windows)
+        {
+            switch (node->Type()) {
+
+                case NodeType::Operator: {
+                    auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                    CollectWindows(op->Left(), windows);
+                    CollectWindows(op->Right(), windows);
+                    break;
+                }
+
+                case NodeType::Function:
+                    CollectWindows(std::static_pointer_cast<FunctionNode<T>>(node)->Argument(), windows);
+                    break;
+
+                case NodeType::Table:
+                    CollectWindows(std::static_pointer_cast<TableNode<T>>(node)->Argument(), windows);
+                    break;
+
+                case NodeType::Window: {
+                    auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                    CollectWindows(window->Argument(), windows);
+                    windows.push_back(window);
+                    break;
+                }
+
+                case NodeType::Cached:
+                    CollectWindows(std::static_pointer_cast<CachedNode<T>>(node)->Inner(), windows);
+                    break;
+
+                case NodeType::Element: {
+                    auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                    if (element->IndexNode())
+                        CollectWindows(element->IndexNode(), windows);
+                    break;
+                }
+
+                case NodeType::Let: {
+                    auto let = std::static_pointer_cast<LetNode<T>>(node);
+                    CollectWindows(let->Value(), windows);
+                    CollectWindows(let->Body(), windows);
+                    break;
+                }
+
+                default:
+                    break;
+            }
+        }
+
+
+
+        // Copy of a tree with a new WindowNode for every occurrence of one, and new nodes on the path to it.
+        // A builder term can use a window term twice or be built into several expressions, and every use
+        // must keep its own rows as when the text is parsed. Other subtrees are shared.
+        template<typename T>
+        std::shared_ptr<Node<T>> CloneWindows(const std::shared_ptr<Node<T>> &node)
+        {
+            switch (node->Type()) {
+
+                case NodeType::Operator: {
+                    auto op    = std::static_pointer_cast<OperatorNode<T>>(node);
+                    auto left  = CloneWindows(op->Left());
+                    auto right = CloneWindows(op->Right());
+                    if (left == op->Left() && right == op->Right())
+                        return node;
+
+                    auto copy = std::make_shared<OperatorNode<T>>(op->Op());
+                    copy->LinkLeft(left);
+                    copy->LinkRight(right);
+                    copy->SetCheckDivisor(op->CheckDivisor());
+                    return copy;
+                }
+
+                case NodeType::Function: {
+                    auto func     = std::static_pointer_cast<FunctionNode<T>>(node);
+                    auto argument = CloneWindows(func->Argument());
+                    if (argument == func->Argument())
+                        return node;
+
+                    auto copy = std::make_shared<FunctionNode<T>>(func->Name(), func->Function());
+                    copy->LinkArgument(argument);
+                    return copy;
+                }
+
+                case NodeType::Table: {
+                    auto table    = std::static_pointer_cast<TableNode<T>>(node);
+                    auto argument = CloneWindows(table->Argument());
+                    if (argument == table->Argument())
+                        return node;
+
+                    auto copy = std::make_shared<TableNode<T>>(table->Name(), table->GetTable());
+                    copy->LinkArgument(argument);
+                    return copy;
+                }
+
+                case NodeType::Window: {
+                    auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                    auto copy   = std::make_shared<WindowNode<T>>(window->GetKind(), window->Parameter());
+                    copy->LinkArgument(CloneWindows(window->Argument()));
+                    return copy;
+                }
+
+                case NodeType::Element: {
+                    auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                    if (!element->IndexNode())
+                        return node;
+
+                    auto index = CloneWindows(element->IndexNode());
+                    if (index == element->IndexNode())
+                        return node;
+
+                    auto copy = std::make_shared<ElementNode<T>>(element->Name(), element->Array(), index);
+                    copy->SetCheckIndex(element->CheckIndex());
+                    return copy;
+                }
+
+                case NodeType::Let: {
+                    auto let   = std::static_pointer_cast<LetNode<T>>(node);
+                    auto value = CloneWindows(let->Value());
+                    auto body  = CloneWindows(let->Body());
+                    if (value == let->Value() && body == let->Body())
+                        return node;
+
+                    auto copy = std::make_shared<LetNode<T>>(let->Name(), let->Slot(), let->Output());
+                    copy->LinkValue(value);
+                    copy->LinkBody(body);
+                    return copy;
+                }
+
+                default:
+                    return node;
+            }
+        }
+
+        // Rewrites runs of consecutive array elements in sums into reductions over slices,
+        // a[0]+a[1]+a[2]+a[3] into sum and a[0]*b[0]+a[1]*b[1]+... into dot. Nodes are copied
+        // instead of modified because builder terms can be shared between expressions.
+        template<typename T>
+        class ReductionFuser {
+        public:
+            static const std::size_t min_run = 4; // Shorter runs are cheaper as plain nodes
+
+            std::shared_ptr<Node<T>> Fuse(const std::shared_ptr<Node<T>> &node) const
+            {
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                        if (op->Op() == OperatorNode<T>::Operator::Add)
+                            return FuseSum(node);
+
+                        auto left  = Fuse(op->Left());
+                        auto right = Fuse(op->Right());
+                        if (left == op->Left() && right == op->Right())
+                            return node;
+
+                        auto copy = std::make_shared<OperatorNode<T>>(op->Op());
+                        copy->LinkLeft(left);
+                        copy->LinkRight(right);
+                        return copy;
+                    }
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                        auto argument = Fuse(func->Argument());
+                        if (argument == func->Argument())
+                            return node;
+
+                        auto copy = std::make_shared<FunctionNode<T>>(func->Name(), func->Function());
+                        copy->LinkArgument(argument);
+                        return copy;
+                    }
+
+                    case NodeType::Table: {
+                        auto table = std::static_pointer_cast<TableNode<T>>(node);
+                        auto argument = Fuse(table->Argument());
+                        if (argument == table->Argument())
+                            return node;
+
+                        auto copy = std::make_shared<TableNode<T>>(table->Name(), table->GetTable());
+                        copy->LinkArgument(argument);
+                        return copy;
+                    }
+
+                    case NodeType::Window: {
+                        auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                        auto argument = Fuse(window->Argument());
+                        if (argument == window->Argument())
+                            return node;
+
+                        auto copy = std::make_shared<WindowNode<T>>(window->GetKind(), window->Parameter());
+                        copy->LinkArgument(argument);
+                        return copy;
+                    }
+
+                    case NodeType::Element: {
+                        auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                        if (!element->IndexNode())
+                            return node;
+
+                        auto index = Fuse(element->IndexNode());
+                        if (index == element->IndexNode())
+                            return node;
+
+                        return std::make_shared<ElementNode<T>>(element->Name(), element->Array(), index);
+                    }
+
+                    case NodeType::Let: {
+                        auto let   = std::static_pointer_cast<LetNode<T>>(node);
+                        auto value = Fuse(let->Value());
+                        auto body  = Fuse(let->Body());
+                        if (value == let->Value() && body == let->Body())
+                            return node;
+
+                        auto copy = std::make_shared<LetNode<T>>(let->Name(), let->Slot(), let->Output());
+                        copy->LinkValue(value);
+                        copy->LinkBody(body);
+                        return copy;
+                    }
+
+                    default:
+                        return node;
+                }
+            }
+
+        private:
+            // a[i] (b == nullptr) or a[i]*b[j] with constant indices
+            struct Term {
+                const ElementNode<T> *a = nullptr;
+                const ElementNode<T> *b = nullptr;
+            };
+
+            static bool ConstantElement(const std::shared_ptr<Node<T>> &node)
+            {
+                return node->Type() == NodeType::Element && !std::static_pointer_cast<ElementNode<T>>(node)->IndexNode();
+            }
+
+            static bool AsTerm(const std::shared_ptr<Node<T>> &node, Term &term)
+            {
+                if (ConstantElement(node)) {
+                    term.a = static_cast<const ElementNode<T> *>(node.get());
+                    term.b = nullptr;
+                    return true;
+                }
+
+                if (node->Type() != NodeType::Operator)
+                    return false;
+
+                auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                if (op->Op() != OperatorNode<T>::Operator::Mul || !ConstantElement(op->Left()) || !ConstantElement(op->Right()))
+                    return false;
+
+                term.a = static_cast<const ElementNode<T> *>(op->Left().get());
+                term.b = static_cast<const ElementNode<T> *>(op->Right().get());
+                return true;
+            }
+
+            // True if next reads the elements following those of previous
+            static bool Continues(const Term &previous, const Term &next)
+            {
+                if ((previous.b == nullptr) != (next.b == nullptr))
+                    return false;
+                if (previous.a->Array() != next.a->Array() || next.a->Index() != previous.a->Index() + 1)
+                    return false;
+
+                return !next.b || (previous.b->Array() == next.b->Array() && next.b->Index() == previous.b->Index() + 1);
+            }
+
+            static void Flatten(const std::shared_ptr<Node<T>> &node, std::vector<std::shared_ptr<Node<T>>> &terms)
+            {
+                if (node->Type() == NodeType::Operator) {
+                    auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                    if (op->Op() == OperatorNode<T>::Operator::Add) {
+                        Flatten(op->Left(), terms);
+                        Flatten(op->Right(), terms);
+                        return;
+                    }
+                }
+
+                terms.push_back(node);
+            }
+
+            std::shared_ptr<Node<T>> FuseSum(const std::shared_ptr<Node<T>> &node) const
+            {
+                typedef typename ReductionNode<T>::Kind Kind;
+
+                std::vector<std::shared_ptr<Node<T>>> terms;
+                Flatten(node, terms);
+
+                std::vector<std::shared_ptr<Node<T>>> fused;
+                bool changed = false;
+
+                for (std::size_t i = 0; i < terms.size();) {
+                    Term first, previous, next;
+                    std::size_t length = 1;
+
+                    if (AsTerm(terms[i], first)) {
+                        previous = first;
+                        while (i + length < terms.size() && AsTerm(terms[i + length], next) && Continues(previous, next)) {
+                            previous = next;
+                            length++;
+                        }
+                    }
+
+                    if (length < min_run) {
+                        for (std::size_t k = i; k < i + length; k++) {
+                            fused.push_back(Fuse(terms[k]));
+                            changed |= fused.back() != terms[k];
+                        }
+                        i += length;
+                        continue;
+                    }
+
+                    std::shared_ptr<ReductionNode<T>> reduction;
+                    if (first.b)
+                        reduction = std::make_shared<ReductionNode<T>>(Kind::Dot, first.a->Name(), first.a->Array(), first.b->Name(), first.b->Array());
+                    else
+                        reduction = std::make_shared<ReductionNode<T>>(Kind::Sum, first.a->Name(), first.a->Array());
+
+                    reduction->SetSlice(first.a->Index(), first.b ? first.b->Index() : 0, length);
+                    fused.push_back(reduction);
+
+                    changed = true;
+                    i += length;
+                }
+
+                if (!changed)
+                    return node;
+
+                // Right-deep like the parser builds chains
+                auto result = fused.back();
+                for (std::size_t k = fused.size() - 1; k-- > 0;) {
+                    auto add = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Add);
+                    add->LinkLeft(fused[k]);
+                    add->LinkRight(result);
+                    result = add;
+                }
+
+                return result;
+            }
+        };
+
+
+
+        template<typename T>
+        std::shared_ptr<Node<T>> FuseReductions(const std::shared_ptr<Node<T>> &node)
+        {
+            return ReductionFuser<T>().Fuse(node);
+        }
+
+
+
+        // Writes a syntax tree as source text, with the brackets needed to parse it back into the same tree
+        template<typename T>
+        void Print(std::ostream &os, const std::shared_ptr<Node<T>> &node)
+        {
+            switch (node->Type()) {
+
+                case NodeType::Operator: {
+                    typedef typename OperatorNode<T>::Operator Operator;
+
+                    auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                    auto precedence = [](Operator o) { return o == Operator::Add || o == Operator::Sub ? 0 : 1; };
+
+                    // Operands are split at the first operator, so only right operands of + and * chain without brackets.
+                    // Interned subtrees are judged by the node they cache.
+                    auto operand = [&](std::shared_ptr<Node<T>> child, bool right) {
+                        while (child->Type() == NodeType::Cached)
+                            child = std::static_pointer_cast<CachedNode<T>>(child)->Inner();
+
+                        bool brackets = child->Type() == NodeType::Let;
+                        if (child->Type() == NodeType::Operator) {
+                            Operator o = std::static_pointer_cast<OperatorNode<T>>(child)->Op();
+                            brackets = precedence(o) < precedence(op->Op())
+                                    || (precedence(o) == precedence(op->Op()) && (!right || op->Op() == Operator::Sub || op->Op() == Operator::Div));
+                        }
+
+                        if (brackets) os << "(";
+                        Print(os, child);
+                        if (brackets) os << ")";
+                    };
+
+                    auto left = op->Left();
+                    if (op->Op() == Operator::Sub && left->Type() == NodeType::Constant) { // Negative sign
+                        T value = std::static_pointer_cast<ConstantNode<T>>(left)->Value();
+                        if (value == T(0) && !std::signbit(value)) {
+                            os << "-";
+                            operand(op->Right(), true);
+                            break;
+                        }
+                    }
+
+                    operand(left, false);
+                    switch (op->Op()) {
+                        case Operator::Add: os << " + "; break;
+                        case Operator::Sub: os << " - "; break;
+                        case Operator::Mul: os << " * "; break;
+                        case Operator::Div: os << " / "; break;
+                    }
+                    operand(op->Right(), true);
+                    break;
+                }
+
+                case NodeType::Variable:
+                    os << std::static_pointer_cast<VariableNode<T>>(node)->Name();
+                    break;
+
+                case NodeType::Constant: {
+                    T value = std::static_pointer_cast<ConstantNode<T>>(node)->Value();
+                    if (std::signbit(value))
+                        os << "(" << value << ")";
+                    else
+                        os << value;
+                    break;
+                }
+
+                case NodeType::Function: {
+                    auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                    os << func->Name() << "(";
+                    Print(os, func->Argument());
+                    os << ")";
+                    break;
+                }
+
+                case NodeType::Table: {
+                    auto table = std::static_pointer_cast<TableNode<T>>(node);
+                    os << table->Name() << "(";
+                    Print(os, table->Argument());
+                    os << ")";
+                    break;
+                }
+
+                case NodeType::Window: {
+                    auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                    os << WindowNode<T>::Name(window->GetKind()) << "(";
+                    Print(os, window->Argument());
+                    os << ", " << window->Parameter() << ")";
+                    break;
+                }
+
+                case NodeType::Cached:
+                    Print(os, std::static_pointer_cast<CachedNode<T>>(node)->Inner());
+                    break;
+
+                case NodeType::Element: {
+                    auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                    os << element->Name() << "[";
+                    if (element->IndexNode())
+                        Print(os, element->IndexNode());
+                    else
+                        os << element->Index();
+                    os << "]";
+                    break;
+                }
+
+                case NodeType::Reduction: { // Slices created by the optimizer are written as name[first..last], as parsed
+                    auto reduction = std::static_pointer_cast<ReductionNode<T>>(node);
+                    auto array = [&](const std::string &name, std::size_t offset) {
+                        os << name;
+                        if (!reduction->Whole())
+                            os << "[" << offset << ".." << offset + reduction->Length() - 1 << "]";
+                    };
+
+                    os << ReductionNode<T>::Name(reduction->GetKind()) << "(";
+                    array(reduction->Name(), reduction->Offset());
+                    if (reduction->Other()) {
+                        os << ", ";
+                        array(reduction->OtherName(), reduction->OtherOffset());
+                    }
+                    os << ")";
+                    break;
+                }
+
+                case NodeType::Let: {
+                    auto let = std::static_pointer_cast<LetNode<T>>(node);
+                    os << let->Name() << " = ";
+                    Print(os, let->Value());
+                    os << "; ";
+                    Print(os, let->Body());
+                    break;
+                }
+
+                case NodeType::Local:
+                    os << std::static_pointer_cast<LocalNode<T>>(node)->Name();
+                    break;
+            }
+        }
+
+        template<typename T>
+        std::string ToString(const std::shared_ptr<Node<T>> &node)
+        {
+            std::ostringstream os;
+            os.precision(std::numeric_limits<T>::max_digits10);
+            Print(os, node);
+            return os.str();
+        }
+
+
+
+        // Propagates declared variable ranges through a syntax tree with interval arithmetic and
+        // removes division and index checks that cannot fail. Nodes are copied instead of modified,
+        // like in ReductionFuser. Checks that remain are listed with the range of their operand.
+        template<typename T>
+        class RangeAnalysis {
+        public:
+            RangeAnalysis(const SymbolMap<Interval<T>> &ranges, bool eliminate)
+                : _ranges(ranges), _eliminate(eliminate) {}
+
+            std::shared_ptr<Node<T>> Analyze(const std::shared_ptr<Node<T>> &node, Interval<T> &range)
+            {
+                range = Unbounded();
+
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+
+                        Interval<T> a, b;
+                        auto left  = Analyze(op->Left(), a);
+                        auto right = Analyze(op->Right(), b);
+
+                        bool check = op->CheckDivisor();
+                        switch (op->Op()) {
+                            case OperatorNode<T>::Operator::Add: interval::Add(a.lower, a.upper, b.lower, b.upper, range.lower, range.upper); break;
+                            case OperatorNode<T>::Operator::Sub: interval::Sub(a.lower, a.upper, b.lower, b.upper, range.lower, range.upper); break;
+
+                            case OperatorNode<T>::Operator::Mul:
+                                if (SameOperand(op->Left(), op->Right()))
+                                    interval::Square(a.lower, a.upper, range.lower, range.upper);
+                                else
+                                    interval::Multiply(a.lower, a.upper, b.lower, b.upper, range.lower, range.upper);
+                                break;
+
+                            case OperatorNode<T>::Operator::Div:
+                                interval::Divide(a.lower, a.upper, b.lower, b.upper, range.lower, range.upper);
+                                check = Keep(b.lower > T(0) || b.upper < T(0), RuntimeCheck<T>::Division, op->Right(), b);
+                                break;
+                        }
+                        range = Sanitize(range);
+
+                        if (left == op->Left() && right == op->Right() && check == op->CheckDivisor())
+                            return node;
+
+                        auto copy = std::make_shared<OperatorNode<T>>(op->Op());
+                        copy->LinkLeft(left);
+                        copy->LinkRight(right);
+                        copy->SetCheckDivisor(check);
+                        return copy;
+                    }
+
+                    case NodeType::Variable: {
+                        if (auto declared = _ranges.Find(std::static_pointer_cast<VariableNode<T>>(node)->Name()))
+                            range = declared->second;
+                        return node;
+                    }
+
+                    case NodeType::Constant:
+                        range.lower = range.upper = std::static_pointer_cast<ConstantNode<T>>(node)->Value();
+                        return node;
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+
+                        Interval<T> ignored;
+                        auto argument = Analyze(func->Argument(), ignored);
+                        if (argument == func->Argument())
+                            return node;
+
+                        auto copy = std::make_shared<FunctionNode<T>>(func->Name(), func->Function());
+                        copy->LinkArgument(argument);
+                        return copy;
+                    }
+
+                    case NodeType::Table: { // Values of the table when parsing, it must not be refilled afterwards
+                        auto table = std::static_pointer_cast<TableNode<T>>(node);
+
+                        Interval<T> x;
+                        auto argument = Analyze(table->Argument(), x);
+                        if (std::isfinite(x.lower) && std::isfinite(x.upper)) // Otherwise the argument may be NaN
+                            range = table->GetTable()->Bounds(x);
+                        if (argument == table->Argument())
+                            return node;
+
+                        auto copy = std::make_shared<TableNode<T>>(table->Name(), table->GetTable());
+                        copy->LinkArgument(argument);
+                        return copy;
+                    }
+
+                    case NodeType::Window: { // Rolling extremes select past values, the others compute or may be NaN
+                        auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                        bool select = window->GetKind() == WindowNode<T>::Kind::RollingMin || window->GetKind() == WindowNode<T>::Kind::RollingMax;
+
+                        Interval<T> x;
+                        auto argument = Analyze(window->Argument(), x);
+                        if (select && std::isfinite(x.lower) && std::isfinite(x.upper))
+                            range = x;
+                        if (argument == window->Argument())
+                            return node;
+
+                        auto copy = std::make_shared<WindowNode<T>>(window->GetKind(), window->Parameter());
+                        copy->LinkArgument(argument);
+                        return copy;
+                    }
+
+                    case NodeType::Element: {
+                        auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                        if (!element->IndexNode())
+                            return node;
+
+                        // Arrays do not shrink after parsing, so an index in bounds now stays in bounds
+                        Interval<T> index;
+                        auto index_node = Analyze(element->IndexNode(), index);
+                        bool check = Keep(index.lower >= T(0) && index.upper < T(element->Array()->size()), RuntimeCheck<T>::Index, element->IndexNode(), index);
+
+                        if (index_node == element->IndexNode() && check == element->CheckIndex())
+                            return node;
+
+                        auto copy = std::make_shared<ElementNode<T>>(element->Name(), element->Array(), index_node);
+                        copy->SetCheckIndex(check);
+                        return copy;
+                    }
+
+                    case NodeType::Reduction:
+                        if (std::static_pointer_cast<ReductionNode<T>>(node)->GetKind() == ReductionNode<T>::Kind::Norm2)
+                            range.lower = T(0);
+                        return node;
+
+                    case NodeType::Let: {
+                        auto let = std::static_pointer_cast<LetNode<T>>(node);
+
+                        Interval<T> value_range;
+                        auto value = Analyze(let->Value(), value_range);
+                        _locals[let->Slot().get()] = value_range;
+
+                        auto body = Analyze(let->Body(), range);
+                        if (value == let->Value() && body == let->Body())
+                            return node;
+
+                        auto copy = std::make_shared<LetNode<T>>(let->Name(), let->Slot(), let->Output());
+                        copy->LinkValue(value);
+                        copy->LinkBody(body);
+                        return copy;
+                    }
+
+                    case NodeType::Local: {
+                        auto it = _locals.find(std::static_pointer_cast<LocalNode<T>>(node)->Slot().get());
+                        if (it != _locals.end())
+                            range = it->second;
+                        return node;
+                    }
+
+                    default:
+                        return node;
+                }
+            }
+
+            std::vector<RuntimeCheck<T>> remaining;
+            std::size_t                  eliminated = 0;
+
+        private:
+            static Interval<T> Unbounded()
+            {
+                Interval<T> range;
+                range.lower = -std::numeric_limits<T>::infinity();
+                range.upper =  std::numeric_limits<T>::infinity();
+                return range;
+            }
+
+            // Bounds computed from infinite ends can be NaN, they are unknown
+            static Interval<T> Sanitize(Interval<T> range)
+            {
+                if (range.lower != range.lower) range.lower = -std::numeric_limits<T>::infinity();
+                if (range.upper != range.upper) range.upper =  std::numeric_limits<T>::infinity();
+                return range;
+            }
+
+            static bool SameOperand(const std::shared_ptr<Node<T>> &a, const std::shared_ptr<Node<T>> &b)
+            {
+                if (a == b)
+                    return true;
+                if (a->Type() != b->Type())
+                    return false;
+                if (a->Type() == NodeType::Variable)
+                    return std::static_pointer_cast<VariableNode<T>>(a)->Value() == std::static_pointer_cast<VariableNode<T>>(b)->Value();
+                if (a->Type() == NodeType::Local)
+                    return std::static_pointer_cast<LocalNode<T>>(a)->Slot() == std::static_pointer_cast<LocalNode<T>>(b)->Slot();
+                return false;
+            }
+
+            // True if the check has to stay
+            bool Keep(bool proven, typename RuntimeCheck<T>::Kind kind, const std::shared_ptr<Node<T>> &operand, const Interval<T> &range)
+            {
+                if (proven && _eliminate) {
+                    eliminated++;
+                    return false;
+                }
+
+                RuntimeCheck<T> check;
+                check.kind    = kind;
+                check.operand = ToString(operand);
+                check.range   = range;
+                remaining.push_back(check);
+                return true;
+            }
+
+        private:
+            const SymbolMap<Interval<T>> &_ranges;
+            bool                          _eliminate;
+
+            std::unordered_map<const T *, Interval<T>> _locals;
+        };
+
+
+
+        // Hash and equality of syntax trees by structure: symbols compare by name, constants by value,
+        // brackets and spaces of the source text do not matter. Optionally the operands of + and *
+        // are compared in either order. Hashes of subtrees are memoized for one comparison.
+        template<typename T>
+        class Structure {
+        public:
+            Structure(bool normalize_commutative) : _normalize(normalize_commutative) {}
+
+            std::uint64_t Hash(const std::shared_ptr<Node<T>> &node)
+            {
+                const Node<T> *key = node.get();
+                auto it = _hashes.find(key);
+                if (it != _hashes.end())
+                    return it->second;
+
+                std::uint64_t hash = Mix(static_cast<std::uint64_t>(node->Type()) + 1);
+
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                        std::uint64_t left  = Hash(op->Left());
+                        std::uint64_t right = Hash(op->Right());
+                        if (Commutative(*op) && left > right)
+                            std::swap(left, right);
+
+                        hash = Combine(Combine(Combine(hash, static_cast<std::uint64_t>(op->Op())), left), right);
+                        break;
+                    }
+
+                    case NodeType::Variable:
+                        hash = Combine(hash, std::hash<std::string>()(std::static_pointer_cast<VariableNode<T>>(node)->Name()));
+                        break;
+
+                    case NodeType::Constant: {
+                        T value = std::static_pointer_cast<ConstantNode<T>>(node)->Value();
+                        hash = Combine(hash, std::hash<T>()(value) ^ (std::signbit(value) ? 1 : 0));
+                        break;
+                    }
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                        hash = Combine(Combine(hash, std::hash<std::string>()(func->Name())), Hash(func->Argument()));
+                        break;
+                    }
+
+                    case NodeType::Table: {
+                        auto table = std::static_pointer_cast<TableNode<T>>(node);
+                        hash = Combine(Combine(hash, std::hash<std::string>()(table->Name())), Hash(table->Argument()));
+                        break;
+                    }
+
+                    case NodeType::Window: {
+                        auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                        hash = Combine(Combine(hash, static_cast<std::uint64_t>(window->GetKind())), std::hash<T>()(window->Parameter()));
+                        hash = Combine(hash, Hash(window->Argument()));
+                        break;
+                    }
+
+                    case NodeType::Cached: // Transparent
+                        hash = Hash(std::static_pointer_cast<CachedNode<T>>(node)->Inner());
+                        break;
+
+                    case NodeType::Element: {
+                        auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                        hash = Combine(hash, std::hash<std::string>()(element->Name()));
+                        hash = Combine(hash, element->IndexNode() ? Hash(element->IndexNode()) : element->Index());
+                        break;
+                    }
+
+                    case NodeType::Reduction: {
+                        auto reduction = std::static_pointer_cast<ReductionNode<T>>(node);
+                        hash = Combine(hash, static_cast<std::uint64_t>(reduction->GetKind()));
+                        hash = Combine(hash, std::hash<std::string>()(reduction->Name()));
+                        hash = Combine(hash, std::hash<std::string>()(reduction->OtherName()));
+                        if (!reduction->Whole()) {
+                            hash = Combine(hash, reduction->Offset());
+                            hash = Combine(hash, reduction->OtherOffset());
+                            hash = Combine(hash, reduction->Length());
+                        }
+                        break;
+                    }
+
+                    case NodeType::Let: {
+                        auto let = std::static_pointer_cast<LetNode<T>>(node);
+                        hash = Combine(Combine(hash, std::hash<std::string>()(let->Name())), let->Output());
+                        hash = Combine(Combine(hash, Hash(let->Value())), Hash(let->Body()));
+                        break;
+                    }
+
+                    case NodeType::Local:
+                        hash = Combine(hash, std::hash<std::string>()(std::static_pointer_cast<LocalNode<T>>(node)->Name()));
+                        break;
+                }
+
+                _hashes.emplace(key, hash);
+                return hash;
+            }
+
+            bool Equal(std::shared_ptr<Node<T>> a, std::shared_ptr<Node<T>> b)
+            {
+                while (a->Type() == NodeType::Cached)
+                    a = std::static_pointer_cast<CachedNode<T>>(a)->Inner();
+                while (b->Type() == NodeType::Cached)
+                    b = std::static_pointer_cast<CachedNode<T>>(b)->Inner();
+
+                if (a == b)
+                    return true;
+
+                if (a->Type() != b->Type() || Hash(a) != Hash(b))
+                    return false;
+
+                switch (a->Type()) {
+
+                    case NodeType::Operator: {
+                        auto x = std::static_pointer_cast<OperatorNode<T>>(a);
+                        auto y = std::static_pointer_cast<OperatorNode<T>>(b);
+                        if (x->Op() != y->Op())
+                            return false;
+
+                        if (Equal(x->Left(), y->Left()) && Equal(x->Right(), y->Right()))
+                            return true;
+
+                        return Commutative(*x) && Equal(x->Left(), y->Right()) && Equal(x->Right(), y->Left());
+                    }
+
+                    case NodeType::Variable:
+                        return std::static_pointer_cast<VariableNode<T>>(a)->Name() == std::static_pointer_cast<VariableNode<T>>(b)->Name();
+
+                    case NodeType::Constant: {
+                        T x = std::static_pointer_cast<ConstantNode<T>>(a)->Value();
+                        T y = std::static_pointer_cast<ConstantNode<T>>(b)->Value();
+                        return x == y && std::signbit(x) == std::signbit(y);
+                    }
+
+                    case NodeType::Function: {
+                        auto x = std::static_pointer_cast<FunctionNode<T>>(a);
+                        auto y = std::static_pointer_cast<FunctionNode<T>>(b);
+                        return x->Name() == y->Name() && Equal(x->Argument(), y->Argument());
+                    }
+
+                    case NodeType::Table: {
+                        auto x = std::static_pointer_cast<TableNode<T>>(a);
+                        auto y = std::static_pointer_cast<TableNode<T>>(b);
+                        return x->Name() == y->Name() && Equal(x->Argument(), y->Argument());
+                    }
+
+                    case NodeType::Window: {
+                        auto x = std::static_pointer_cast<WindowNode<T>>(a);
+                        auto y = std::static_pointer_cast<WindowNode<T>>(b);
+                        return x->GetKind() == y->GetKind() && x->Parameter() == y->Parameter() && Equal(x->Argument(), y->Argument());
+                    }
+
+                    case NodeType::Element: {
+                        auto x = std::static_pointer_cast<ElementNode<T>>(a);
+                        auto y = std::static_pointer_cast<ElementNode<T>>(b);
+                        if (x->Name() != y->Name() || !x->IndexNode() != !y->IndexNode())
+                            return false;
+
+                        return x->IndexNode() ? Equal(x->IndexNode(), y->IndexNode()) : x->Index() == y->Index();
+                    }
+
+                    case NodeType::Reduction: {
+                        auto x = std::static_pointer_cast<ReductionNode<T>>(a);
+                        auto y = std::static_pointer_cast<ReductionNode<T>>(b);
+                        if (x->GetKind() != y->GetKind() || x->Name() != y->Name() || x->OtherName() != y->OtherName() || x->Whole() != y->Whole())
+                            return false;
+
+                        return x->Whole() || (x->Offset() == y->Offset() && x->OtherOffset() == y->OtherOffset() && x->Length() == y->Length());
+                    }
+
+                    case NodeType::Let: {
+                        auto x = std::static_pointer_cast<LetNode<T>>(a);
+                        auto y = std::static_pointer_cast<LetNode<T>>(b);
+                        if (x->Name() != y->Name() || x->Output() != y->Output())
+                            return false;
+
+                        return Equal(x->Value(), y->Value()) && Equal(x->Body(), y->Body());
+                    }
+
+                    case NodeType::Local:
+                        return std::static_pointer_cast<LocalNode<T>>(a)->Name() == std::static_pointer_cast<LocalNode<T>>(b)->Name();
+
+                    default:
+                        return false;
+                }
+            }
+
+        private:
+            bool Commutative(const OperatorNode<T> &op) const
+            {
+                return _normalize && (op.Op() == OperatorNode<T>::Operator::Add || op.Op() == OperatorNode<T>::Operator::Mul);
+            }
+
+            static std::uint64_t Mix(std::uint64_t x) // splitmix64 finalizer
+            {
+                x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+                x ^= x >> 27; x *= 0x94d049bb133111ebull;
+                return x ^ (x >> 31);
+            }
+
+            static std::uint64_t Combine(std::uint64_t hash, std::uint64_t value)
+            {
+                return Mix(hash ^ (value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2)));
+            }
+
+        private:
+            bool _normalize;
+            std::unordered_map<const Node<T> *, std::uint64_t> _hashes;
+        };
+
+
+
+        // Approximate heap bytes of a single node: the node and its shared_ptr control
+        // block, plus the symbol name stored in the node
+        template<typename T>
+        std::size_t NodeMemory(const Node<T> &node)
+        {
+            const std::size_t control_block = 2 * sizeof(long) + sizeof(void *);
+            auto name_memory = [](const std::string &name) { return name.capacity() > 15 ? name.capacity() + 1 : 0; };
+
+            switch (node.Type()) {
+                case NodeType::Operator: return sizeof(OperatorNode<T>) + control_block;
+                case NodeType::Variable: return sizeof(VariableNode<T>) + control_block + name_memory(static_cast<const VariableNode<T> &>(node).Name());
+                case NodeType::Function: return sizeof(FunctionNode<T>) + control_block + name_memory(static_cast<const FunctionNode<T> &>(node).Name());
+                case NodeType::Table:    return sizeof(TableNode<T>) + control_block + name_memory(static_cast<const TableNode<T> &>(node).Name());
+                case NodeType::Window: { // Ring of values, plus row numbers for the deque of rolling extremes
+                    auto &window = static_cast<const WindowNode<T> &>(node);
+                    bool  deque  = window.GetKind() == WindowNode<T>::Kind::RollingMin || window.GetKind() == WindowNode<T>::Kind::RollingMax;
+                    return sizeof(WindowNode<T>) + control_block + window.Window() * (sizeof(T) + (deque ? sizeof(std::uint64_t) : 0));
+                }
+                case NodeType::Cached:   return sizeof(CachedNode<T>) + control_block;
+                case NodeType::Element:  return sizeof(ElementNode<T>) + control_block + name_memory(static_cast<const ElementNode<T> &>(node).Name());
+                case NodeType::Reduction: {
+                    auto &reduction = static_cast<const ReductionNode<T> &>(node);
+                    return sizeof(ReductionNode<T>) + control_block + name_memory(reduction.Name()) + name_memory(reduction.OtherName());
+                }
+                case NodeType::Let: { // The slot is owned by the let unless it is an output
+                    auto &let = static_cast<const LetNode<T> &>(node);
+                    return sizeof(LetNode<T>) + control_block + (let.Output() ? 0 : control_block + sizeof(T)) + name_memory(let.Name());
+                }
+                case NodeType::Local:    return sizeof(LocalNode<T>) + control_block + name_memory(static_cast<const LocalNode<T> &>(node).Name());
+                default:                 return sizeof(ConstantNode<T>) + control_block;
+            }
+        }
+
+        // Approximate heap bytes of a syntax tree, shared subtrees are counted once per reference.
+        // With memo, the size of every shared subtree is computed once, which keeps deep sharing linear
+        template<typename T>
+        std::size_t TreeMemory(const std::shared_ptr<Node<T>> &node, std::unordered_map<const Node<T> *, std::size_t> *memo = nullptr)
+        {
+            if (memo) {
+                auto it = memo->find(node.get());
+                if (it != memo->end())
+                    return it->second;
+            }
+
+            std::size_t memory = NodeMemory(*node);
+
+            switch (node->Type()) {
+
+                case NodeType::Operator: {
+                    auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                    memory += TreeMemory(op->Left(), memo) + TreeMemory(op->Right(), memo);
+                    break;
+                }
+
+                case NodeType::Function:
+                    memory += TreeMemory(std::static_pointer_cast<FunctionNode<T>>(node)->Argument(), memo);
+                    break;
+
+                case NodeType::Table: // The table is shared with the expression that registered it
+                    memory += TreeMemory(std::static_pointer_cast<TableNode<T>>(node)->Argument(), memo);
+                    break;
+
+                case NodeType::Window:
+                    memory += TreeMemory(std::static_pointer_cast<WindowNode<T>>(node)->Argument(), memo);
+                    break;
+
+                case NodeType::Cached:
+                    memory += TreeMemory(std::static_pointer_cast<CachedNode<T>>(node)->Inner(), memo);
+                    break;
+
+                case NodeType::Element: {
+                    auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                    memory += element->IndexNode() ? TreeMemory(element->IndexNode(), memo) : 0;
+                    break;
+                }
+
+                case NodeType::Let: {
+                    auto let = std::static_pointer_cast<LetNode<T>>(node);
+                    memory += TreeMemory(let->Value(), memo) + TreeMemory(let->Body(), memo);
+                    break;
+                }
+
+                default:
+                    break;
+            }
+
+            if (memo)
+                (*memo)[node.get()] = memory;
+            return memory;
+        }
+
+
+
+        // Evaluates the cost model over a syntax tree, optionally writing one annotated line per node.
+        // Subtrees shared through interning are counted at every reference, like they are evaluated.
+        template<typename T>
+        class Explainer {
+        public:
+            Explainer(const CostModel &model, std::ostream *os) : _model(model), _os(os) {}
+
+            CostEstimate Estimate(const std::shared_ptr<Node<T>> &node, std::size_t depth = 0)
+            {
+                CostEstimate own;
+                own.nodes  = 1;
+                own.cycles = _model.node;
+                own.memory = NodeMemory(*node);
+
+                std::string label;
+                std::vector<std::shared_ptr<Node<T>>> children;
+
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                        switch (op->Op()) {
+                            case OperatorNode<T>::Operator::Add: label = "+"; own.cycles += _model.add; break;
+                            case OperatorNode<T>::Operator::Sub: label = "-"; own.cycles += _model.add; break;
+                            case OperatorNode<T>::Operator::Mul: label = "*"; own.cycles += _model.multiply; break;
+                            case OperatorNode<T>::Operator::Div:
+                                label = op->CheckDivisor() ? "/ (checked)" : "/";
+                                own.cycles += _model.divide + (op->CheckDivisor() ? _model.check : 0);
+                                break;
+                        }
+                        children = { op->Left(), op->Right() };
+                        break;
+                    }
+
+                    case NodeType::Variable:
+                    case NodeType::Local:
+                        label = ToString(node);
+                        own.cycles += _model.load;
+                        own.memory += sizeof(T);
+                        break;
+
+                    case NodeType::Constant:
+                        label = ToString(node);
+                        break;
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                        auto hint = _model.function_hints.find(func->Name());
+                        label = func->Name() + "()";
+                        own.cycles += hint != _model.function_hints.end() ? hint->second : _model.function;
+                        children = { func->Argument() };
+                        break;
+                    }
+
+                    case NodeType::Table: { // Plus one load per step of the search of non-uniform grids
+                        auto lookup = std::static_pointer_cast<TableNode<T>>(node);
+                        auto &table = *lookup->GetTable();
+                        std::size_t search = table.Uniform() ? 0 : static_cast<std::size_t>(std::ceil(std::log2(static_cast<double>(table.Points()))));
+                        label = lookup->Name() + "() (table)";
+                        own.cycles += _model.table + search * _model.load;
+                        own.memory += ((table.GetInterpolation() == Table<T>::Linear ? 2 : 4) + search) * sizeof(T);
+                        children = { lookup->Argument() };
+                        break;
+                    }
+
+                    case NodeType::Window: {
+                        auto window = std::static_pointer_cast<WindowNode<T>>(node);
+                        char parameter[32];
+                        std::snprintf(parameter, sizeof(parameter), "%g", static_cast<double>(window->Parameter()));
+                        label = std::string(WindowNode<T>::Name(window->GetKind())) + "(, " + parameter + ")";
+                        own.cycles += _model.window;
+                        own.memory += 2 * sizeof(T);
+                        children = { window->Argument() };
+                        break;
+                    }
+
+                    case NodeType::Cached:
+                        label = "cached";
+                        children = { std::static_pointer_cast<CachedNode<T>>(node)->Inner() };
+                        break;
+
+                    case NodeType::Element: {
+                        auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                        own.cycles += _model.load;
+                        own.memory += sizeof(T);
+                        if (element->IndexNode()) {
+                            label = element->Name() + (element->CheckIndex() ? "[] (checked)" : "[]");
+                            own.cycles += element->CheckIndex() ? _model.check : 0;
+                            children = { element->IndexNode() };
+                        }
+                        else {
+                            label = ToString(node);
+                        }
+                        break;
+                    }
+
+                    case NodeType::Reduction: {
+                        auto reduction = std::static_pointer_cast<ReductionNode<T>>(node);
+                        std::size_t arrays = reduction->Other() ? 2 : 1;
+                        label = ToString(node);
+                        own.cycles += _model.element * reduction->Length() * arrays;
+                        own.memory += sizeof(T) * reduction->Length() * arrays;
+                        break;
+                    }
+
+                    case NodeType::Let: {
+                        auto let = std::static_pointer_cast<LetNode<T>>(node);
+                        label = let->Name() + (let->Output() ? " = (output)" : " =");
+                        own.cycles += _model.load;
+                        own.memory += sizeof(T);
+                        children = { let->Value(), let->Body() };
+                        break;
+                    }
+                }
+
+                if (_os) {
+                    char cost[64];
+                    std::snprintf(cost, sizeof(cost), "%8.1f cycles %6zu bytes  ", own.cycles, own.memory);
+                    *_os << cost << std::string(2 * depth, ' ') << label << "\n";
+                }
+
+                CostEstimate total = own;
+                for (auto &child : children) {
+                    CostEstimate estimate = Estimate(child, depth + 1);
+                    total.cycles += estimate.cycles;
+                    total.memory += estimate.memory;
+                    total.nodes  += estimate.nodes;
+                }
+                return total;
+            }
+
+        private:
+            const CostModel &_model;
+            std::ostream    *_os;
+        };
+
+
+
+        // Registered symbols by index, shared by the compact expressions compiled from an expression
+        template<typename T>
+        struct SymbolTable {
+            std::vector<std::shared_ptr<T>>  variables;
+            std::vector<const T *>           variable_pointers;
+            std::vector<std::function<T(T)>> functions;
+
+            std::vector<std::shared_ptr<const Table<T>>> tables;
+            std::vector<const Table<T> *>                table_pointers;
+
+            std::vector<std::shared_ptr<std::vector<T>>> arrays;
+            std::vector<const std::vector<T> *>          array_pointers;
+
+            std::vector<std::shared_ptr<T>> outputs;
+            std::vector<T *>                 output_pointers;
+
+            std::map<std::string, std::uint16_t> variable_index;
+            std::map<std::string, std::uint16_t> function_index;
+            std::map<std::string, std::uint16_t> table_index;
+            std::map<std::string, std::uint16_t> array_index;
+            std::map<std::string, std::uint16_t> output_index;
+        };
+
+
+
+        // One version of the registered symbols. Versions are never modified once published, registering
+        // creates the next version, so a parser holding one sees the same symbols until it is done.
+        template<typename T>
+        struct Registry {
+            SymbolMap<std::shared_ptr<T>>              variables;
+            SymbolMap<std::function<T(T)>>             functions;
+            SymbolMap<std::shared_ptr<const Table<T>>> tables;
+            SymbolMap<std::shared_ptr<std::vector<T>>> arrays;
+            SymbolMap<std::shared_ptr<T>>              outputs;
+            SymbolMap<Interval<T>>                     ranges;
+
+            Registry() = default;
+
+            // Copies the symbols, the symbol table of the next version is built again
+            Registry(const Registry &other)
+                : variables(other.variables), functions(other.functions), tables(other.tables), arrays(other.arrays),
+                  outputs(other.outputs), ranges(other.ranges) {}
+
+            Registry &operator=(const Registry &) = delete;
+
+            ~Registry() { delete _table.load(std::memory_order_relaxed); }
+
+            bool IsVariable(const std::string &name) const
+            {
+                return variables.Contains(name) || arrays.Contains(name) || outputs.Contains(name);
+            }
+
+            bool IsFunction(const std::string &name) const { return functions.Contains(name) || tables.Contains(name); }
+
+            // Symbols by index in name order, built once per version. Lock free: the table is published
+            // through a raw pointer owned by this version, which readers keep alive by their snapshot.
+            std::shared_ptr<const SymbolTable<T>> Indexed() const
+            {
+                if (auto cached = _table.load(std::memory_order_acquire))
+                    return *cached;
+
+                auto table = std::make_shared<SymbolTable<T>>();
+
+                variables.ForEach([&](const std::pair<const std::string, std::shared_ptr<T>> &variable) {
+                    table->variable_index.emplace(variable.first, static_cast<std::uint16_t>(table->variables.size()));
+                    table->variables.push_back(variable.second);
+                    table->variable_pointers.push_back(variable.second.get());
+                });
+
+                functions.ForEach([&](const std::pair<const std::string, std::function<T(T)>> &function) {
+                    table->function_index.emplace(function.first, static_cast<std::uint16_t>(table->functions.size()));
+                    table->functions.push_back(function.second);
+                });
+
+                tables.ForEach([&](const std::pair<const std::string, std::shared_ptr<const Table<T>>> &lookup) {
+                    table->table_index.emplace(lookup.first, static_cast<std::uint16_t>(table->tables.size()));
+                    table->tables.push_back(lookup.second);
+                    table->table_pointers.push_back(lookup.second.get());
+                });
+
+                arrays.ForEach([&](const std::pair<const std::string, std::shared_ptr<std::vector<T>>> &array) {
+                    table->array_index.emplace(array.first, static_cast<std::uint16_t>(table->arrays.size()));
+                    table->arrays.push_back(array.second);
+                    table->array_pointers.push_back(array.second.get());
+                });
+
+                outputs.ForEach([&](const std::pair<const std::string, std::shared_ptr<T>> &output) {
+                    table->output_index.emplace(output.first, static_cast<std::uint16_t>(table->outputs.size()));
+                    table->outputs.push_back(output.second);
+                    table->output_pointers.push_back(output.second.get());
+                });
+
+                // Threads racing here build equal tables, the first one stored is kept
+                auto built = new std::shared_ptr<const SymbolTable<T>>(std::move(table));
+                const std::shared_ptr<const SymbolTable<T>> *expected = nullptr;
+                if (!_table.compare_exchange_strong(expected, built, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    delete built;
+                    return *expected;
+                }
+                return *built;
+            }
+
+        private:
+            // Set once, never changed while the version is readable
+            mutable std::atomic<const std::shared_ptr<const SymbolTable<T>> *> _table{ nullptr };
+        };
+
+
+
+        // Registered symbols shared by expressions on any number of threads. Parsers pin the current version
+        // with a few atomic operations and no lock; registering copies the current version, publishes the copy
+        // with an atomic store and serializes only against other registrations.
+        //
+        // Replaced versions are reclaimed by epochs: readers count themselves in the slot of the epoch they
+        // entered, and the epoch only advances once the other slot is empty, so every active reader entered
+        // in the current or the previous epoch. A version replaced in epoch e can only be held by readers that
+        // entered by e, and is freed once the epoch reaches e + 2. Unlike a single reader count this needs no
+        // moment without readers, only that the parses older than the last advance finish.
+        template<typename T>
+        class SymbolRegistry {
+            struct Cell {
+                std::atomic<const Registry<T> *> current;
+                std::atomic<std::size_t>         epoch{ 0 };
+                std::atomic<std::size_t>         readers[2];
+                std::mutex                       writer;
+                std::vector<std::pair<const Registry<T> *, std::size_t>> retired; // With their epoch, guarded by writer
+
+                explicit Cell(const Registry<T> *version) : current(version)
+                {
+                    readers[0] = 0;
+                    readers[1] = 0;
+                }
+
+                ~Cell()
+                {
+                    for (auto &version : retired)
+                        delete version.first;
+                    delete current.load();
+                }
+
+                // Advances the epoch as far as readers allow and frees the versions no reader can hold,
+                // with writer locked
+                void Reclaim()
+                {
+                    for (int i = 0; i < 2; i++) {
+                        std::size_t e = epoch.load();
+                        if (readers[(e + 1) & 1].load() != 0)
+                            break;
+                        epoch.store(e + 1);
+                    }
+
+                    std::size_t e = epoch.load();
+                    auto kept = std::remove_if(retired.begin(), retired.end(), [&](const std::pair<const Registry<T> *, std::size_t> &version) {
+                        if (version.second + 2 > e)
+                            return false;
+                        delete version.first;
+                        return true;
+                    });
+                    retired.erase(kept, retired.end());
+                }
+            };
+
+        public:
+            // Pins the current version for its lifetime
+            class Snapshot {
+            public:
+                explicit Snapshot(Cell &cell) : _cell(&cell)
+                {
+                    // Counted in the slot of an epoch that is still current after counting, so an advance
+                    // past it waits for this reader
+                    for (;;) {
+                        std::size_t e = _cell->epoch.load();
+                        _slot = e & 1;
+                        _cell->readers[_slot].fetch_add(1);
+                        if (_cell->epoch.load() == e)
+                            break;
+                        _cell->readers[_slot].fetch_sub(1);
+                    }
+                    _version = _cell->current.load();
+                }
+
+                Snapshot(Snapshot &&other) noexcept : _cell(other._cell), _version(other._version), _slot(other._slot) { other._cell = nullptr; }
+
+                Snapshot(const Snapshot &)            = delete;
+                Snapshot &operator=(const Snapshot &) = delete;
+
+                ~Snapshot()
+                {
+                    if (!_cell || _cell->readers[_slot].fetch_sub(1) != 1)
+                        return;
+
+                    // Last reader of the slot, frees what registrations left behind unless one is running
+                    std::unique_lock<std::mutex> lock(_cell->writer, std::try_to_lock);
+                    if (lock && !_cell->retired.empty())
+                        _cell->Reclaim();
+                }
+
+                const Registry<T> &operator*() const { return *_version; }
+                const Registry<T> *operator->() const { return _version; }
+                const Registry<T> *get() const { return _version; }
+
+            private:
+                Cell              *_cell;
+                const Registry<T> *_version;
+                std::size_t        _slot;
+            };
+
+            SymbolRegistry() : _cell(std::make_shared<Cell>(new Registry<T>())) {}
+
+            // A copy starts from the symbols registered so far and registers independently
+            SymbolRegistry(const SymbolRegistry &other) : _cell(std::make_shared<Cell>(new Registry<T>(*other.Read()))) {}
+
+            SymbolRegistry &operator=(const SymbolRegistry &other)
+            {
+                if (this != &other)
+                    _cell = std::make_shared<Cell>(new Registry<T>(*other.Read()));
+                return *this;
+            }
+
+            Snapshot Read() const { return Snapshot(*_cell); }
+
+            // Applies update to a copy of the current version and publishes it if update succeeds
+            template<typename F>
+            Status Update(F update)
+            {
+                std::lock_guard<std::mutex> lock(_cell->writer);
+
+                std::unique_ptr<Registry<T>> next(new Registry<T>(*_cell->current.load()));
+                Status status = update(*next);
+                if (status != Success)
+                    return status;
+
+                _cell->retired.emplace_back(_cell->current.exchange(next.release()), _cell->epoch.load());
+                _cell->Reclaim();
+                return Success;
+            }
+
+            // Uses the symbols of other, registering through either is seen by both
+            void Share(const SymbolRegistry &other) { _cell = other._cell; }
+
+            // Equal for registries sharing their symbols
+            std::shared_ptr<const void> Identity() const { return _cell; }
+
+        private:
+            std::shared_ptr<Cell> _cell;
+        };
+
+
+
+        namespace compact {
+
+            enum Opcode : std::uint8_t {
+                PushVariable,   // u16 variable index
+                PushConstant,   // u8 constant pool index
+                PushImmediate,  // i8 small integer constant
+                Call,           // u16 function index
+                PushElement,    // u16 array index, u32 element index
+                IndexElement,   // u16 array index, element index on the stack
+                Reduce,         // u8 kind, u16 array index, u16 other array index, whole arrays
+                ReduceSlice,    // Same as Reduce followed by u32 offset, u32 other offset, u32 length
+                StoreLocal,     // u8 local index, pops the value of a let-binding
+                StoreOutput,    // u16 output index, u8 local index, pops the value of an assigned output
+                PushLocal,      // u8 local index
+                UncheckedIndexElement, // Index proven to be in bounds
+                LookupTable,    // u16 table index
+                Add, Sub, Mul, Div,
+                ReverseSub, ReverseDiv, // Operands swapped, emitted when the right operand is evaluated first
+                UncheckedDiv, UncheckedReverseDiv // Divisor proven to be nonzero
+            };
+
+            const std::size_t max_stack  = 255;
+            const std::size_t max_locals = 64;
+            const std::uint32_t abi      = 1; // Of the opcodes and their operands, incremented when they change
+
+            // Evaluates postfix code, variables and functions are indexed by the symbol table
+            template<typename T>
+            T Run(const std::uint8_t *code, std::size_t size, const T *constants,
+                  const T *const *variables, const std::function<T(T)> *functions, const Table<T> *const *tables,
+                  const std::vector<T> *const *arrays, T *const *outputs, Status &status)
+            {
+                T stack[max_stack + 1];
+                std::size_t top = 0; // Index of the next free slot
+
+                T locals[max_locals];
+
+                const std::uint8_t *pc  = code;
+                const std::uint8_t *end = code + size;
+
+                while (pc != end) {
+
+                    std::uint8_t opcode = *pc++;
+                    switch (opcode) {
+
+                        case PushVariable: {
+                            std::uint16_t index;
+                            std::memcpy(&index, pc, sizeof(index));
+                            pc += sizeof(index);
+                            stack[top++] = *variables[index];
+                            break;
+                        }
+
+                        case PushConstant:
+                            stack[top++] = constants[*pc++];
+                            break;
+
+                        case PushImmediate:
+                            stack[top++] = T(static_cast<std::int8_t>(*pc++));
+                            break;
+
+                        case Call: {
+                            std::uint16_t index;
+                            std::memcpy(&index, pc, sizeof(index));
+                            pc += sizeof(index);
+                            stack[top - 1] = functions[index](stack[top - 1]);
+                            break;
+                        }
+
+                        case LookupTable: {
+                            std::uint16_t index;
+                            std::memcpy(&index, pc, sizeof(index));
+                            pc += sizeof(index);
+                            stack[top - 1] = tables[index]->Eval(stack[top - 1]);
+                            break;
+                        }
+
+                        case PushElement: {
+                            std::uint16_t array;
+                            std::uint32_t element;
+                            std::memcpy(&array, pc, sizeof(array));
+                            std::memcpy(&element, pc + sizeof(array), sizeof(element));
+                            pc += sizeof(array) + sizeof(element);
+                            stack[top++] = arrays[array]->data()[element];
+                            break;
+                        }
+
+                        case Reduce:
+                        case ReduceSlice: {
+                            typedef typename ReductionNode<T>::Kind Kind;
+
+                            Kind kind = static_cast<Kind>(*pc++);
+                            std::uint16_t array, other;
+                            std::memcpy(&array, pc, sizeof(array));
+                            std::memcpy(&other, pc + sizeof(array), sizeof(other));
+                            pc += sizeof(array) + sizeof(other);
+
+                            const T *a = arrays[array]->data();
+                            const T *b = arrays[other]->data();
+                            std::size_t n = kind == Kind::Dot ? std::min(arrays[array]->size(), arrays[other]->size()) : arrays[array]->size();
+
+                            if (opcode == ReduceSlice) {
+                                std::uint32_t slice[3];
+                                std::memcpy(slice, pc, sizeof(slice));
+                                pc += sizeof(slice);
+
+                                a += slice[0];
+                                b += slice[1];
+                                n  = slice[2];
+                            }
+
+                            switch (kind) {
+                                case Kind::Sum:   stack[top++] = kernels::Kernels<T>().sum(a, n); break;
+                                case Kind::Dot:   stack[top++] = kernels::Kernels<T>().dot(a, b, n); break;
+                                case Kind::Norm2: stack[top++] = std::sqrt(kernels::Kernels<T>().dot(a, a, n)); break;
+                                case Kind::Min:   stack[top++] = kernels::Kernels<T>().min(a, n); break;
+                                default:          stack[top++] = kernels::Kernels<T>().max(a, n); break;
+                            }
+                            break;
+                        }
+
+                        case StoreLocal:
+                            locals[*pc++] = stack[--top];
+                            break;
+
+                        case StoreOutput: {
+                            std::uint16_t output;
+                            std::memcpy(&output, pc, sizeof(output));
+                            pc += sizeof(output);
+
+                            locals[*pc++] = stack[--top];
+                            *outputs[output] = stack[top];
+                            break;
+                        }
+
+                        case PushLocal:
+                            stack[top++] = locals[*pc++];
+                            break;
+
+                        case IndexElement: {
+                            std::uint16_t array;
+                            std::memcpy(&array, pc, sizeof(array));
+                            pc += sizeof(array);
+
+                            T index = stack[top - 1];
+                            if (!(index >= T(0) && index < T(arrays[array]->size()))) {
+                                status = Error_Index_Out_Of_Bounds;
+                                stack[top - 1] = T(0);
+                            }
+                            else {
+                                stack[top - 1] = arrays[array]->data()[static_cast<std::size_t>(index)];
+                            }
+                            break;
+                        }
+
+                        case UncheckedIndexElement: {
+                            std::uint16_t array;
+                            std::memcpy(&array, pc, sizeof(array));
+                            pc += sizeof(array);
+
+                            stack[top - 1] = arrays[array]->data()[static_cast<std::size_t>(stack[top - 1])];
+                            break;
+                        }
+
+                        default: {
+                            T right = stack[--top];
+                            T left  = stack[top - 1];
+                            if (opcode == ReverseSub || opcode == ReverseDiv || opcode == UncheckedReverseDiv)
+                                std::swap(left, right);
+
+                            switch (opcode) {
+                                case Add: left = left + right; break;
+                                case Sub: case ReverseSub: left = left - right; break;
+                                case Mul: left = left * right; break;
+                                case UncheckedDiv: case UncheckedReverseDiv: left = left / right; break;
+
+                                default:
+                                    if (right == T(0)) {
+                                        status = Error_Division_By_Zero;
+                                        left   = T(0);
+                                    }
+                                    else {
+                                        left = left / right;
+                                    }
+                                    break;
+                            }
+
+                            stack[top - 1] = left;
+                            break;
+                        }
+                    }
+                }
+
+                return stack[0];
+            }
+
+            // Evaluates postfix code for rows first to first + n of column-major input, one instruction over all
+            // rows before the next, so that the arithmetic loops vectorize. Variables without a column are
+            // broadcast. Stack slots and locals hold block values each, outputs get the value of the last row.
+            // Results are those of Run row by row, status is that of any failing row.
+            template<typename T>
+            void RunBatch(const std::uint8_t *code, std::size_t size, const T *constants,
+                          const T *const *variables, const T *const *columns, std::size_t first, std::size_t n,
+                          const std::function<T(T)> *functions, const Table<T> *const *tables,
+                          const std::vector<T> *const *arrays, T *const *outputs,
+                          T *stack, T *locals, std::size_t block, Status &status)
+            {
+                T *top = stack; // Next free slot
+
+                const std::uint8_t *pc  = code;
+                const std::uint8_t *end = code + size;
+
+                while (pc != end) {
+
+                    std::uint8_t opcode = *pc++;
+                    switch (opcode) {
+
+                        case PushVariable: {
+                            std::uint16_t index;
+                            std::memcpy(&index, pc, sizeof(index));
+                            pc += sizeof(index);
+                            if (columns[index])
+                                std::copy(columns[index] + first, columns[index] + first + n, top);
+                            else
+                                std::fill(top, top + n, *variables[index]);
+                            top += block;
+                            break;
+                        }
+
+                        case PushConstant:
+                            std::fill(top, top + n, constants[*pc++]);
+                            top += block;
+                            break;
+
+                        case PushImmediate:
+                            std::fill(top, top + n, T(static_cast<std::int8_t>(*pc++)));
+                            top += block;
+                            break;
+
+                        case Call: {
+                            std::uint16_t index;
+                            std::memcpy(&index, pc, sizeof(index));
+                            pc += sizeof(index);
+
+                            T *x = top - block;
+                            for (std::size_t i = 0; i < n; i++)
+                                x[i] = functions[index](x[i]);
+                            break;
+                        }
+
+                        case LookupTable: {
+                            std::uint16_t index;
+                            std::memcpy(&index, pc, sizeof(index));
+                            pc += sizeof(index);
+
+                            T *x = top - block;
+                            for (std::size_t i = 0; i < n; i++)
+                                x[i] = tables[index]->Eval(x[i]);
+                            break;
+                        }
+
+                        case PushElement: {
+                            std::uint16_t array;
+                            std::uint32_t element;
+                            std::memcpy(&array, pc, sizeof(array));
+                            std::memcpy(&element, pc + sizeof(array), sizeof(element));
+                            pc += sizeof(array) + sizeof(element);
+                            std::fill(top, top + n, arrays[array]->data()[element]);
+                            top += block;
+                            break;
+                        }
+
+                        case Reduce:
+                        case ReduceSlice: { // The arrays are the same for all rows, reduced once
+                            std::size_t length = opcode == Reduce ? 6 : 18;
+                            T value = Run(pc - 1, length, constants, variables, functions, tables, arrays, outputs, status);
+                            pc += length - 1;
+                            std::fill(top, top + n, value);
+                            top += block;
+                            break;
+                        }
+
+                        case StoreLocal:
+                            top -= block;
+                            std::copy(top, top + n, locals + *pc++ * block);
+                            break;
+
+                        case StoreOutput: {
+                            std::uint16_t output;
+                            std::memcpy(&output, pc, sizeof(output));
+                            pc += sizeof(output);
+
+                            top -= block;
+                            std::copy(top, top + n, locals + *pc++ * block);
+                            *outputs[output] = top[n - 1];
+                            break;
+                        }
+
+                        case PushLocal:
+                            std::copy(locals + *pc * block, locals + *pc * block + n, top);
+                            pc++;
+                            top += block;
+                            break;
+
+                        case IndexElement:
+                        case UncheckedIndexElement: {
+                            std::uint16_t array;
+                            std::memcpy(&array, pc, sizeof(array));
+                            pc += sizeof(array);
+
+                            const T *data = arrays[array]->data();
+                            T size = T(arrays[array]->size());
+                            T *x = top - block;
+                            for (std::size_t i = 0; i < n; i++) {
+                                if (opcode == IndexElement && !(x[i] >= T(0) && x[i] < size)) {
+                                    status = Error_Index_Out_Of_Bounds;
+                                    x[i] = T(0);
+                                }
+                                else {
+                                    x[i] = data[static_cast<std::size_t>(x[i])];
+                                }
+                            }
+                            break;
+                        }
+
+                        default: {
+                            top -= block;
+                            T *left  = top - block;
+                            T *right = top;
+
+                            switch (opcode) {
+                                case Add:        for (std::size_t i = 0; i < n; i++) left[i] = left[i] + right[i]; break;
+                                case Sub:        for (std::size_t i = 0; i < n; i++) left[i] = left[i] - right[i]; break;
+                                case ReverseSub: for (std::size_t i = 0; i < n; i++) left[i] = right[i] - left[i]; break;
+                                case Mul:        for (std::size_t i = 0; i < n; i++) left[i] = left[i] * right[i]; break;
+
+                                case UncheckedDiv:        for (std::size_t i = 0; i < n; i++) left[i] = left[i] / right[i]; break;
+                                case UncheckedReverseDiv: for (std::size_t i = 0; i < n; i++) left[i] = right[i] / left[i]; break;
+
+                                default: { // Div and ReverseDiv, zero for a zero divisor as in Run
+                                    bool reverse = opcode == ReverseDiv, zero = false;
+                                    for (std::size_t i = 0; i < n; i++) {
+                                        T dividend = reverse ? right[i] : left[i];
+                                        T divisor  = reverse ? left[i] : right[i];
+                                        zero |= divisor == T(0);
+                                        left[i] = divisor == T(0) ? T(0) : dividend / divisor;
+                                    }
+                                    if (zero)
+                                        status = Error_Division_By_Zero;
+                                    break;
+                                }
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+
+
+    template<typename T>
+    class InternStore;
+
+    template<typename T>
+    class Builder;
+
+    namespace shm {
+        template<typename T>
+        class Publisher;
+
+        template<typename T>
+        class Store;
+    }
+
+
+
+    // True while the calling thread is inside Expression<T>::EvalRealtime
+    inline bool InRealtimeEval() { return _internal::RealtimeFlag(); }
+
+
+    // Best instruction set supported by the processor
+    inline Isa DetectedIsa() { return _internal::kernels::DetectIsa(); }
+
+    // Instruction set of the kernels in use, the detected one unless overridden by EXPRPARSE_ISA or SetIsa
+    inline Isa ActiveIsa() { return static_cast<Isa>(_internal::kernels::SelectedIsa().load()); }
+
+    // Selects the kernels of an instruction set for all threads, for testing and benchmarks. Results are
+    // bit-identical for every instruction set, the kernels do not contract multiply-adds.
+    inline Status SetIsa(Isa isa)
+    {
+        if (isa < Isa_Generic || isa > DetectedIsa())
+            return Error_Unsupported;
+
+        _internal::kernels::SelectedIsa().store(static_cast<int>(isa));
+        return Success;
+    }
+
+    inline const char *IsaName(Isa isa)
+    {
+        switch (isa) {
+            case Isa_SSE4_2: return "sse4.2";
+            case Isa_AVX2:   return "avx2";
+            case Isa_AVX512: return "avx512";
+            default:         return "generic";
+        }
+    }
+
+
+
+    // Implementations of the functions registered by Expression::RegisterIntrinsics
+    enum Intrinsics {
+        Intrinsics_Exact,       // The standard library
+        Intrinsics_Approximate, // exprparse::approx, faster and vectorizable with a small bounded error
+    };
+
+    // Branch-free approximations computed in double precision. Maximum relative errors of normal results,
+    // measured by exprparse_bench against long double references:
+    //   Exp, Log   1.5e-16 (1 ulp)
+    //   Sin, Cos   4e-16 (2.5 ulp) for |x| <= 1.6e6, NaN beyond
+    //   Tanh       3e-16 (1.5 ulp)
+    // Results below the smallest normal number lose relative precision, float results are within 1 ulp.
+    namespace approx {
+
+        template<typename T> T Exp(T x)  { return static_cast<T>(_internal::approx::Exp(static_cast<double>(x))); }
+        template<typename T> T Log(T x)  { return static_cast<T>(_internal::approx::Log(static_cast<double>(x))); }
+        template<typename T> T Sin(T x)  { return static_cast<T>(_internal::approx::Sin(static_cast<double>(x))); }
+        template<typename T> T Cos(T x)  { return static_cast<T>(_internal::approx::Cos(static_cast<double>(x))); }
+        template<typename T> T Tanh(T x) { return static_cast<T>(_internal::approx::Tanh(static_cast<double>(x))); }
+
+        // Over arrays with the kernels of the active instruction set
+        template<typename T> void Exp(const T *x, T *y, std::size_t n)  { _internal::kernels::Kernels<T>().exp(x, y, n); }
+        template<typename T> void Log(const T *x, T *y, std::size_t n)  { _internal::kernels::Kernels<T>().log(x, y, n); }
+        template<typename T> void Sin(const T *x, T *y, std::size_t n)  { _internal::kernels::Kernels<T>().sin(x, y, n); }
+        template<typename T> void Cos(const T *x, T *y, std::size_t n)  { _internal::kernels::Kernels<T>().cos(x, y, n); }
+        template<typename T> void Tanh(const T *x, T *y, std::size_t n) { _internal::kernels::Kernels<T>().tanh(x, y, n); }
+    }
+
+
+
+    // Function of one variable given by values on a grid, registered with Expression::RegisterTable and
+    // evaluated as a node of the syntax tree. Linear interpolation joins the points with segments, cubic
+    // with Hermite polynomials whose slopes are the centered differences of the neighbouring points, which is
+    // Catmull-Rom on uniform grids. Arguments outside the grid take the values at its ends.
+    //
+    // The coefficients of each cell are stored next to each other, so a lookup reads one or two cache lines.
+    // The cell of a uniform grid is computed in constant time, other grids are searched in log2(points) steps.
+    template<typename T>
+    class Table {
+    public:
+        enum Interpolation { Linear, Cubic };
+
+        // Values at first, first + step, first + 2 * step, ...
+        Status SetUniform(T first, T step, const std::vector<T> &values, Interpolation interpolation = Linear)
+        {
+            if (!(step > T(0)) || values.size() < 2)
+                return Error_Invalid_Table;
+
+            std::vector<T> grid(values.size());
+            for (std::size_t i = 0; i < grid.size(); i++)
+                grid[i] = first + static_cast<T>(i) * step;
+
+            Status status = Build(grid, values, interpolation);
+            if (status != Success)
+                return status;
+
+            _grid.clear();
+            _grid.shrink_to_fit();
+            _step    = step;
+            _inverse = T(1) / step;
+            return Success;
+        }
+
+        // Values at strictly increasing points
+        Status SetGrid(const std::vector<T> &grid, const std::vector<T> &values, Interpolation interpolation = Linear)
+        {
+            return Build(grid, values, interpolation);
+        }
+
+        T Eval(T x) const
+        {
+            if (Empty())
+                return std::numeric_limits<T>::quiet_NaN();
+
+            auto cells = GetCells();
+            if (Uniform())
+                return _interpolation == Linear ? _internal::table::Uniform<T, 2>(cells, x) : _internal::table::Uniform<T, 4>(cells, x);
+            return _interpolation == Linear ? _internal::table::Grid<T, 2>(cells, x) : _internal::table::Grid<T, 4>(cells, x);
+        }
+
+        // Over arrays with the kernels of the active instruction set, equal to Eval except with AVX-512
+        void Eval(const T *x, T *y, std::size_t n) const
+        {
+            if (Empty())
+                std::fill(y, y + n, std::numeric_limits<T>::quiet_NaN());
+            else
+                _internal::kernels::Kernels<T>().table(GetCells(), x, y, n);
+        }
+
+        // Bounds of the interpolated values over a range of arguments, from the extremes of every cell
+        // it overlaps widened by the rounding error of evaluating the polynomials
+        Interval<T> Bounds(const Interval<T> &x) const
+        {
+            const T infinity = std::numeric_limits<T>::infinity();
+
+            Interval<T> result;
+            if (Empty() || x.lower != x.lower || x.upper != x.upper) {
+                result.lower = -infinity;
+                result.upper = infinity;
+                return result;
+            }
+
+            auto cells = GetCells();
+            int  first = CellOf(cells, x.lower), last = CellOf(cells, x.upper);
+
+            result.lower = infinity;
+            result.upper = -infinity;
+            for (int cell = first; cell <= last; cell++) {
+                result.lower = std::min(result.lower, _lower[cell]);
+                result.upper = std::max(result.upper, _upper[cell]);
+            }
+            return result;
+        }
+
+        bool          Empty()            const { return _coefficients.empty(); }
+        bool          Uniform()          const { return _grid.empty(); }
+        Interpolation GetInterpolation() const { return _interpolation; }
+        std::size_t   Points()           const { return Empty() ? 0 : _lower.size() + 1; }
+        T             First()            const { return _first; }
+        T             Last()             const { return _last; }
+
+        // Heap bytes of the coefficients, grid and cell bounds
+        std::size_t MemoryUsage() const
+        {
+            return (_coefficients.capacity() + _grid.capacity() + _lower.capacity() + _upper.capacity()) * sizeof(T);
+        }
+
+    private:
+        Status Build(const std::vector<T> &grid, const std::vector<T> &values, Interpolation interpolation)
+        {
+            std::size_t n = values.size();
+            if (grid.size() != n || n < 2 || n - 1 > static_cast<std::size_t>(std::numeric_limits<int>::max() / 4))
+                return Error_Invalid_Table;
+
+            for (std::size_t i = 0; i < n; i++) {
+                if (!std::isfinite(grid[i]) || !std::isfinite(values[i]) || (i > 0 && !(grid[i] > grid[i - 1])))
+                    return Error_Invalid_Table;
+            }
+
+            // Slopes at the points for cubic cells, one-sided at the ends
+            std::vector<T> slopes(n);
+            for (std::size_t i = 0; i < n; i++) {
+                std::size_t a = i == 0 ? 0 : i - 1, b = i == n - 1 ? i : i + 1;
+                slopes[i] = (values[b] - values[a]) / (grid[b] - grid[a]);
+            }
+
+            int stride = interpolation == Linear ? 2 : 4;
+            std::vector<T> coefficients((n - 1) * stride), lower(n - 1), upper(n - 1);
+
+            for (std::size_t i = 0; i + 1 < n; i++) {
+                T h      = grid[i + 1] - grid[i];
+                T secant = (values[i + 1] - values[i]) / h;
+                T c[4]   = { values[i], secant, T(0), T(0) };
+
+                if (interpolation == Cubic) {
+                    c[1] = slopes[i];
+                    c[2] = (T(3) * secant - T(2) * slopes[i] - slopes[i + 1]) / h;
+                    c[3] = (slopes[i] + slopes[i + 1] - T(2) * secant) / (h * h);
+                }
+                std::copy(c, c + stride, coefficients.begin() + i * stride);
+
+                // Extremes at the ends and where the derivative c1 + 2 c2 u + 3 c3 u^2 vanishes inside the cell
+                auto value = [&](T u) { return c[0] + u * (c[1] + u * (c[2] + u * c[3])); };
+                T low  = std::min(value(T(0)), value(h));
+                T high = std::max(value(T(0)), value(h));
+
+                T qa = T(3) * c[3], qb = T(2) * c[2], qc = c[1];
+                T roots[2] = { T(-1), T(-1) };
+                if (qa != T(0)) {
+                    T discriminant = qb * qb - T(4) * qa * qc;
+                    if (discriminant >= T(0)) {
+                        roots[0] = (-qb - std::sqrt(discriminant)) / (T(2) * qa);
+                        roots[1] = (-qb + std::sqrt(discriminant)) / (T(2) * qa);
+                    }
+                }
+                else if (qb != T(0)) {
+                    roots[0] = -qc / qb;
+                }
+                for (T u : roots) {
+                    if (u > T(0) && u < h) {
+                        low  = std::min(low, value(u));
+                        high = std::max(high, value(u));
+                    }
+                }
+
+                // Horner's rule is accurate to a few ulps of the sum of the terms, and the offset u of uniform
+                // grids is computed with an error of a few ulps of the argument
+                T terms      = std::fabs(c[0]) + h * (std::fabs(c[1]) + h * (std::fabs(c[2]) + h * std::fabs(c[3])));
+                T derivative = std::fabs(c[1]) + h * (T(2) * std::fabs(c[2]) + T(3) * h * std::fabs(c[3]));
+                T scale      = std::max(std::fabs(grid.front()), std::fabs(grid.back()));
+                T error      = T(8) * std::numeric_limits<T>::epsilon() * (terms + derivative * scale);
+
+                lower[i] = _internal::interval::Down(low - error);
+                upper[i] = _internal::interval::Up(high + error);
+            }
+
+            _coefficients.swap(coefficients);
+            _lower.swap(lower);
+            _upper.swap(upper);
+            _grid          = grid;
+            _first         = grid.front();
+            _last          = grid.back();
+            _step          = T(0);
+            _inverse       = T(0);
+            _interpolation = interpolation;
+            return Success;
+        }
+
+        _internal::table::Cells<T> GetCells() const
+        {
+            _internal::table::Cells<T> cells;
+            cells.coefficients = _coefficients.data();
+            cells.grid         = Uniform() ? nullptr : _grid.data();
+            cells.first        = _first;
+            cells.last         = _last;
+            cells.step         = _step;
+            cells.inverse      = _inverse;
+            cells.last_cell    = static_cast<int>(_lower.size()) - 1;
+            cells.stride       = _interpolation == Linear ? 2 : 4;
+            return cells;
+        }
+
+        // Cell evaluated for an argument, the same as in Eval
+        int CellOf(const _internal::table::Cells<T> &cells, T x) const
+        {
+            T clamped = _internal::table::Clamp(cells, x);
+            return Uniform() ? _internal::table::UniformCell(cells, clamped) : _internal::table::GridCell(cells, clamped);
+        }
+
+    private:
+        std::vector<T> _coefficients;
+        std::vector<T> _grid;         // Points of non-uniform grids
+        std::vector<T> _lower;        // Bounds of the values in every cell
+        std::vector<T> _upper;
+
+        T _first   = T(0);
+        T _last    = T(0);
+        T _step    = T(0);
+        T _inverse = T(0);
+
+        Interpolation _interpolation = Linear;
+    };
+
+
+
+    template<typename T>
+    class Expression {
+        
+        static_assert(std::is_floating_point<T>::value, "T is not floating point type");
+
+    public:
+        Status RegisterVariable(const std::string &name, const std::shared_ptr<T> &variable)
+        {
+            EP_LOG("Registering variable " << name);
+
+            return _registry.Update([&](_internal::Registry<T> &symbols) {
+                return AddVariable(symbols, name, variable);
+            });
+        }
+
+        // Registers a variable whose value the caller guarantees to stay within range. Checks that
+        // cannot fail for values in the range are removed from expressions parsed afterwards.
+        // Fails with Error_Invalid_Range if lower > upper or either bound is NaN.
+        Status RegisterVariable(const std::string &name, const std::shared_ptr<T> &variable, const Interval<T> &range)
+        {
+            EP_LOG("Registering variable " << name);
+
+            if (!(range.lower <= range.upper))
+                return Error_Invalid_Range;
+
+            // Published together, a parser never sees the variable without its range
+            return _registry.Update([&](_internal::Registry<T> &symbols) {
+                Status status = AddVariable(symbols, name, variable);
+                if (status == Success)
+                    symbols.ranges = symbols.ranges.Insert(name, range);
+                return status;
+            });
+        }
+
+        Status RegisterFunction(const std::string &name, const std::function<T(T)> &function)
+        {
+            EP_LOG("Registering function " << name);
+
+            return _registry.Update([&](_internal::Registry<T> &symbols) {
+                // Check for variable with same name
+                if (symbols.IsVariable(name))
+                    return Error_Variable_Function_Name_Clash;
+
+                if (symbols.IsFunction(name))
+                    return Error_Function_Already_Registered;
+
+                symbols.functions = symbols.functions.Insert(name, function);
+                return Success;
+            });
+        }
+
+        // Registers exp, log, sin, cos and tanh from the standard library or their approximations, all or none of
+        // them if a name is taken. They are plain function pointers, so interned subtrees calling them are shared.
+        Status RegisterIntrinsics(Intrinsics intrinsics = Intrinsics_Exact)
+        {
+            typedef T (*Intrinsic)(T);
+
+            static const std::pair<const char *, Intrinsic> exact[] = {
+                { "exp", [](T x) -> T { return std::exp(x); } }, { "log", [](T x) -> T { return std::log(x); } },
+                { "sin", [](T x) -> T { return std::sin(x); } }, { "cos", [](T x) -> T { return std::cos(x); } },
+                { "tanh", [](T x) -> T { return std::tanh(x); } },
+            };
+            static const std::pair<const char *, Intrinsic> approximate[] = {
+                { "exp", &approx::Exp<T> }, { "log", &approx::Log<T> }, { "sin", &approx::Sin<T> }, { "cos", &approx::Cos<T> },
+                { "tanh", &approx::Tanh<T> },
+            };
+
+            // In one update, so that on a name clash none of them is registered
+            return _registry.Update([&](_internal::Registry<T> &symbols) {
+                for (auto &intrinsic : intrinsics == Intrinsics_Approximate ? approximate : exact) {
+                    if (symbols.IsVariable(intrinsic.first))
+                        return Error_Variable_Function_Name_Clash;
+
+                    if (symbols.IsFunction(intrinsic.first))
+                        return Error_Function_Already_Registered;
+
+                    symbols.functions = symbols.functions.Insert(intrinsic.first, std::function<T(T)>(intrinsic.second));
+                }
+                return Success;
+            });
+        }
+
+        // Registers an interpolation table called like a function, name(x), and evaluated without an indirect call.
+        // Range analysis bounds lookups by the values of the table when parsing, so a table must not be refilled
+        // while expressions using it remain parsed.
+        Status RegisterTable(const std::string &name, const std::shared_ptr<const Table<T>> &table)
+        {
+            EP_LOG("Registering table " << name);
+
+            if (!table || table->Empty())
+                return Error_Invalid_Table;
+
+            return _registry.Update([&](_internal::Registry<T> &symbols) {
+                if (symbols.IsVariable(name))
+                    return Error_Variable_Function_Name_Clash;
+
+                if (symbols.IsFunction(name))
+                    return Error_Function_Already_Registered;
+
+                symbols.tables = symbols.tables.Insert(name, table);
+                return Success;
+            });
+        }
+
+        // Registers an array variable, referenced as name[index] with a constant or computed index.
+        // Elements are read from the vector's contiguous storage, its size must not shrink after parsing.
+        Status RegisterArray(const std::string &name, const std::shared_ptr<std::vector<T>> &array)
+        {
+            EP_LOG("Registering array " << name);
+
+            return _registry.Update([&](_internal::Registry<T> &symbols) {
+                if (symbols.IsFunction(name))
+                    return Error_Variable_Function_Name_Clash;
+
+                if (symbols.IsVariable(name))
+                    return Error_Variable_Already_Registered;
+
+                symbols.arrays = symbols.arrays.Insert(name, array);
+                return Success;
+            });
+        }
+
+        // Registers a variable written by programs, name = value; statements store into it on every
+        // evaluation. Statements after the assignment read the assigned value under the same name.
+        Status RegisterOutput(const std::string &name, const std::shared_ptr<T> &output)
+        {
+            EP_LOG("Registering output " << name);
+
+            return _registry.Update([&](_internal::Registry<T> &symbols) {
+                if (symbols.IsFunction(name))
+                    return Error_Variable_Function_Name_Clash;
+
+                if (symbols.IsVariable(name))
+                    return Error_Variable_Already_Registered;
+
+                symbols.outputs = symbols.outputs.Insert(name, output);
+                return Success;
+            });
+        }
+
+        T Eval(Status &status) const
+        {
+            EP_LOG("Evaluating expression");
+
+            if (!_base) { // The AST is empty
+                status = Error_Not_Compiled;
+                return T(0);
+            } 
+
+            status = Success;
+            return _base->Eval(status);
+        }
+
+        // Real-time safe evaluation: performs no allocation, takes no locks and evaluates
+        // exactly WorstCaseOperations().nodes nodes. Registered functions must give the same
+        // guarantees themselves, a function throwing terminates the program.
+        // InRealtimeEval() is true for the duration of the call, so allocator and lock hooks
+        // of the application can assert that nothing violates the guarantee.
+        T EvalRealtime(Status &status) const noexcept
+        {
+            if (!_base) {
+                status = Error_Not_Compiled;
+                return T(0);
+            }
+
+            // Restored rather than cleared, a registered function may evaluate another expression in real time
+            bool outer = _internal::RealtimeFlag();
+            _internal::RealtimeFlag() = true;
+            status = Success;
+            T value = _base->Eval(status);
+            _internal::RealtimeFlag() = outer;
+
+            return value;
+        }
+
+        // Evaluation bounded by a budget and stoppable through a cancellation flag. Fails with
+        // Error_Budget_Exceeded without evaluating anything if the expression is statically too expensive.
+        T Eval(Status &status, const EvalBudget &budget) const
+        {
+            if (!_base) {
+                status = Error_Not_Compiled;
+                return T(0);
+            }
+
+            if (_operations.nodes + _operations.elements > budget.max_operations) {
+                status = Error_Budget_Exceeded;
+                return T(0);
+            }
+
+            status = Success;
+
+            // Every node is evaluated exactly once and reductions read a fixed number of elements,
+            // so the static check above already enforces the budget and only cancellation has
+            // to be polled during evaluation
+            if (!budget.cancel)
+                return _base->Eval(status);
+
+            _internal::EvalContext context(budget);
+
+            T value = _base->Eval(status, context);
+            return context.Stopped() ? T(0) : value;
+        }
+
+        // Evaluates rows of column-major input in order, as if loading every row into the named variables and
+        // calling Eval, so lag, ema and rolling functions see one stream across row-by-row and chunked calls.
+        // Variables without a column keep their values. Stops at the first failing row, out holds the rows before it.
+        void EvalBatch(const std::map<std::string, const T *> &columns, std::size_t rows, T *out, Status &status) const
+        {
+            if (!_base) {
+                status = Error_Not_Compiled;
+                return;
+            }
+
+            std::vector<std::pair<T *, const T *>> inputs;
+            {
+                auto symbols = _registry.Read();
+                for (auto &column : columns) {
+                    auto variable = symbols->variables.Find(column.first);
+                    if (!variable) {
+                        status = Error_Unregistered_Symbol;
+                        return;
+                    }
+                    inputs.emplace_back(variable->second.get(), column.second);
+                }
+            }
+
+            status = Success;
+            for (std::size_t row = 0; row < rows; row++) {
+                for (auto &input : inputs)
+                    *input.first = input.second[row];
+
+                out[row] = _base->Eval(status);
+                if (status != Success)
+                    return;
+            }
+        }
+
+        // Forgets the rows seen by the lag, ema and rolling functions, as after parsing
+        void ResetState()
+        {
+            for (auto &window : _windows)
+                window->Reset();
+        }
+
+        // State of the lag, ema and rolling functions, restored into this expression or one parsed from the
+        // same text to resume the stream
+        StateCheckpoint Checkpoint() const
+        {
+            StateCheckpoint checkpoint;
+            for (auto &window : _windows)
+                window->Save(checkpoint.data);
+            return checkpoint;
+        }
+
+        // Fails with Error_Invalid_Checkpoint and keeps the current state unless the checkpoint was taken
+        // from an expression with the same stateful functions
+        Status Restore(const StateCheckpoint &checkpoint)
+        {
+            auto read = [this](const StateCheckpoint &state) {
+                const std::uint8_t *data = state.data.data();
+                const std::uint8_t *end  = data + state.data.size();
+
+                for (auto &window : _windows)
+                    if (!window->Restore(data, end))
+                        return false;
+                return data == end;
+            };
+
+            StateCheckpoint current = Checkpoint();
+            if (read(checkpoint))
+                return Success;
+
+            read(current); // Undoes the nodes restored before the mismatch
+            return Error_Invalid_Checkpoint;
+        }
+
+        Status Parse(std::string expr_string);
+
+        // Compiles an expression constructed with a Builder, equivalent to parsing its text. The builder must
+        // resolve symbols in this expression or one sharing its symbols, Error_Foreign_Term otherwise.
+        Status Build(const typename Builder<T>::Term &term);
+
+        void               SetParseLimits(const ParseLimits &limits) { _limits = limits; }
+        const ParseLimits &Limits() const { return _limits; }
+
+        // Division and index checks left in the parsed expression, with the ranges of their operands
+        const std::vector<RuntimeCheck<T>> &RuntimeChecks() const { return _checks; }
+
+        // Number of checks removed from the parsed expression by range analysis
+        std::size_t EliminatedChecks() const { return _eliminated_checks; }
+
+        // Source text of the parsed expression after optimizations
+        std::string ToString() const { return _base ? _internal::ToString(_base) : std::string(); }
+
+        // Estimated cost of one evaluation of the parsed expression
+        CostEstimate EstimateCost(const CostModel &model = CostModel()) const
+        {
+            return _base ? _internal::Explainer<T>(model, nullptr).Estimate(_base) : CostEstimate();
+        }
+
+        // Keeps the tree after every pass of the next Parse or Build for Explain, off by default
+        void SetExplainPasses(bool record) { _record_passes = record; }
+
+        // Annotated dump of the parsed tree with the cost model, after every pass if recorded
+        std::string Explain(const CostModel &model = CostModel()) const
+        {
+            std::ostringstream os;
+
+            auto dump = [&](const std::string &pass, const std::shared_ptr<_internal::Node<T>> &tree) {
+                std::ostringstream nodes;
+                CostEstimate total = _internal::Explainer<T>(model, &nodes).Estimate(tree);
+
+                char summary[128];
+                std::snprintf(summary, sizeof(summary), "%.1f cycles, %zu bytes, %zu nodes", total.cycles, total.memory, total.nodes);
+                os << "== " << pass << ": " << summary << "\n" << _internal::ToString(tree) << "\n" << nodes.str();
+            };
+
+            if (!_base)
+                return "== not compiled\n";
+
+            if (_passes.empty())
+                dump("final", _base);
+            for (auto &pass : _passes)
+                dump(pass.first, pass.second);
+            return os.str();
+        }
+
+        // Combination of Optimization flags applied by the next Parse or Build, by default Optimize_Checks
+        void     SetOptimizations(unsigned optimizations) { _optimizations = optimizations; }
+        unsigned Optimizations() const { return _optimizations; }
+
+        // Exact operation counts of one evaluation of the parsed expression
+        const OperationCount &WorstCaseOperations() const { return _operations; }
+
+        // Hash of the parsed syntax tree, equal for expressions that differ only in spaces and brackets.
+        // With normalize_commutative, operand order of + and * is ignored as well.
+        std::uint64_t StructuralHash(bool normalize_commutative = false) const
+        {
+            return _base ? _internal::Structure<T>(normalize_commutative).Hash(_base) : 0;
+        }
+
+        bool StructurallyEqual(const Expression &other, bool normalize_commutative = false) const
+        {
+            if (!_base || !other._base)
+                return !_base && !other._base;
+
+            return _internal::Structure<T>(normalize_commutative).Equal(_base, other._base);
+        }
+
+        // Approximate heap bytes held by the parsed syntax tree
+        std::size_t MemoryUsage() const { return _base ? _internal::TreeMemory(_base) : 0; }
+
+        // Shares identical subtrees of parsed expressions with other expressions through the store,
+        // nullptr (the default) disables interning
+        void SetInternStore(InternStore<T> *store) { _intern_store = store; }
+
+        // Uses the registered symbols of other from now on, symbols registered through either expression are
+        // seen by both. Expressions sharing symbols can register and parse on different threads without locks:
+        // every Parse or Build sees the symbols of one moment, registrations during it apply to the next one.
+        // Clears the parsed expression, which may reference symbols unknown to other.
+        void ShareSymbols(const Expression &other)
+        {
+            _registry.Share(other._registry);
+            _base.reset();
+            _variables.clear();
+            _operations = OperationCount();
+        }
+
+        // Names of the registered variables referenced by the last parsed expression
+        const std::set<std::string> &Variables() const { return _variables; }
+
+        // Root of the parsed syntax tree, empty if not compiled
+        const std::shared_ptr<_internal::Node<T>> &AST() const { return _base; }
+
+    private:
+        template<typename U>
+        friend class CompactExpression;
+
+        template<typename U>
+        friend class Builder;
+
+        template<typename U>
+        friend class shm::Store;
+
+        Status Finalize(Status status);
+
+        // Symbols by index, rebuilt after registering new symbols
+        std::shared_ptr<const _internal::SymbolTable<T>> Symbols() const;
+
+        static Status AddVariable(_internal::Registry<T> &symbols, const std::string &name, const std::shared_ptr<T> &variable)
+        {
+            // Check for function with same name
+            if (symbols.IsFunction(name))
+                return Error_Variable_Function_Name_Clash;
+
+            if (symbols.IsVariable(name))
+                return Error_Variable_Already_Registered;
+
+            symbols.variables = symbols.variables.Insert(name, variable);
+            return Success;
+        }
+
+        Status CheckLimits(const std::string &expr_string) const;
+
+        // Splits statements at top level semicolons, name = value statements bind locals or assign outputs
+        std::shared_ptr<_internal::Node<T>> ParseStatements(
+            std::string::const_iterator begin, std::string::const_iterator end, Status &status);
+
+        std::shared_ptr<_internal::Node<T>> ParseSubString(
+            std::string::const_iterator begin, std::string::const_iterator end, Status &status
+        #ifdef EP_DEBUG
+        , int rec_depth
+        #endif    
+        );
+
+        // Splits a reduction argument name[first..last] into the array name and the closed range of elements,
+        // leaving name and last unchanged for a whole array
+        static Status ParseSlice(std::string &name, std::size_t &first, std::size_t &last)
+        {
+            auto open = name.find('[');
+            if (open == std::string::npos)
+                return Success;
+
+            auto dots = name.find("..", open);
+            if (dots == std::string::npos || name.back() != ']')
+                return Error_Syntax_Error;
+
+            std::string bounds[2] = { name.substr(open + 1, dots - open - 1), name.substr(dots + 2, name.size() - dots - 3) };
+            for (auto &bound : bounds)
+                if (bound.empty() || bound.size() > 18 || bound.find_first_not_of("0123456789") != std::string::npos)
+                    return Error_Syntax_Error;
+
+            first = std::stoull(bounds[0]);
+            last  = std::stoull(bounds[1]);
+            name.erase(open);
+            return first <= last ? Success : Error_Index_Out_Of_Bounds;
+        }
+
+    private:
+        _internal::SymbolRegistry<T> _registry;
+        const _internal::Registry<T> *_snapshot = nullptr; // Symbols seen by the running Parse or Build
+
+        std::set<std::string> _variables;
+        OperationCount        _operations;
+
+        std::vector<std::shared_ptr<_internal::WindowNode<T>>> _windows; // Stateful nodes of the parsed tree
+
+        std::map<std::string, std::shared_ptr<T>> _locals; // Let-bindings in scope while parsing
+
+        ParseLimits _limits;
+        std::size_t _parse_depth = 0;
+        std::size_t _window_rows = 0; // Of the windows created by the running Parse
+        unsigned    _optimizations = Optimize_Checks;
+
+        std::vector<RuntimeCheck<T>> _checks;
+        std::size_t                  _eliminated_checks = 0;
+
+        bool _record_passes = false;
+        std::vector<std::pair<std::string, std::shared_ptr<_internal::Node<T>>>> _passes; // Tree after every pass
+
+        InternStore<T> *_intern_store = nullptr;
+
+        std::shared_ptr<_internal::Node<T>> _base;
+    };
+
+
+#ifdef EP_DEBUG
+#define _exprparse_parse_substring(b, e, s) ParseSubString(b, e, s, rec_depth + 1)
+#else
+#define _exprparse_parse_substring(b, e, s) ParseSubString(b, e, s)
+#endif
+
+    template<typename T>
+    Status Expression<T>::Parse(std::string expr_string)
+    {
+        EP_LOG("Parsing expression");
+
+        _base.reset();
+        _variables.clear();
+        _operations = OperationCount();
+
+        Status status = CheckLimits(expr_string);
+        if (status != Success)
+            return status;
+
+        // Remove blank spaces
+        auto new_end = std::remove(expr_string.begin(), expr_string.end(), ' ');
+
+        // Parse against one version of the symbols, registrations on other threads apply to the next Parse
+        auto symbols = _registry.Read();
+        _snapshot = symbols.get();
+
+        _parse_depth = 0;
+        _window_rows = 0;
+        _base = ParseStatements(expr_string.begin(), new_end, status);
+        _locals.clear();
+
+        status = Finalize(status);
+        _snapshot = nullptr;
+        return status;
+    }
+
+
+
+    template<typename T>
+    Status Expression<T>::Build(const typename Builder<T>::Term &term)
+    {
+        EP_LOG("Building expression");
+
+        _base.reset();
+        _variables.clear();
+        _operations = OperationCount();
+
+        if (term._status != Success)
+            return term._status;
+        if (term._symbols != _registry.Identity()) // Resolved in the symbols of another expression
+            return Error_Foreign_Term;
+
+        // Checked before walking the tree, a builder can nest deeper than the recursion allows
+        if (term._nodes > _limits.max_nodes || term._depth > _limits.max_depth || term._window_rows > _limits.max_window_state)
+            return Error_Limit_Exceeded;
+
+        auto symbols = _registry.Read();
+        _snapshot = symbols.get();
+
+        _base = _internal::CloneWindows(term._node);
+        Status status = Finalize(Success);
+        _snapshot = nullptr;
+        return status;
+    }
+
+
+
+    // Steps shared by Parse and Build, so both produce identical expressions
+    template<typename T>
+    Status Expression<T>::Finalize(Status status)
+    {
+        if (status == Success) {
+            _internal::CountOperations(_base, _operations, 1);
+
+            if (_operations.nodes > _limits.max_nodes || _operations.depth > _limits.max_depth)
+                status = Error_Limit_Exceeded;
+        }
+
+        _passes.clear();
+        if (status == Success && _record_passes)
+            _passes.emplace_back("parsed", _base);
+
+        if (status == Success && (_optimizations & Optimize_Reductions)) {
+            auto fused = _internal::FuseReductions(_base);
+            if (fused != _base) {
+                _base = fused;
+                _operations = OperationCount();
+                _internal::CountOperations(_base, _operations, 1);
+
+                if (_record_passes)
+                    _passes.emplace_back("reductions", _base);
+            }
+        }
+
+        _checks.clear();
+        _eliminated_checks = 0;
+
+        if (status == Success) {
+            _internal::RangeAnalysis<T> analysis(_snapshot->ranges, (_optimizations & Optimize_Checks) != 0);
+            Interval<T> range;
+            _base = analysis.Analyze(_base, range);
+
+            _checks            = analysis.remaining;
+            _eliminated_checks = analysis.eliminated;
+
+            if (_record_passes)
+                _passes.emplace_back("ranges", _base);
+        }
+
+        if (status == Success) {
+            if (_intern_store) {
+                _base = _intern_store->Intern(_base);
+
+                if (_record_passes)
+                    _passes.emplace_back("interned", _base);
+            }
+
+            _internal::CollectVariables(_base, _variables);
+
+            _windows.clear();
+            _internal::CollectWindows(_base, _windows);
+        }
+        else { // Clear the AST since it's invalid
+            _base.reset();
+            _variables.clear();
+            _windows.clear();
+            _operations = OperationCount();
+            _checks.clear();
+            _eliminated_checks = 0;
+            _passes.clear();
+        }
+
+        return status;
+    }
+
+
+
+    template<typename T>
+    Status Expression<T>::CheckLimits(const std::string &expr_string) const
+    {
+        if (expr_string.size() > _limits.max_length)
+            return Error_Limit_Exceeded;
+
+        std::size_t identifier_length = 0;
+        std::size_t min_nodes         = 0; // Every operand and operator makes at least one node
+        std::size_t min_depth         = 0;
+        std::size_t statements        = 0;
+
+        // Operators are split off one at a time, so a chain of n +/- (or n * and / between them)
+        // inside one pair of brackets nests at least n levels deep below that bracket
+        struct Level { char close = '\0'; std::size_t plus_minus = 0, mul_div = 0; };
+        std::vector<Level> levels(1);
+
+        for (char c : expr_string) {
+
+            if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.') {
+                if (identifier_length++ == 0)
+                    min_nodes++;
+                if (identifier_length > _limits.max_identifier_length)
+                    return Error_Limit_Exceeded;
+                continue;
+            }
+            identifier_length = 0;
+
+            Level &level = levels.back();
+            switch (c) {
+                case '(': case '[':
+                    levels.emplace_back();
+                    levels.back().close = c == '(' ? ')' : ']';
+                    break;
+
+                case ')': case ']':
+                    if (levels.back().close != c)
+                        return Error_Syntax_Error;
+                    levels.pop_back();
+                    break;
+
+                case '+': case '-':
+                    min_nodes++;
+                    level.plus_minus++;
+                    level.mul_div = 0;
+                    break;
+
+                case '*': case '/':
+                    min_nodes++;
+                    level.mul_div++;
+                    break;
+
+                case ';': // Every statement nests the rest of the program one level deeper
+                    min_nodes++;
+                    statements++;
+                    level.plus_minus = level.mul_div = 0;
+                    break;
+
+                default:
+                    break;
+            }
+
+            if (c != ')' && c != ']') {
+                min_depth = std::max(min_depth, statements + levels.size() - 1 + std::max(levels.back().plus_minus, levels.back().mul_div));
+                if (min_depth > _limits.max_depth)
+                    return Error_Limit_Exceeded;
+            }
+
+            if (min_nodes > _limits.max_nodes)
+                return Error_Limit_Exceeded;
+        }
+
+        if (levels.size() != 1)
+            return Error_Syntax_Error;
+
+        return Success;
+    }
+
+
+
+    template<typename T>
+    std::shared_ptr<const _internal::SymbolTable<T>> Expression<T>::Symbols() const
+    {
+        return _registry.Read()->Indexed();
+    }
+
+
+
+#define _exprparse_parse_error(error) {\
+EP_LOG_INDENT();\
+EP_LOG(#error);\
+status = error;\
+return nullptr;\
+}
+
+    template<typename T>
+    std::shared_ptr<_internal::Node<T>> Expression<T>::ParseStatements(
+        std::string::const_iterator begin, std::string::const_iterator end, Status &status)
+    {
+        #ifdef EP_DEBUG
+        int rec_depth = 0;
+        #endif
+
+        std::vector<std::shared_ptr<_internal::LetNode<T>>> lets;
+        std::shared_ptr<_internal::Node<T>> node;
+
+        while (!node) {
+
+            // Find end of statement
+            auto it = begin;
+            int bracket_depth = 0;
+            while (it != end && (bracket_depth != 0 || *it != ';')) {
+                if (*it == '(' || *it == '[') bracket_depth++;
+                if (*it == ')' || *it == ']') bracket_depth--;
+                it++;
+            }
+
+            auto assign = std::find(begin, it, '=');
+            if (assign == it) {
+                if (it != end) // Only the last statement can be a plain expression
+                    _exprparse_parse_error(Error_Syntax_Error);
+
+                node = _exprparse_parse_substring(begin, end, status);
+                if (status != Success)
+                    return nullptr;
+                break;
+            }
+
+            if (assign == begin || std::isdigit(static_cast<unsigned char>(*begin)))
+                _exprparse_parse_error(Error_Syntax_Error);
+
+            std::string name(begin, assign);
+            for (char c : name)
+                if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+                    _exprparse_parse_error(Error_Syntax_Error);
+
+            if (_snapshot->variables.Contains(name) || _snapshot->arrays.Contains(name) || _locals.count(name))
+                _exprparse_parse_error(Error_Variable_Already_Registered);
+            if (_snapshot->IsFunction(name))
+                _exprparse_parse_error(Error_Variable_Function_Name_Clash);
+
+            EP_LOG("LET_NODE " << name);
+
+            // Outputs are stored into the caller's variable, other names into a slot of the expression
+            auto output = _snapshot->outputs.Find(name);
+            auto let    = output ? std::make_shared<_internal::LetNode<T>>(name, output->second, true)
+                                 : std::make_shared<_internal::LetNode<T>>(name, std::make_shared<T>(T(0)));
+
+            // Bound after parsing the value, a binding cannot refer to itself
+            let->LinkValue(_exprparse_parse_substring(assign + 1, it, status));
+            if (status != Success)
+                return nullptr;
+
+            _locals.emplace(name, let->Slot());
+            lets.push_back(let);
+
+            if (it == end) // Program ending in an assignment evaluates to the assigned value
+                node = std::make_shared<_internal::LocalNode<T>>(name, let->Slot());
+            else
+                begin = it + 1;
+        }
+
+        for (auto it = lets.rbegin(); it != lets.rend(); ++it) {
+            (*it)->LinkBody(node);
+            node = *it;
+        }
+
+        return node;
+    }
+
+
+
+    template<typename T>
+    std::shared_ptr<_internal::Node<T>> Expression<T>::ParseSubString(
+        std::string::const_iterator begin, std::string::const_iterator end, Status &status
+        #ifdef EP_DEBUG
+        , int rec_depth
+        #endif  
+        )
+    {
+        EP_LOG_INDENT();
+        #ifdef EP_DEBUG
+        rec_depth++;
+        #endif
+        EP_LOG("SUB_EXPR '" << std::string(begin, end) << "'");
+
+        _internal::ScopedIncrement depth_guard(_parse_depth);
+        if (_parse_depth > _limits.max_depth)
+            _exprparse_parse_error(Error_Limit_Exceeded);
+
+        if (begin == end) // Missing operand
+            _exprparse_parse_error(Error_Syntax_Error);
+
+        auto it                   = begin;
+        int  bracket_depth        = 0;     
+        char operator_symbol      = '\0';
+        bool found_plus_or_minus  = false; // +/- has precedence over *// when constructing tree
+
+        while (it != end) {
+            
+            if (*it == '(' || *it == '[') bracket_depth++;
+            if (*it == ')' || *it == ']') bracket_depth--;
+
+            if (bracket_depth == 0) { // Only look for operator if outside paranthesis
+
+                if (*it == '+' || *it == '-')
+                {
+                    found_plus_or_minus = true;
+                    operator_symbol     = *it;
+
+                    EP_LOG_INDENT();
+                    EP_LOG("OPERATOR " << *it);
+                    break;
+                }
+            }
+
+            it++;
+        }
+
+        if (bracket_depth != 0) // Start- and end brackets should cancel out
+            _exprparse_parse_error(Error_Syntax_Error);
+
+        if (!found_plus_or_minus) { // Only pick * or / operators if + or - aren't found
+            
+            it = begin;
+            while (it != end) {
+            
+                if (*it == '(' || *it == '[') bracket_depth++;
+                if (*it == ')' || *it == ']') bracket_depth--;
+
+                if (bracket_depth == 0) { // Only look for operator if outside paranthesis
+
+                    if (*it == '*' || *it == '/')
+                    {
+                        operator_symbol = *it;
+
+                        EP_LOG_INDENT();
+                        EP_LOG("OPERATOR " << *it);
+                        break;
+                    }
+                }
+
+                it++;
+            }
+        }
+
+        if (operator_symbol != '\0') {
+
+            using namespace _internal;
+
+            std::shared_ptr<OperatorNode<T>> node;
+
+            switch (operator_symbol) {
+                case '+':
+                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Add);
+                    EP_LOG_INDENT();
+                    EP_LOG("ADD_NODE");
+                    break;
+
+                case '-':
+                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Sub);
+                    EP_LOG_INDENT();
+                    EP_LOG("SUB_NODE");
+                    break;
+
+                case '*':
+                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Mul);
+                    EP_LOG_INDENT();
+                    EP_LOG("MUL_NODE");
+                    break;
+
+                case '/':
+                    node = std::make_shared<OperatorNode<T>>(OperatorNode<T>::Operator::Div);
+                    EP_LOG_INDENT();
+                    EP_LOG("DIV_NODE");
+                    break;
+
+                default:
+                    _exprparse_parse_error(Error_Unknown); // What the hell ?
+                    break;
+            }
+
+            if (begin != it) // Right hand side is non-empty
+            {
+                node->LinkLeft( _exprparse_parse_substring(begin, it, status));
+            }
+            else if (operator_symbol == '-') // Negative sign (-x becomes 0 - x)
+            {
+                EP_LOG_INDENT();
+                EP_LOG("NEGATE")
+                node->LinkLeft(std::make_shared<_internal::ConstantNode<T>>(T(0)));
+            }
+            else // RH is empty but operator is not minus
+            {
+                _exprparse_parse_error(Error_Syntax_Error);
+            }
+
+            node->LinkRight(_exprparse_parse_substring(it + 1, end,  status));
+            //                             ^^^^^^ --- plus one to omit operator        
+
+            if (status == Success)
+                return node;
+            else
+                return nullptr;
+
+        } else {
+            
+            // Strip potential brackets
+            if (*begin == '(' && *(end - 1) == ')')
+            {
+                EP_LOG_INDENT();
+                EP_LOG("STRIP_BRACKETS");
+
+                begin++; 
+                end--;
+
+                if (begin == end) // Empty bracket
+                    return std::make_shared<_internal::ConstantNode<T>>(T(0));
+
+                if (begin > end) 
+                    // Only happens if substring is odd length 
+                    // (meaning start- and end brackets aren't one-to-one)
+                    _exprparse_parse_error(Error_Syntax_Error);
+
+                return _exprparse_parse_substring(begin, end, status);
+            }
+
+            // Check for constant
+            std::stringstream ss;
+            ss << std::string(begin, end);
+            T value;
+            ss >> value; // Try converting to T (double / float)
+
+            if (!ss.fail()) {
+                EP_LOG_INDENT();
+                EP_LOG("CONST_NODE " << value);
+
+                return std::make_shared<_internal::ConstantNode<T>>(value);
+            } 
+            else 
+            {
+                // Look for variable
+                auto v_it = _snapshot->variables.Find(std::string(begin, end));
+
+                if (v_it)
+                {
+                    EP_LOG_INDENT();
+                    EP_LOG("VAR_NODE " << v_it->first);
+
+                    return std::make_shared<_internal::VariableNode<T>>(v_it->first, v_it->second);
+                    //                                                         SYMBOL --- ^^^^^^
+                }
+
+                // Look for let-binding of an earlier statement
+                auto l_it = _locals.find(std::string(begin, end));
+
+                if (l_it != _locals.end())
+                {
+                    EP_LOG_INDENT();
+                    EP_LOG("LOCAL_NODE " << l_it->first);
+
+                    return std::make_shared<_internal::LocalNode<T>>(l_it->first, l_it->second);
+                }
+
+                // Look for array element
+                if (*(end - 1) == ']')
+                {
+                    auto name_end = std::find(begin, end, '[');
+                    if (name_end == end - 1)
+                        _exprparse_parse_error(Error_Syntax_Error);
+
+                    auto a_it = _snapshot->arrays.Find(std::string(begin, name_end));
+                    if (!a_it)
+                        _exprparse_parse_error(Error_Unregistered_Symbol);
+
+                    EP_LOG_INDENT();
+                    EP_LOG("ELEMENT_NODE " << a_it->first);
+
+                    // Parse index                                    vvv ---- vvv --- Strip brackets
+                    auto index = _exprparse_parse_substring(name_end + 1, end - 1, status);
+                    if (status != Success)
+                        return nullptr;
+
+                    if (index->Type() != _internal::NodeType::Constant)
+                        return std::make_shared<_internal::ElementNode<T>>(a_it->first, a_it->second, index);
+
+                    // Constant index, checked now instead of on every evaluation
+                    T value = std::static_pointer_cast<_internal::ConstantNode<T>>(index)->Value();
+                    if (!(value >= T(0) && value < T(a_it->second->size())) || value != T(static_cast<std::size_t>(value)))
+                        _exprparse_parse_error(Error_Index_Out_Of_Bounds);
+
+                    return std::make_shared<_internal::ElementNode<T>>(a_it->first, a_it->second, static_cast<std::size_t>(value));
+                }
+
+                // Look for function
+                auto func_end = begin;
+
+                // Sub expression must end with left bracket
+                if(*(end - 1) != ')')
+                    _exprparse_parse_error(Error_Syntax_Error);
+
+                // Extract function name before parenthesis
+                while (func_end != end && *func_end != '(')
+                    func_end++;
+                if (*func_end != '(') // Function has no arguments
+                    _exprparse_parse_error(Error_Syntax_Error);
+
+                
+                auto f_it = _snapshot->functions.Find(std::string(begin, func_end));
+                if (f_it)
+                {
+                    EP_LOG_INDENT();
+                    EP_LOG("FUNC_NODE " << f_it->first);
+
+                    auto node = std::make_shared<_internal::FunctionNode<T>>(f_it->first, f_it->second);
+
+                    // Evaluate argument               vvv ---- vvv --- Strip brackets
+                    auto arg = _exprparse_parse_substring(func_end + 1, end - 1, status);
+                    if (status != Success)
+                        return nullptr;
+
+                    node->LinkArgument(arg);
+                    return node;
+                }
+
+                auto t_it = _snapshot->tables.Find(std::string(begin, func_end));
+                if (t_it)
+                {
+                    EP_LOG_INDENT();
+                    EP_LOG("TABLE_NODE " << t_it->first);
+
+                    auto node = std::make_shared<_internal::TableNode<T>>(t_it->first, t_it->second);
+
+                    auto arg = _exprparse_parse_substring(func_end + 1, end - 1, status);
+                    if (status != Success)
+                        return nullptr;
+
+                    node->LinkArgument(arg);
+                    return node;
+                }
+
+                // Look for stateful functions of the stream of evaluations, ema(x, 0.1) or lag(x, 1) etc.
+                typename _internal::WindowNode<T>::Kind window_kind;
+                if (_internal::WindowNode<T>::FromName(std::string(begin, func_end), window_kind))
+                {
+                    EP_LOG_INDENT();
+                    EP_LOG("WINDOW_NODE " << std::string(begin, func_end));
+
+                    // The parameter follows the last comma outside brackets, the argument may contain calls
+                    auto comma = end - 1;
+                    for (int depth = 0; comma != func_end; ) {
+                        comma--;
+                        if (*comma == ')' || *comma == ']') depth++;
+                        if (*comma == '(' || *comma == '[') depth--;
+                        if (*comma == ',' && depth == 0)
+                            break;
+                    }
+                    if (comma == func_end)
+                        _exprparse_parse_error(Error_Syntax_Error);
+
+                    auto parameter = _exprparse_parse_substring(comma + 1, end - 1, status);
+                    if (status != Success)
+                        return nullptr;
+
+                    if (parameter->Type() != _internal::NodeType::Constant)
+                        _exprparse_parse_error(Error_Syntax_Error);
+
+                    T value = std::static_pointer_cast<_internal::ConstantNode<T>>(parameter)->Value();
+                    if (!_internal::WindowNode<T>::ValidParameter(window_kind, value, std::numeric_limits<std::size_t>::max()))
+                        _exprparse_parse_error(Error_Syntax_Error);
+                    if (!_internal::WindowNode<T>::ValidParameter(window_kind, value, _limits.max_window))
+                        _exprparse_parse_error(Error_Limit_Exceeded);
+
+                    // Counted before allocating, so many windows cannot exhaust memory either
+                    _window_rows += _internal::WindowNode<T>::Rows(window_kind, value);
+                    if (_window_rows > _limits.max_window_state)
+                        _exprparse_parse_error(Error_Limit_Exceeded);
+
+                    auto node = std::make_shared<_internal::WindowNode<T>>(window_kind, value);
+
+                    auto arg = _exprparse_parse_substring(func_end + 1, comma, status);
+                    if (status != Success)
+                        return nullptr;
+
+                    node->LinkArgument(arg);
+                    return node;
+                }
+
+                // Look for built-in reduction over arrays, dot(a,b) or sum(a) etc.
+                typename _internal::ReductionNode<T>::Kind kind;
+                if (_internal::ReductionNode<T>::FromName(std::string(begin, func_end), kind))
+                {
+                    EP_LOG_INDENT();
+                    EP_LOG("REDUCTION_NODE " << std::string(begin, func_end));
+
+                    auto comma = std::find(func_end + 1, end - 1, ',');
+                    bool dot   = kind == _internal::ReductionNode<T>::Kind::Dot;
+                    if (dot == (comma == end - 1)) // Dot takes two arrays, the others one
+                        _exprparse_parse_error(Error_Syntax_Error);
+
+                    // Arrays, or slices name[first..last] as printed for sums rewritten by the optimizer
+                    std::string names[2]  = { std::string(func_end + 1, comma), dot ? std::string(comma + 1, end - 1) : std::string() };
+                    std::size_t firsts[2] = { 0, 0 };
+                    std::size_t lasts[2]  = { std::string::npos, std::string::npos };
+                    for (int k = 0; k < (dot ? 2 : 1); k++) {
+                        status = ParseSlice(names[k], firsts[k], lasts[k]);
+                        if (status != Success)
+                            _exprparse_parse_error(status);
+                    }
+
+                    auto a_it = _snapshot->arrays.Find(names[0]);
+                    auto b_it = dot ? _snapshot->arrays.Find(names[1]) : nullptr;
+                    if (!a_it || (dot && !b_it))
+                        _exprparse_parse_error(Error_Unregistered_Symbol);
+
+                    std::size_t sizes[2] = { a_it->second->size(), dot ? b_it->second->size() : 0 };
+                    std::size_t lengths[2];
+                    for (int k = 0; k < (dot ? 2 : 1); k++) {
+                        if (lasts[k] != std::string::npos && lasts[k] >= sizes[k])
+                            _exprparse_parse_error(Error_Index_Out_Of_Bounds);
+                        lengths[k] = lasts[k] != std::string::npos ? lasts[k] - firsts[k] + 1 : sizes[k];
+                    }
+                    if (dot && lengths[0] != lengths[1])
+                        _exprparse_parse_error(Error_Index_Out_Of_Bounds);
+
+                    auto node = dot ? std::make_shared<_internal::ReductionNode<T>>(kind, a_it->first, a_it->second, b_it->first, b_it->second)
+                                    : std::make_shared<_internal::ReductionNode<T>>(kind, a_it->first, a_it->second);
+                    if (lasts[0] != std::string::npos || lasts[1] != std::string::npos)
+                        node->SetSlice(firsts[0], firsts[1], lengths[0]);
+                    return node;
+                }
+
+                _exprparse_parse_error(Error_Unregistered_Symbol);
+            }
+
+        }
+    }
+
+
+
+    // Constructs expressions directly from data instead of text, resolving symbols registered in
+    // an expression. Terms can be reused, errors propagate to the terms built from them. Terms
+    // only combine with terms of builders of expressions sharing the same symbols.
+    //
+    //     exprparse::Builder<double> b(e);
+    //     e.Build(b.Add(b.Var("x"), b.Mul(b.Constant(2), b.Call("f", b.Var("y")))));
+    template<typename T>
+    class Builder {
+    public:
+        class Term {
+        public:
+            Status GetStatus() const { return _status; }
+
+        private:
+            friend class Builder<T>;
+            friend class Expression<T>;
+
+            std::shared_ptr<_internal::Node<T>> _node;
+            Status      _status = Error_Not_Compiled;
+            std::size_t _nodes       = 0;
+            std::size_t _depth       = 0;
+            std::size_t _window_rows = 0; // History of the windows in the term
+
+            std::shared_ptr<const void> _symbols; // Registry the symbols were resolved in
+        };
+
+    public:
+        Builder(const Expression<T> &expression) : _expression(expression) {}
+
+        Term Constant(T value) const
+        {
+            return Leaf(std::make_shared<_internal::ConstantNode<T>>(value));
+        }
+
+        Term Var(const std::string &name) const
+        {
+            auto symbols = _expression._registry.Read();
+            auto it = symbols->variables.Find(name);
+            if (!it)
+                return Error(Error_Unregistered_Symbol);
+
+            return Leaf(std::make_shared<_internal::VariableNode<T>>(it->first, it->second));
+        }
+
+        // Call of a registered function or table
+        Term Call(const std::string &name, const Term &argument) const
+        {
+            auto symbols = _expression._registry.Read();
+            auto it = symbols->functions.Find(name);
+            auto t_it = symbols->tables.Find(name);
+            if (!it && !t_it)
+                return Error(Error_Unregistered_Symbol);
+
+            if (argument._status != Success)
+                return argument;
+            if (Foreign(argument))
+                return Error(Error_Foreign_Term);
+
+            std::shared_ptr<_internal::Node<T>> node;
+            if (it) {
+                auto call = std::make_shared<_internal::FunctionNode<T>>(it->first, it->second);
+                call->LinkArgument(argument._node);
+                node = call;
+            }
+            else {
+                auto lookup = std::make_shared<_internal::TableNode<T>>(t_it->first, t_it->second);
+                lookup->LinkArgument(argument._node);
+                node = lookup;
+            }
+
+            Term term;
+            term._node        = node;
+            term._status      = Success;
+            term._nodes       = argument._nodes + 1;
+            term._depth       = argument._depth + 1;
+            term._window_rows = argument._window_rows;
+            term._symbols     = argument._symbols;
+            return term;
+        }
+
+        // Element at a constant index, checked against the current array size
+        Term Element(const std::string &name, std::size_t index) const
+        {
+            auto symbols = _expression._registry.Read();
+            auto it = symbols->arrays.Find(name);
+            if (!it)
+                return Error(Error_Unregistered_Symbol);
+
+            if (index >= it->second->size())
+                return Error(Error_Index_Out_Of_Bounds);
+
+            return Leaf(std::make_shared<_internal::ElementNode<T>>(it->first, it->second, index));
+        }
+
+        // Element at a computed index, checked on every evaluation
+        Term Element(const std::string &name, const Term &index) const
+        {
+            auto symbols = _expression._registry.Read();
+            auto it = symbols->arrays.Find(name);
+            if (!it)
+                return Error(Error_Unregistered_Symbol);
+
+            if (index._status != Success)
+                return index;
+            if (Foreign(index))
+                return Error(Error_Foreign_Term);
+
+            Term term;
+            term._node        = std::make_shared<_internal::ElementNode<T>>(it->first, it->second, index._node);
+            term._status      = Success;
+            term._nodes       = index._nodes + 1;
+            term._depth       = index._depth + 1;
+            term._window_rows = index._window_rows;
+            term._symbols     = index._symbols;
+            return term;
+        }
+
+        // Binds value to a local for the terms built by body, like name = value; body when parsing,
+        // or assigns it if name is a registered output. The local term passed to body is only valid
+        // inside the terms returned by it.
+        Term Let(const std::string &name, const Term &value, const std::function<Term(const Term &)> &body) const
+        {
+            if (value._status != Success)
+                return value;
+            if (Foreign(value))
+                return Error(Error_Foreign_Term);
+
+            auto symbols = _expression._registry.Read();
+            if (symbols->variables.Contains(name) || symbols->arrays.Contains(name))
+                return Error(Error_Variable_Already_Registered);
+            if (symbols->IsFunction(name))
+                return Error(Error_Variable_Function_Name_Clash);
+
+            auto output = symbols->outputs.Find(name);
+            auto let    = output ? std::make_shared<_internal::LetNode<T>>(name, output->second, true)
+                                 : std::make_shared<_internal::LetNode<T>>(name, std::make_shared<T>(T(0)));
+
+            Term result = body(Leaf(std::make_shared<_internal::LocalNode<T>>(name, let->Slot())));
+            if (result._status != Success)
+                return result;
+            if (Foreign(result))
+                return Error(Error_Foreign_Term);
+
+            let->LinkValue(value._node);
+            let->LinkBody(result._node);
+
+            Term term;
+            term._node        = let;
+            term._status      = Success;
+            term._nodes       = value._nodes + result._nodes + 1;
+            term._depth       = std::max(value._depth, result._depth) + 1;
+            term._window_rows = value._window_rows + result._window_rows;
+            term._symbols     = value._symbols;
+            return term;
+        }
+
+        // Built-in reduction as in the parser, other names the second array of dot
+        Term Reduce(const std::string &function, const std::string &array, const std::string &other = "") const
+        {
+            typename _internal::ReductionNode<T>::Kind kind;
+            if (!_internal::ReductionNode<T>::FromName(function, kind))
+                return Error(Error_Unregistered_Symbol);
+
+            bool dot = kind == _internal::ReductionNode<T>::Kind::Dot;
+            if (dot == other.empty())
+                return Error(Error_Syntax_Error);
+
+            auto symbols = _expression._registry.Read();
+            auto a_it = symbols->arrays.Find(array);
+            if (!a_it)
+                return Error(Error_Unregistered_Symbol);
+
+            if (!dot)
+                return Leaf(std::make_shared<_internal::ReductionNode<T>>(kind, a_it->first, a_it->second));
+
+            auto b_it = symbols->arrays.Find(other);
+            if (!b_it)
+                return Error(Error_Unregistered_Symbol);
+
+            if (a_it->second->size() != b_it->second->size())
+                return Error(Error_Index_Out_Of_Bounds);
+
+            return Leaf(std::make_shared<_internal::ReductionNode<T>>(kind, a_it->first, a_it->second, b_it->first, b_it->second));
+        }
+
+        // Stateful function of the stream of evaluations as in the parser, lag(x, k) or ema(x, alpha) etc.
+        // Every use of the term in built expressions keeps its own rows, as if its text was repeated.
+        Term Window(const std::string &function, const Term &argument, T parameter) const
+        {
+            typename _internal::WindowNode<T>::Kind kind;
+            if (!_internal::WindowNode<T>::FromName(function, kind))
+                return Error(Error_Unregistered_Symbol);
+
+            if (!_internal::WindowNode<T>::ValidParameter(kind, parameter, std::numeric_limits<std::size_t>::max()))
+                return Error(Error_Syntax_Error);
+            if (!_internal::WindowNode<T>::ValidParameter(kind, parameter, _expression._limits.max_window))
+                return Error(Error_Limit_Exceeded);
+
+            if (argument._status != Success)
+                return argument;
+            if (Foreign(argument))
+                return Error(Error_Foreign_Term);
+
+            std::size_t rows = argument._window_rows + _internal::WindowNode<T>::Rows(kind, parameter);
+            if (rows > _expression._limits.max_window_state)
+                return Error(Error_Limit_Exceeded);
+
+            auto window = std::make_shared<_internal::WindowNode<T>>(kind, parameter);
+            window->LinkArgument(argument._node);
+
+            Term term;
+            term._node        = window;
+            term._status      = Success;
+            term._nodes       = argument._nodes + 1;
+            term._depth       = argument._depth + 1;
+            term._window_rows = rows;
+            term._symbols     = argument._symbols;
+            return term;
+        }
+
+        Term Add(const Term &left, const Term &right) const { return Operator(_internal::OperatorNode<T>::Operator::Add, left, right); }
+        Term Sub(const Term &left, const Term &right) const { return Operator(_internal::OperatorNode<T>::Operator::Sub, left, right); }
+        Term Mul(const Term &left, const Term &right) const { return Operator(_internal::OperatorNode<T>::Operator::Mul, left, right); }
+        Term Div(const Term &left, const Term &right) const { return Operator(_internal::OperatorNode<T>::Operator::Div, left, right); }
+
+        // Same as the parser's negative sign, -x becomes 0 - x
+        Term Neg(const Term &term) const { return Sub(Constant(T(0)), term); }
+
+    private:
+        Term Leaf(const std::shared_ptr<_internal::Node<T>> &node) const
+        {
+            Term term;
+            term._node    = node;
+            term._status  = Success;
+            term._nodes   = 1;
+            term._depth   = 1;
+            term._symbols = _expression._registry.Identity();
+            return term;
+        }
+
+        // Built by the builder of an expression with other symbols, or before this expression shared another's
+        bool Foreign(const Term &term) const { return term._symbols != _expression._registry.Identity(); }
+
+        static Term Error(Status status)
+        {
+            Term term;
+            term._status = status;
+            return term;
+        }
+
+        Term Operator(typename _internal::OperatorNode<T>::Operator op, const Term &left, const Term &right) const
+        {
+            if (left._status != Success)
+                return left;
+            if (right._status != Success)
+                return right;
+            if (Foreign(left) || Foreign(right))
+                return Error(Error_Foreign_Term);
+
+            auto node = std::make_shared<_internal::OperatorNode<T>>(op);
+            node->LinkLeft(left._node);
+            node->LinkRight(right._node);
+
+            Term term;
+            term._node        = node;
+            term._status      = Success;
+            term._nodes       = left._nodes + right._nodes + 1;
+            term._depth       = std::max(left._depth, right._depth) + 1;
+            term._window_rows = left._window_rows + right._window_rows;
+            term._symbols     = left._symbols;
+            return term;
+        }
+
+    private:
+        const Expression<T> &_expression;
+    };
+
+
+
+    struct InternStatistics {
+        std::size_t entries     = 0; // Distinct live subtrees in the store
+        std::size_t lookups     = 0;
+        std::size_t hits        = 0;
+        std::size_t bytes_saved = 0; // Approximate bytes separate trees would need in addition
+    };
+
+
+
+    // Hash-consing store sharing identical immutable subtrees between expressions. Subtrees are
+    // reference counted and reclaimed once no expression uses them. Functions are only shared if
+    // they were registered as plain function pointers, other callables cannot be compared.
+    //
+    // With the epoch cache enabled, shared subtrees remember their value until AdvanceEpoch() is
+    // called, so they are evaluated once per epoch. Evaluation of cached expressions must then not
+    // run concurrently on several threads.
+    template<typename T>
+    class InternStore {
+    public:
+        static InternStore &Global()
+        {
+            static InternStore store;
+            return store;
+        }
+
+        std::shared_ptr<_internal::Node<T>> Intern(const std::shared_ptr<_internal::Node<T>> &root)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            auto interned = InternNode(root);
+
+            if (_nodes.size() > 2 * _collected_size + 1024) // Amortized reclamation of expired entries
+                CollectLocked();
+
+            return interned;
+        }
+
+        // Drops the entries of subtrees no longer referenced by any expression
+        void Collect()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            CollectLocked();
+        }
+
+        InternStatistics Statistics() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            InternStatistics statistics;
+            statistics.lookups = _lookups;
+            statistics.hits    = _hits;
+
+            // A subtree with n references would be n separate copies of the whole subtree, its shared
+            // descendants included as often as they occur in it
+            std::unordered_map<const _internal::Node<T> *, std::size_t> memo;
+
+            for (auto &entry : _nodes) {
+                auto node = entry.second.lock();
+                if (!node)
+                    continue;
+
+                statistics.entries++;
+
+                long references = node.use_count() - 1; // Without the lock above
+                if (references > 1)
+                    statistics.bytes_saved += (references - 1) * _internal::TreeMemory(node, &memo);
+            }
+
+            return statistics;
+        }
+
+        // Only affects subtrees interned afterwards
+        void EnableEpochCache(bool enable) { _epoch_cache = enable; }
+
+        // Invalidates the values remembered by the epoch cache
+        void AdvanceEpoch() { _epoch->fetch_add(1, std::memory_order_relaxed); }
+
+    private:
+        struct Key {
+            _internal::NodeType type;
+            int                 op = 0;
+            unsigned char       value[sizeof(T)] = {};
+            const void         *first  = nullptr;
+            const void         *second = nullptr;
+            std::size_t         index  = 0;
+            std::string         name;
+
+            bool operator==(const Key &other) const
+            {
+                return type == other.type && op == other.op && std::memcmp(value, other.value, sizeof(T)) == 0
+                    && first == other.first && second == other.second && index == other.index && name == other.name;
+            }
+        };
+
+        struct KeyHash {
+            std::size_t operator()(const Key &key) const
+            {
+                std::size_t hash = std::hash<std::string>()(key.name);
+                auto combine = [&hash](std::size_t value) { hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2); };
+
+                combine(static_cast<std::size_t>(key.type));
+                combine(static_cast<std::size_t>(key.op));
+                combine(std::hash<std::string>()(std::string(reinterpret_cast<const char *>(key.value), sizeof(T))));
+                combine(std::hash<const void *>()(key.first));
+                combine(std::hash<const void *>()(key.second));
+                combine(key.index);
+                return hash;
+            }
+        };
+
+        // Children are interned first, so equal subtrees have identical child pointers. Nodes are copied
+        // instead of relinked when a child changes, like in ReductionFuser, because builder terms can be
+        // shared with expressions that are not interned.
+        std::shared_ptr<_internal::Node<T>> InternNode(std::shared_ptr<_internal::Node<T>> node)
+        {
+            using namespace _internal;
+
+            Key key;
+            key.type = node->Type();
+
+            switch (node->Type()) {
+
+                case NodeType::Operator: {
+                    auto op    = std::static_pointer_cast<OperatorNode<T>>(node);
+                    auto left  = InternNode(op->Left());
+                    auto right = InternNode(op->Right());
+                    if (left != op->Left() || right != op->Right()) {
+                        auto copy = std::make_shared<OperatorNode<T>>(op->Op());
+                        copy->LinkLeft(left);
+                        copy->LinkRight(right);
+                        copy->SetCheckDivisor(op->CheckDivisor());
+                        node = op = copy;
+                    }
+
+                    key.op     = static_cast<int>(op->Op()) * 2 + op->CheckDivisor();
+                    key.first  = op->Left().get();
+                    key.second = op->Right().get();
+                    break;
+                }
+
+                case NodeType::Variable: {
+                    auto var = std::static_pointer_cast<VariableNode<T>>(node);
+                    key.name  = var->Name();
+                    key.first = var->Value().get();
+                    break;
+                }
+
+                case NodeType::Constant: {
+                    T value = std::static_pointer_cast<ConstantNode<T>>(node)->Value();
+                    std::memcpy(key.value, &value, sizeof(T));
+                    break;
+                }
+
+                case NodeType::Function: {
+                    auto func     = std::static_pointer_cast<FunctionNode<T>>(node);
+                    auto argument = InternNode(func->Argument());
+                    if (argument != func->Argument()) {
+                        auto copy = std::make_shared<FunctionNode<T>>(func->Name(), func->Function());
+                        copy->LinkArgument(argument);
+                        node = func = copy;
+                    }
+
+                    auto target = func->Function().template target<T(*)(T)>();
+                    if (!target)
+                        return node;
+
+                    key.name   = func->Name();
+                    key.first  = reinterpret_cast<const void *>(*target);
+                    key.second = func->Argument().get();
+                    break;
+                }
+
+                case NodeType::Table: {
+                    auto table    = std::static_pointer_cast<TableNode<T>>(node);
+                    auto argument = InternNode(table->Argument());
+                    if (argument != table->Argument()) {
+                        auto copy = std::make_shared<TableNode<T>>(table->Name(), table->GetTable());
+                        copy->LinkArgument(argument);
+                        node = table = copy;
+                    }
+
+                    key.name   = table->Name();
+                    key.first  = table->GetTable().get();
+                    key.second = table->Argument().get();
+                    break;
+                }
+
+                case NodeType::Window: { // The state belongs to one expression, interning happens before any row
+                    auto window   = std::static_pointer_cast<WindowNode<T>>(node);
+                    auto argument = InternNode(window->Argument());
+                    if (argument == window->Argument())
+                        return node;
+
+                    auto copy = std::make_shared<WindowNode<T>>(window->GetKind(), window->Parameter());
+                    copy->LinkArgument(argument);
+                    return copy;
+                }
+
+                case NodeType::Element: {
+                    auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                    if (element->IndexNode()) {
+                        auto index = InternNode(element->IndexNode());
+                        if (index != element->IndexNode()) {
+                            auto copy = std::make_shared<ElementNode<T>>(element->Name(), element->Array(), index);
+                            copy->SetCheckIndex(element->CheckIndex());
+                            node = element = copy;
+                        }
+                    }
+
+                    key.op     = element->CheckIndex();
+                    key.name   = element->Name();
+                    key.first  = element->Array().get();
+                    key.second = element->IndexNode().get();
+                    key.index  = element->Index();
+                    break;
+                }
+
+                case NodeType::Reduction: {
+                    auto reduction = std::static_pointer_cast<ReductionNode<T>>(node);
+                    if (!reduction->Whole()) // Slices are rare, created by the optimizer
+                        return node;
+
+                    key.op     = static_cast<int>(reduction->GetKind());
+                    key.name   = reduction->Name() + ',' + reduction->OtherName();
+                    key.first  = reduction->Array().get();
+                    key.second = reduction->Other().get();
+                    break;
+                }
+
+                case NodeType::Let: { // Slots belong to one expression, only the statements are shared
+                    auto let   = std::static_pointer_cast<LetNode<T>>(node);
+                    auto value = InternNode(let->Value());
+                    auto body  = InternNode(let->Body());
+                    if (value == let->Value() && body == let->Body())
+                        return node;
+
+                    auto copy = std::make_shared<LetNode<T>>(let->Name(), let->Slot(), let->Output());
+                    copy->LinkValue(value);
+                    copy->LinkBody(body);
+                    return copy;
+                }
+
+                default: // Already interned, or a local which is never shared
+                    return node;
+            }
+
+            _lookups++;
+
+            auto it = _nodes.find(key);
+            if (it != _nodes.end()) {
+                if (auto existing = it->second.lock()) {
+                    _hits++;
+                    return existing;
+                }
+            }
+
+            std::shared_ptr<Node<T>> stored = node;
+            if (_epoch_cache && (key.type == NodeType::Operator || key.type == NodeType::Function))
+                stored = std::make_shared<CachedNode<T>>(node, _epoch);
+
+            _nodes[key] = stored;
+            return stored;
+        }
+
+        void CollectLocked()
+        {
+            for (auto it = _nodes.begin(); it != _nodes.end(); )
+                it = it->second.expired() ? _nodes.erase(it) : std::next(it);
+
+            _collected_size = _nodes.size();
+        }
+
+    private:
+        mutable std::mutex _mutex;
+
+        std::unordered_map<Key, std::weak_ptr<_internal::Node<T>>, KeyHash> _nodes;
+        std::size_t _collected_size = 0;
+
+        std::size_t _lookups = 0;
+        std::size_t _hits    = 0;
+
+        bool                                        _epoch_cache = false;
+        std::shared_ptr<std::atomic<std::uint64_t>> _epoch = std::make_shared<std::atomic<std::uint64_t>>(0);
+    };
+
+
+
+    // Hash and equality functors keying containers on the structure of parsed expressions,
+    // for example std::unordered_map<Expression<T>, V, StructuralHash<T>, StructuralEqual<T>>
+    template<typename T>
+    struct StructuralHash {
+        bool normalize_commutative = false;
+
+        std::size_t operator()(const Expression<T> &expression) const
+        {
+            return static_cast<std::size_t>(expression.StructuralHash(normalize_commutative));
+        }
+    };
+
+    template<typename T>
+    struct StructuralEqual {
+        bool normalize_commutative = false;
+
+        bool operator()(const Expression<T> &a, const Expression<T> &b) const
+        {
+            return a.StructurallyEqual(b, normalize_commutative);
+        }
+    };
+
+
+
+    // Compact encoding of a parsed expression: postfix bytecode with 8-bit opcodes, 16-bit symbol
+    // indices, small integer constants inline and a deduplicated constant pool, stored in a single
+    // allocation. Symbols are shared with all compact expressions compiled from the same expression.
+    // Evaluates to bit-identical results as the expression it was compiled from.
+    template<typename T>
+    class CompactExpression {
+    public:
+        Status Compile(const Expression<T> &expression)
+        {
+            using namespace _internal;
+
+            _data.reset();
+            _symbols.reset();
+
+            if (!expression._base)
+                return Error_Not_Compiled;
+
+            if (!expression._windows.empty()) // Compact expressions share no state with the expression
+                return Error_Unsupported;
+
+            auto symbols = expression.Symbols();
+            if (symbols->variables.size() > 0xFFFF || symbols->functions.size() > 0xFFFF || symbols->tables.size() > 0xFFFF
+                || symbols->arrays.size() > 0xFFFF || symbols->outputs.size() > 0xFFFF)
+                return Error_Limit_Exceeded;
+
+            Encoder encoder(*symbols);
+            std::size_t stack = encoder.Emit(expression._base);
+
+            if (stack > compact::max_stack || encoder.code.size() > 0xFFFF || encoder.constants.size() > 0xFF || encoder.locals.size() > compact::max_locals)
+                return Error_Limit_Exceeded;
+
+            Header header;
+            header.code_size      = static_cast<std::uint16_t>(encoder.code.size());
+            header.constant_count = static_cast<std::uint8_t>(encoder.constants.size());
+            header.stack_size     = static_cast<std::uint8_t>(stack);
+            header.local_count    = static_cast<std::uint8_t>(encoder.locals.size());
+
+            _data.reset(new std::uint8_t[ConstantsOffset() + encoder.constants.size() * sizeof(T) + encoder.code.size()]);
+            std::memcpy(_data.get(), &header, sizeof(header));
+            if (!encoder.constants.empty())
+                std::memcpy(_data.get() + ConstantsOffset(), encoder.constants.data(), encoder.constants.size() * sizeof(T));
+            if (!encoder.code.empty())
+                std::memcpy(Code(), encoder.code.data(), encoder.code.size());
+
+            _symbols = symbols;
+            return Success;
+        }
+
+        T Eval(Status &status) const
+        {
+            if (!_data) {
+                status = Error_Not_Compiled;
+                return T(0);
+            }
+
+            status = Success;
+            return _internal::compact::Run(Code(), GetHeader().code_size, Constants(),
+                                           _symbols->variable_pointers.data(), _symbols->functions.data(), _symbols->table_pointers.data(),
+                                           _symbols->array_pointers.data(), _symbols->output_pointers.data(), status);
+        }
+
+        // Evaluates rows of column-major input, with the results of loading every row into the named variables
+        // and calling Eval. Rows are evaluated in blocks, one instruction over the whole block at a time, so
+        // the arithmetic vectorizes. Variables without a column keep their values. status is that of any failing
+        // row, whose result is 0 as in Eval; the other rows are evaluated as well.
+        void EvalBatch(const std::map<std::string, const T *> &columns, std::size_t rows, T *out, Status &status) const
+        {
+            if (!_data) {
+                status = Error_Not_Compiled;
+                return;
+            }
+
+            std::vector<const T *> inputs(_symbols->variables.size(), nullptr);
+            for (auto &column : columns) {
+                auto it = _symbols->variable_index.find(column.first);
+                if (it == _symbols->variable_index.end()) {
+                    status = Error_Unregistered_Symbol;
+                    return;
+                }
+                inputs[it->second] = column.second;
+            }
+
+            const Header header = GetHeader();
+            std::vector<T> stack(std::max<std::size_t>(header.stack_size, 1) * batch_block);
+            std::vector<T> locals(header.local_count * batch_block);
+
+            status = Success;
+            for (std::size_t row = 0; row < rows; row += batch_block) {
+                std::size_t n = std::min(batch_block, rows - row);
+                _internal::compact::RunBatch(Code(), header.code_size, Constants(), _symbols->variable_pointers.data(), inputs.data(), row, n,
+                                             _symbols->functions.data(), _symbols->table_pointers.data(), _symbols->array_pointers.data(),
+                                             _symbols->output_pointers.data(), stack.data(), locals.data(), batch_block, status);
+                std::copy(stack.begin(), stack.begin() + n, out + row);
+            }
+        }
+
+        // Bytes owned by this expression, symbols shared with other expressions are not included
+        std::size_t MemoryUsage() const
+        {
+            if (!_data)
+                return sizeof(*this);
+
+            const Header header = GetHeader();
+            return sizeof(*this) + ConstantsOffset() + header.constant_count * sizeof(T) + header.code_size;
+        }
+
+        // Bytes of the symbol table shared by all compact expressions compiled from the same expression
+        std::size_t SharedMemoryUsage() const
+        {
+            if (!_symbols)
+                return 0;
+
+            return sizeof(*_symbols)
+                 + _symbols->variables.size() * (sizeof(std::shared_ptr<T>) + sizeof(const T *))
+                 + _symbols->functions.size() * sizeof(std::function<T(T)>)
+                 + _symbols->tables.size() * (sizeof(std::shared_ptr<const Table<T>>) + sizeof(const Table<T> *));
+        }
+
+    private:
+        template<typename U>
+        friend class shm::Publisher;
+
+        static constexpr std::size_t batch_block = 64; // Rows of one block of EvalBatch
+
+        struct Header {
+            std::uint16_t code_size;
+            std::uint8_t  constant_count;
+            std::uint8_t  stack_size;  // Slots used by the code, for the blocks of EvalBatch
+            std::uint8_t  local_count;
+        };
+
+        static constexpr std::size_t ConstantsOffset()
+        {
+            return (sizeof(Header) + alignof(T) - 1) / alignof(T) * alignof(T);
+        }
+
+        Header GetHeader() const
+        {
+            Header header;
+            std::memcpy(&header, _data.get(), sizeof(header));
+            return header;
+        }
+
+        const T *Constants() const { return reinterpret_cast<const T *>(_data.get() + ConstantsOffset()); }
+
+        std::uint8_t *Code() const { return _data.get() + ConstantsOffset() + GetHeader().constant_count * sizeof(T); }
+
+        struct Encoder {
+            Encoder(const _internal::SymbolTable<T> &symbols) : symbols(symbols) {}
+
+            // Stack slots needed to evaluate a subtree when the larger operand is always emitted first
+            std::size_t StackNeed(const std::shared_ptr<_internal::Node<T>> &node)
+            {
+                using namespace _internal;
+
+                auto it = needs.find(node.get());
+                if (it != needs.end())
+                    return it->second;
+
+                std::size_t need = 1;
+                if (node->Type() == NodeType::Operator) {
+                    auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                    std::size_t left  = StackNeed(op->Left());
+                    std::size_t right = StackNeed(op->Right());
+                    need = left == right ? left + 1 : std::max(left, right);
+                }
+                else if (node->Type() == NodeType::Function) {
+                    need = StackNeed(std::static_pointer_cast<FunctionNode<T>>(node)->Argument());
+                }
+                else if (node->Type() == NodeType::Table) {
+                    need = StackNeed(std::static_pointer_cast<TableNode<T>>(node)->Argument());
+                }
+                else if (node->Type() == NodeType::Cached) {
+                    need = StackNeed(std::static_pointer_cast<CachedNode<T>>(node)->Inner());
+                }
+                else if (node->Type() == NodeType::Element && std::static_pointer_cast<ElementNode<T>>(node)->IndexNode()) {
+                    need = StackNeed(std::static_pointer_cast<ElementNode<T>>(node)->IndexNode());
+                }
+                else if (node->Type() == NodeType::Let) { // The value is popped before the body runs
+                    auto let = std::static_pointer_cast<LetNode<T>>(node);
+                    need = std::max(StackNeed(let->Value()), StackNeed(let->Body()));
+                }
+
+                needs.emplace(node.get(), need);
+                return need;
+            }
+
+            std::size_t Emit(const std::shared_ptr<_internal::Node<T>> &node)
+            {
+                using namespace _internal;
+                using namespace _internal::compact;
+
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+
+                        bool reversed = StackNeed(op->Right()) > StackNeed(op->Left());
+                        Emit(reversed ? op->Right() : op->Left());
+                        Emit(reversed ? op->Left()  : op->Right());
+
+                        switch (op->Op()) {
+                            case OperatorNode<T>::Operator::Add: code.push_back(Add); break; // Exactly commutative
+                            case OperatorNode<T>::Operator::Mul: code.push_back(Mul); break;
+                            case OperatorNode<T>::Operator::Sub: code.push_back(reversed ? ReverseSub : Sub); break;
+                            case OperatorNode<T>::Operator::Div:
+                                if (op->CheckDivisor())
+                                    code.push_back(reversed ? ReverseDiv : Div);
+                                else
+                                    code.push_back(reversed ? UncheckedReverseDiv : UncheckedDiv);
+                                break;
+                        }
+                        break;
+                    }
+
+                    case NodeType::Variable: {
+                        auto var = std::static_pointer_cast<VariableNode<T>>(node);
+                        code.push_back(PushVariable);
+                        PushIndex(symbols.variable_index.at(var->Name()));
+                        break;
+                    }
+
+                    case NodeType::Constant: {
+                        T value = std::static_pointer_cast<ConstantNode<T>>(node)->Value();
+
+                        // Small integers are stored inline, -0 is not since it would lose its sign
+                        if (value >= T(-128) && value <= T(127) && value == T(static_cast<int>(value)) && !(value == T(0) && std::signbit(value))) {
+                            code.push_back(PushImmediate);
+                            code.push_back(static_cast<std::uint8_t>(static_cast<std::int8_t>(value)));
+                            break;
+                        }
+
+                        std::size_t index = 0;
+                        while (index < constants.size() && std::memcmp(&constants[index], &value, sizeof(T)) != 0)
+                            index++;
+                        if (index == constants.size())
+                            constants.push_back(value);
+
+                        code.push_back(PushConstant);
+                        code.push_back(static_cast<std::uint8_t>(index));
+                        break;
+                    }
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                        Emit(func->Argument());
+                        code.push_back(Call);
+                        PushIndex(symbols.function_index.at(func->Name()));
+                        break;
+                    }
+
+                    case NodeType::Table: {
+                        auto table = std::static_pointer_cast<TableNode<T>>(node);
+                        Emit(table->Argument());
+                        code.push_back(LookupTable);
+                        PushIndex(symbols.table_index.at(table->Name()));
+                        break;
+                    }
+
+                    case NodeType::Cached:
+                        Emit(std::static_pointer_cast<CachedNode<T>>(node)->Inner());
+                        break;
+
+                    case NodeType::Element: {
+                        auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                        if (element->IndexNode()) {
+                            Emit(element->IndexNode());
+                            code.push_back(element->CheckIndex() ? IndexElement : UncheckedIndexElement);
+                            PushIndex(symbols.array_index.at(element->Name()));
+                        }
+                        else {
+                            std::uint32_t index = static_cast<std::uint32_t>(element->Index());
+                            std::uint8_t bytes[sizeof(index)];
+                            std::memcpy(bytes, &index, sizeof(index));
+
+                            code.push_back(PushElement);
+                            PushIndex(symbols.array_index.at(element->Name()));
+                            code.insert(code.end(), bytes, bytes + sizeof(index));
+                        }
+                        break;
+                    }
+
+                    case NodeType::Reduction: {
+                        auto reduction = std::static_pointer_cast<ReductionNode<T>>(node);
+                        std::uint16_t array = symbols.array_index.at(reduction->Name());
+
+                        code.push_back(reduction->Whole() ? Reduce : ReduceSlice);
+                        code.push_back(static_cast<std::uint8_t>(reduction->GetKind()));
+                        PushIndex(array);
+                        PushIndex(reduction->Other() ? symbols.array_index.at(reduction->OtherName()) : array);
+
+                        if (!reduction->Whole()) {
+                            std::uint32_t slice[3] = {
+                                static_cast<std::uint32_t>(reduction->Offset()),
+                                static_cast<std::uint32_t>(reduction->OtherOffset()),
+                                static_cast<std::uint32_t>(reduction->Length())
+                            };
+                            std::uint8_t bytes[sizeof(slice)];
+                            std::memcpy(bytes, slice, sizeof(slice));
+                            code.insert(code.end(), bytes, bytes + sizeof(slice));
+                        }
+                        break;
+                    }
+
+                    case NodeType::Let: {
+                        auto let = std::static_pointer_cast<LetNode<T>>(node);
+                        Emit(let->Value());
+
+                        std::size_t index = locals.emplace(let->Slot().get(), locals.size()).first->second;
+                        if (let->Output()) {
+                            code.push_back(StoreOutput);
+                            PushIndex(symbols.output_index.at(let->Name()));
+                        }
+                        else {
+                            code.push_back(StoreLocal);
+                        }
+                        code.push_back(static_cast<std::uint8_t>(index));
+
+                        Emit(let->Body());
+                        break;
+                    }
+
+                    case NodeType::Local: {
+                        auto local = std::static_pointer_cast<LocalNode<T>>(node);
+                        code.push_back(PushLocal);
+                        code.push_back(static_cast<std::uint8_t>(locals.at(local->Slot().get())));
+                        break;
+                    }
+
+                    case NodeType::Window: // Rejected by Compile
+                        break;
+                }
+
+                return StackNeed(node);
+            }
+
+            void PushIndex(std::uint16_t index)
+            {
+                std::uint8_t bytes[sizeof(index)];
+                std::memcpy(bytes, &index, sizeof(index));
+                code.insert(code.end(), bytes, bytes + sizeof(index));
+            }
+
+            const _internal::SymbolTable<T> &symbols;
+
+            std::vector<std::uint8_t> code;
+            std::vector<T>            constants;
+
+            std::unordered_map<const _internal::Node<T> *, std::size_t> needs;
+            std::unordered_map<const T *, std::size_t>                  locals; // Slot of a let-binding to its index
+        };
+
+    private:
+        std::unique_ptr<std::uint8_t[]>                  _data;
+        std::shared_ptr<const _internal::SymbolTable<T>> _symbols;
+    };
+
+
+
+    // Bounds of an expression over boxes of variable ranges, evaluated over the same syntax tree
+    // as Expression<T>. The bounds contain every point evaluation in the box: arithmetic rounds
+    // outward, repeated operands of a product are squared, and reductions over arrays account for
+    // their rounding error. Registered functions need an interval version to be evaluated.
+    // Evaluation reuses registers of the object, so one object must not be evaluated from several
+    // threads at once; copies can.
+    //
+    //     exprparse::IntervalExpression<double> bounds;
+    //     bounds.Compile(e);
+    //     auto range = bounds.Eval({ { "x", { 0, 1 } }, { "y", { -1, 1 } } }, status);
+    template<typename T>
+    class IntervalExpression {
+    public:
+        typedef std::function<Interval<T>(Interval<T>)> Function;
+
+        // Interval version of a function registered with the expression, must contain f(x) for all x of the argument
+        Status RegisterFunction(const std::string &name, const Function &function)
+        {
+            return _function_map.try_emplace(name, function).second ? Success : Error_Function_Already_Registered;
+        }
+
+        // Interval version of a monotonic point function accurate to one ulp
+        static Function Monotonic(const std::function<T(T)> &function, bool increasing)
+        {
+            return [function, increasing](Interval<T> x) {
+                T a = function(x.lower), b = function(x.upper);
+                if (!increasing)
+                    std::swap(a, b);
+
+                Interval<T> result;
+                result.lower = _internal::interval::Down(_internal::interval::Down(a));
+                result.upper = _internal::interval::Up(_internal::interval::Up(b));
+                return result;
+            };
+        }
+
+        Status Compile(const Expression<T> &expression)
+        {
+            _code.clear();
+            _variables.clear();
+            _bindings.clear();
+            _functions.clear();
+            _result = 0;
+
+            if (!expression.AST())
+                return Error_Not_Compiled;
+
+            Compiler compiler(*this);
+            Status status = Success;
+            _result = compiler.Emit(expression.AST(), status);
+
+            if (status != Success) {
+                _code.clear();
+                _variables.clear();
+                _bindings.clear();
+                _functions.clear();
+            }
+
+            // Registers of one block serve both Eval and EvalBatch
+            _lower.assign(_code.size() * block, T(0));
+            _upper.assign(_code.size() * block, T(0));
+            _lower_inputs.assign(_variables.size(), nullptr);
+            _upper_inputs.assign(_variables.size(), nullptr);
+            _box.assign(_variables.size(), Interval<T>());
+            return status;
+        }
+
+        // Variables in input slot order, the order of the inputs and columns arguments
+        const std::vector<std::string> &Variables() const { return _variables; }
+
+        // Bounds over the given variable ranges, in slot order
+        Interval<T> Eval(const Interval<T> *inputs, Status &status) const
+        {
+            Interval<T> result;
+            if (_code.empty()) {
+                status = Error_Not_Compiled;
+                return result;
+            }
+
+            status = Success;
+
+            for (std::size_t i = 0; i < _variables.size(); i++) {
+                _lower_inputs[i] = &inputs[i].lower;
+                _upper_inputs[i] = &inputs[i].upper;
+            }
+
+            Run(_lower_inputs.data(), _upper_inputs.data(), 0, 1, _lower.data(), _upper.data(), 1, status);
+
+            result.lower = _lower[_result];
+            result.upper = _upper[_result];
+            return result;
+        }
+
+        // Bounds over ranges given by name, other variables are taken at their current value
+        Interval<T> Eval(const std::map<std::string, Interval<T>> &box, Status &status) const
+        {
+            for (std::size_t i = 0; i < _variables.size(); i++) {
+                auto it = box.find(_variables[i]);
+                if (it != box.end())
+                    _box[i] = it->second;
+                else
+                    _box[i].lower = _box[i].upper = *_bindings[i];
+            }
+
+            return Eval(_box.data(), status);
+        }
+
+        // Bounds of rows of boxes given as columns of lower and upper ends in slot order (structure of
+        // arrays). Rows are evaluated in blocks, one operation over the whole block at a time.
+        void EvalBatch(const T *const *lower, const T *const *upper, std::size_t rows,
+                       T *out_lower, T *out_upper, Status &status) const
+        {
+            if (_code.empty()) {
+                status = Error_Not_Compiled;
+                return;
+            }
+
+            status = Success;
+
+            for (std::size_t row = 0; row < rows; row += block) {
+                std::size_t n = std::min(block, rows - row);
+                Run(lower, upper, row, n, _lower.data(), _upper.data(), block, status);
+
+                std::copy(_lower.begin() + _result * block, _lower.begin() + _result * block + n, out_lower + row);
+                std::copy(_upper.begin() + _result * block, _upper.begin() + _result * block + n, out_upper + row);
+            }
+        }
+
+    private:
+        static constexpr std::size_t block = 64;
+
+        enum class Op { Input, Constant, Element, IndexElement, Reduce, Add, Sub, Mul, Square, Div, Call };
+
+        // One operation writing its register, operands are earlier registers
+        struct Instruction {
+            Op            op = Op::Constant;
+            std::uint32_t a = 0, b = 0; // Operand registers, or the input slot / function index
+            T             value = T(0);
+            std::shared_ptr<std::vector<T>>                    array;
+            std::size_t                                        index = 0;
+            std::shared_ptr<const _internal::ReductionNode<T>> reduction;
+        };
+
+        struct Compiler {
+            Compiler(IntervalExpression &target) : target(target) {}
+
+            std::uint32_t Add(Instruction instruction)
+            {
+                target._code.push_back(instruction);
+                return static_cast<std::uint32_t>(target._code.size() - 1);
+            }
+
+            // Shared subtrees, repeated variables and locals map to one register, so x * x is a square
+            std::uint32_t Emit(const std::shared_ptr<_internal::Node<T>> &node, Status &status)
+            {
+                using namespace _internal;
+
+                const void *key = node.get();
+                if (node->Type() == NodeType::Variable)
+                    key = std::static_pointer_cast<VariableNode<T>>(node)->Value().get();
+                else if (node->Type() == NodeType::Local)
+                    key = std::static_pointer_cast<LocalNode<T>>(node)->Slot().get();
+
+                auto it = registers.find(key);
+                if (it != registers.end())
+                    return it->second;
+
+                Instruction instruction;
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                        instruction.a = Emit(op->Left(), status);
+                        instruction.b = Emit(op->Right(), status);
+
+                        switch (op->Op()) {
+                            case OperatorNode<T>::Operator::Add: instruction.op = Op::Add; break;
+                            case OperatorNode<T>::Operator::Sub: instruction.op = Op::Sub; break;
+                            case OperatorNode<T>::Operator::Mul: instruction.op = instruction.a == instruction.b ? Op::Square : Op::Mul; break;
+                            case OperatorNode<T>::Operator::Div: instruction.op = Op::Div; break;
+                        }
+                        break;
+                    }
+
+                    case NodeType::Variable: {
+                        auto var = std::static_pointer_cast<VariableNode<T>>(node);
+                        instruction.op = Op::Input;
+                        instruction.a  = static_cast<std::uint32_t>(target._variables.size());
+                        target._variables.push_back(var->Name());
+                        target._bindings.push_back(var->Value());
+                        break;
+                    }
+
+                    case NodeType::Constant:
+                        instruction.op    = Op::Constant;
+                        instruction.value = std::static_pointer_cast<ConstantNode<T>>(node)->Value();
+                        break;
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                        auto f_it = target._function_map.find(func->Name());
+                        if (f_it == target._function_map.end()) {
+                            status = Error_Unsupported;
+                            return 0;
+                        }
+
+                        instruction.op = Op::Call;
+                        instruction.a  = Emit(func->Argument(), status);
+                        instruction.b  = static_cast<std::uint32_t>(target._functions.size());
+                        target._functions.push_back(f_it->second);
+                        break;
+                    }
+
+                    case NodeType::Table: { // Bounded by the table itself
+                        auto table  = std::static_pointer_cast<TableNode<T>>(node);
+                        auto lookup = table->GetTable();
+
+                        instruction.op = Op::Call;
+                        instruction.a  = Emit(table->Argument(), status);
+                        instruction.b  = static_cast<std::uint32_t>(target._functions.size());
+                        target._functions.push_back([lookup](Interval<T> x) { return lookup->Bounds(x); });
+                        break;
+                    }
+
+                    case NodeType::Window: // Depends on previous rows
+                        status = Error_Unsupported;
+                        return 0;
+
+                    case NodeType::Cached:
+                        return Emit(std::static_pointer_cast<CachedNode<T>>(node)->Inner(), status);
+
+                    case NodeType::Element: {
+                        auto element = std::static_pointer_cast<ElementNode<T>>(node);
+                        instruction.array = element->Array();
+                        if (element->IndexNode()) {
+                            instruction.op = Op::IndexElement;
+                            instruction.a  = Emit(element->IndexNode(), status);
+                        }
+                        else {
+                            instruction.op    = Op::Element;
+                            instruction.index = element->Index();
+                        }
+                        break;
+                    }
+
+                    case NodeType::Reduction:
+                        instruction.op        = Op::Reduce;
+                        instruction.reduction = std::static_pointer_cast<ReductionNode<T>>(node);
+                        break;
+
+                    case NodeType::Let: { // Assignments to outputs are not performed, only bounded
+                        auto let = std::static_pointer_cast<LetNode<T>>(node);
+                        registers.emplace(let->Slot().get(), Emit(let->Value(), status));
+                        return Emit(let->Body(), status);
+                    }
+
+                    default:
+                        status = Error_Unknown;
+                        return 0;
+                }
+
+                std::uint32_t result = Add(instruction);
+                registers.emplace(key, result);
+                return result;
+            }
+
+            IntervalExpression &target;
+            std::unordered_map<const void *, std::uint32_t> registers;
+        };
+
+        // Bounds of a reduction over the current array contents, widened by the rounding error of the kernels
+        static Interval<T> Reduce(const _internal::ReductionNode<T> &reduction)
+        {
+            using namespace _internal;
+            typedef typename ReductionNode<T>::Kind Kind;
+
+            const T *a = reduction.Array()->data() + reduction.Offset();
+            const T *b = reduction.Other() ? reduction.Other()->data() + reduction.OtherOffset() : a;
+            std::size_t n = reduction.Length();
+
+            Interval<T> result;
+            if (reduction.GetKind() == Kind::Min || reduction.GetKind() == Kind::Max) {
+                Status ignored = Success; // Min and max are exact
+                result.lower = result.upper = reduction.Eval(ignored);
+                return result;
+            }
+
+            bool sum = reduction.GetKind() == Kind::Sum;
+            T value = sum ? kernels::Kernels<T>().sum(a, n) : kernels::Kernels<T>().dot(a, b, n);
+
+            T magnitude = T(0);
+            for (std::size_t i = 0; i < n; i++)
+                magnitude += sum ? std::fabs(a[i]) : std::fabs(a[i] * b[i]);
+
+            // Recursive summation of n terms errs by less than n * epsilon of the magnitude
+            T error = interval::Up(interval::Up(T(n + 1) * std::numeric_limits<T>::epsilon()) * interval::Up(magnitude));
+            result.lower = interval::Down(value - error);
+            result.upper = interval::Up(value + error);
+
+            if (reduction.GetKind() == Kind::Norm2) {
+                result.lower = interval::Down(std::sqrt(std::max(result.lower, T(0))));
+                result.upper = interval::Up(std::sqrt(result.upper));
+            }
+            return result;
+        }
+
+        // Evaluates rows [first, first + n) of the inputs into registers of the given stride
+        void Run(const T *const *lower_inputs, const T *const *upper_inputs, std::size_t first, std::size_t n,
+                 T *lower, T *upper, std::size_t stride, Status &status) const
+        {
+            const _internal::kernels::KernelSet<T> &kernels = _internal::kernels::Kernels<T>();
+
+            for (std::size_t r = 0; r < _code.size(); r++) {
+                const Instruction &instruction = _code[r];
+
+                T *l = lower + r * stride;
+                T *u = upper + r * stride;
+                const T *al = lower + instruction.a * stride, *au = upper + instruction.a * stride;
+                const T *bl = lower + instruction.b * stride, *bu = upper + instruction.b * stride;
+
+                switch (instruction.op) {
+
+                    case Op::Input:
+                        std::copy(lower_inputs[instruction.a] + first, lower_inputs[instruction.a] + first + n, l);
+                        std::copy(upper_inputs[instruction.a] + first, upper_inputs[instruction.a] + first + n, u);
+                        break;
+
+                    case Op::Constant:
+                        std::fill(l, l + n, instruction.value);
+                        std::fill(u, u + n, instruction.value);
+                        break;
+
+                    case Op::Element:
+                        std::fill(l, l + n, (*instruction.array)[instruction.index]);
+                        std::fill(u, u + n, (*instruction.array)[instruction.index]);
+                        break;
+
+                    case Op::IndexElement:
+                        for (std::size_t i = 0; i < n; i++) {
+                            // Indices are truncated like in the point evaluation, points out of bounds are excluded
+                            const std::vector<T> &array = *instruction.array;
+                            if (!(au[i] >= T(0) && al[i] < T(array.size()))) {
+                                status = Error_Index_Out_Of_Bounds;
+                                l[i] = u[i] = T(0);
+                                continue;
+                            }
+
+                            std::size_t low  = al[i] > T(0) ? static_cast<std::size_t>(al[i]) : 0;
+                            std::size_t high = au[i] < T(array.size()) ? static_cast<std::size_t>(au[i]) : array.size() - 1;
+
+                            auto range = std::minmax_element(array.begin() + low, array.begin() + high + 1);
+                            l[i] = *range.first;
+                            u[i] = *range.second;
+                        }
+                        break;
+
+                    case Op::Reduce: {
+                        Interval<T> bounds = Reduce(*instruction.reduction);
+                        std::fill(l, l + n, bounds.lower);
+                        std::fill(u, u + n, bounds.upper);
+                        break;
+                    }
+
+                    case Op::Add:
+                        kernels.interval_add(al, au, bl, bu, l, u, n);
+                        break;
+
+                    case Op::Sub:
+                        kernels.interval_sub(al, au, bl, bu, l, u, n);
+                        break;
+
+                    case Op::Mul:
+                        kernels.interval_multiply(al, au, bl, bu, l, u, n);
+                        break;
+
+                    case Op::Square:
+                        kernels.interval_square(al, au, l, u, n);
+                        break;
+
+                    case Op::Div:
+                        if (!kernels.interval_divide(al, au, bl, bu, l, u, n))
+                            status = Error_Division_By_Zero;
+                        break;
+
+                    case Op::Call:
+                        for (std::size_t i = 0; i < n; i++) {
+                            Interval<T> argument;
+                            argument.lower = al[i];
+                            argument.upper = au[i];
+
+                            Interval<T> result = _functions[instruction.b](argument);
+                            l[i] = result.lower;
+                            u[i] = result.upper;
+                        }
+                        break;
+                }
+            }
+        }
+
+    private:
+        std::map<std::string, Function> _function_map;
+
+        std::vector<Instruction>         _code;
+        std::uint32_t                    _result = 0;
+        std::vector<std::string>         _variables;
+        std::vector<std::shared_ptr<T>>  _bindings;
+        std::vector<Function>            _functions;
+
+        // Scratch of Eval and EvalBatch, sized by Compile so that evaluation does not allocate
+        mutable std::vector<T>           _lower, _upper;
+        mutable std::vector<const T *>   _lower_inputs, _upper_inputs;
+        mutable std::vector<Interval<T>> _box;
+    };
+
+
+
+    // Set of named expressions where each expression can be used as a variable of the others.
+    // Expressions are evaluated in topological order, independent expressions of the same
+    // layer optionally in parallel, and only the expressions downstream of invalidated inputs are recomputed.
+    template<typename T>
+    class ExpressionGraph {
+    public:
+        Status RegisterVariable(const std::string &name, const std::shared_ptr<T> &variable)
+        {
+            if (_functions.find(name) != _functions.end())
+                return Error_Variable_Function_Name_Clash;
+
+            if (_index.find(name) != _index.end())
+                return Error_Variable_Already_Registered;
+
+            auto pair = _inputs.try_emplace(name, variable);
+            if (pair.second)
+                _compiled = false;
+            return pair.second ? Success : Error_Variable_Already_Registered;
+        }
+
+        Status RegisterFunction(const std::string &name, const std::function<T(T)> &function)
+        {
+            if (_inputs.find(name) != _inputs.end() || _index.find(name) != _index.end())
+                return Error_Variable_Function_Name_Clash;
+
+            auto pair = _functions.try_emplace(name, function);
+            if (pair.second)
+                _compiled = false;
+            return pair.second ? Success : Error_Function_Already_Registered;
+        }
+
+        // Adds a named expression, its value can be referenced by name from the other expressions
+        Status AddExpression(const std::string &name, const std::string &expr_string)
+        {
+            if (_functions.find(name) != _functions.end())
+                return Error_Variable_Function_Name_Clash;
+
+            if (_inputs.find(name) != _inputs.end() || _index.find(name) != _index.end())
+                return Error_Variable_Already_Registered;
+
+            _index.emplace(name, _nodes.size());
+            _nodes.emplace_back();
+            _nodes.back().name   = name;
+            _nodes.back().source = expr_string;
+            _nodes.back().output = std::make_shared<T>(0);
+
+            _compiled = false;
+            return Success;
+        }
+
+        // Parses all expressions, resolves dependencies and orders them into layers
+        Status Compile()
+        {
+            _compiled = false;
+            _layers.clear();
+
+            for (auto &node : _nodes) {
+
+                node.expression = Expression<T>();
+                node.dependencies.clear();
+                node.dependents.clear();
+
+                for (auto &input : _inputs)
+                    node.expression.RegisterVariable(input.first, input.second);
+                for (auto &function : _functions)
+                    node.expression.RegisterFunction(function.first, function.second);
+                for (auto &other : _nodes) // Outputs of all expressions, self included so that self references are reported as cycles
+                    node.expression.RegisterVariable(other.name, other.output);
+
+                Status status = node.expression.Parse(node.source);
+                if (status != Success)
+                    return status;
+            }
+
+            for (std::size_t i = 0; i < _nodes.size(); i++) {
+                for (auto &variable : _nodes[i].expression.Variables()) {
+                    auto it = _index.find(variable);
+                    if (it != _index.end()) {
+                        _nodes[i].dependencies.push_back(it->second);
+                        _nodes[it->second].dependents.push_back(i);
+                    }
+                }
+            }
+
+            // Kahn's algorithm, one layer per round
+            std::vector<std::size_t> in_degree(_nodes.size());
+            std::vector<std::size_t> current;
+            for (std::size_t i = 0; i < _nodes.size(); i++) {
+                in_degree[i] = _nodes[i].dependencies.size();
+                if (in_degree[i] == 0)
+                    current.push_back(i);
+            }
+
+            std::size_t ordered = 0;
+            while (!current.empty()) {
+                std::vector<std::size_t> next;
+                for (std::size_t i : current)
+                    for (std::size_t j : _nodes[i].dependents)
+                        if (--in_degree[j] == 0)
+                            next.push_back(j);
+
+                ordered += current.size();
+                _layers.push_back(std::move(current));
+                current = std::move(next);
+            }
+
+            if (ordered != _nodes.size()) { // Remaining expressions depend on each other
+                _layers.clear();
+                return Error_Dependency_Cycle;
+            }
+
+            for (auto &node : _nodes)
+                node.dirty = true;
+
+            _compiled = true;
+            return Success;
+        }
+
+        // Marks the expressions depending on an input variable (or a named expression) for recomputation
+        void Invalidate(const std::string &name)
+        {
+            auto it = _index.find(name);
+            if (it != _index.end()) {
+                _nodes[it->second].dirty = true;
+                return;
+            }
+
+            for (auto &node : _nodes)
+                if (node.expression.Variables().count(name) != 0)
+                    node.dirty = true;
+        }
+
+        void InvalidateAll()
+        {
+            for (auto &node : _nodes)
+                node.dirty = true;
+        }
+
+        // Recomputes invalidated expressions and everything downstream of them
+        Status Eval()
+        {
+            if (!_compiled)
+                return Error_Not_Compiled;
+
+            std::vector<std::size_t> pending;
+            for (auto &layer : _layers) {
+
+                pending.clear();
+                for (std::size_t i : layer) {
+                    if (!_nodes[i].dirty)
+                        continue;
+
+                    pending.push_back(i);
+                    for (std::size_t j : _nodes[i].dependents)
+                        _nodes[j].dirty = true;
+                }
+
+                Status status = EvalLayer(pending);
+                if (status != Success)
+                    return status;
+            }
+
+            return Success;
+        }
+
+        // Number of threads used for evaluating a layer, by default 1 which evaluates on the calling thread.
+        // Threads are started for every layer of every Eval, which only pays off for expensive expressions.
+        // Registered functions are then called concurrently. The expressions are parsed without an InternStore,
+        // whose epoch-cached subtrees must not be evaluated concurrently, so a layer shares no state.
+        void SetThreadCount(unsigned count) { _thread_count = count == 0 ? 1 : count; }
+
+        std::shared_ptr<T> Output(const std::string &name) const
+        {
+            auto it = _index.find(name);
+            return it != _index.end() ? _nodes[it->second].output : nullptr;
+        }
+
+        // Expression names grouped by evaluation layer, each layer depends only on previous ones
+        std::vector<std::vector<std::string>> Layers() const
+        {
+            std::vector<std::vector<std::string>> layers;
+            for (auto &layer : _layers) {
+                layers.emplace_back();
+                for (std::size_t i : layer)
+                    layers.back().push_back(_nodes[i].name);
+            }
+            return layers;
+        }
+
+    private:
+        struct GraphNode {
+            std::string         name;
+            std::string         source;
+            Expression<T>       expression;
+            std::shared_ptr<T>  output;
+
+            std::vector<std::size_t> dependencies;
+            std::vector<std::size_t> dependents;
+
+            bool dirty = true;
+        };
+
+        Status EvalNode(std::size_t i)
+        {
+            Status status;
+            T value = _nodes[i].expression.Eval(status);
+            if (status == Success) {
+                *_nodes[i].output = value;
+                _nodes[i].dirty   = false;
+            }
+            return status;
+        }
+
+        Status EvalLayer(const std::vector<std::size_t> &pending)
+        {
+            std::size_t thread_count = std::min<std::size_t>(_thread_count, pending.size());
+
+            if (thread_count <= 1) {
+                for (std::size_t i : pending) {
+                    Status status = EvalNode(i);
+                    if (status != Success)
+                        return status;
+                }
+                return Success;
+            }
+
+            // Expressions of the same layer only read outputs of previous layers
+            std::atomic<std::size_t> next(0);
+            std::atomic<int>         error(Success);
+            auto worker = [&]() {
+                std::size_t k;
+                while ((k = next++) < pending.size()) {
+                    Status status = EvalNode(pending[k]);
+                    if (status != Success)
+                        error = status;
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (std::size_t t = 1; t < thread_count; t++)
+                threads.emplace_back(worker);
+            worker();
+            for (auto &thread : threads)
+                thread.join();
+
+            return static_cast<Status>(error.load());
+        }
+
+    private:
+        std::map<std::string, std::shared_ptr<T>>   _inputs;
+        std::map<std::string, std::function<T(T)>> _functions;
+
+        std::vector<GraphNode>             _nodes;
+        std::map<std::string, std::size_t> _index;
+
+        std::vector<std::vector<std::size_t>> _layers;
+
+        unsigned _thread_count = 1;
+        bool     _compiled     = false;
+    };
 }
 
-#endif // _exprparse_h_
\ No newline at end of file
+#endif // _exprparse_h_
@@ -0,0 +1,622 @@
+#ifndef _exprparse_codegen_h_
+#define _exprparse_codegen_h_
+
+#include "exprparse.hpp"
+
+#include <cstdio>       // std::snprintf, std::remove, std::rename
+#include <cstdlib>      // std::getenv, mkstemps
+#include <cstdint>      // std::uint64_t
+#include <cerrno>       // errno
+#include <iomanip>      // std::hexfloat
+#include <cctype>       // std::isalnum, std::isspace
+
+#include <dlfcn.h>      // dlopen, dlsym, dlclose
+#include <pwd.h>        // getpwuid
+#include <unistd.h>     // fork, execvp, write, close
+#include <sys/stat.h>   // lstat, mkdir
+#include <sys/wait.h>   // waitpid
+
+// Ahead-of-time backend: emits a self-contained C++ translation unit from parsed expressions,
+// compiles it with the local compiler into a shared object and loads it with dlopen.
+//
+// For every expression added under a symbol name the unit exports
+//
+//   T ep_<symbol>(const T *const *vars, ep_call_t call, void *ctx, int *status);
+//   void ep_<symbol>_batch(const T *const *columns, size_t rows, T *out, ep_call_t call, void *ctx, int *status);
+//
+// where vars / columns are indexed by the variable slots of the generator and registered
+// functions are called back through call(ctx, function_slot, argument).
+
+namespace exprparse {
+
+    namespace codegen {
+
+        template<typename T>
+        class Generator {
+        public:
+            // Adds an expression to the unit, exported under ep_<symbol>
+            Status Add(const std::string &symbol, const Expression<T> &expression)
+            {
+                if (!expression.AST())
+                    return Error_Not_Compiled;
+
+                for (auto &entry : _entries)
+                    if (entry.symbol == symbol)
+                        return Error_Function_Already_Registered;
+
+                for (char c : symbol)
+                    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+                        return Error_Syntax_Error;
+
+                Status status = Success;
+                std::vector<const T *> locals;
+                CollectSymbols(expression.AST(), locals, status);
+                if (status != Success)
+                    return status;
+
+                _entries.push_back({ symbol, expression.AST(), locals });
+                return Success;
+            }
+
+            std::string Source() const
+            {
+                std::stringstream ss;
+
+                ss << "// Generated by exprparse\n";
+                ss << "#include <stddef.h>\n\n";
+                ss << "typedef " << TypeName() << " ep_real;\n";
+                ss << "typedef ep_real (*ep_call_t)(void *ctx, int function, ep_real x);\n\n";
+
+                ss << "static inline ep_real ep_div(ep_real a, ep_real b, int *status)\n";
+                ss << "{\n";
+                ss << "    if (b == 0) { *status = " << static_cast<int>(Error_Division_By_Zero) << "; return 0; }\n";
+                ss << "    return a / b;\n";
+                ss << "}\n";
+
+                for (auto &entry : _entries) {
+
+                    ss << "\nextern \"C\" ep_real ep_" << entry.symbol
+                       << "(const ep_real *const *vars, ep_call_t call, void *ctx, int *status)\n";
+                    ss << "{\n";
+                    DeclareLocals(ss, entry, "    ");
+                    ss << "    return ";
+                    Emit(ss, entry.ast, entry.locals, "*vars[", "]");
+                    ss << ";\n";
+                    ss << "}\n";
+
+                    ss << "\nextern \"C\" void ep_" << entry.symbol
+                       << "_batch(const ep_real *const *columns, size_t rows, ep_real *out, ep_call_t call, void *ctx, int *status)\n";
+                    ss << "{\n";
+                    ss << "    for (size_t i = 0; i < rows; i++) {\n";
+                    DeclareLocals(ss, entry, "        ");
+                    ss << "        out[i] = ";
+                    Emit(ss, entry.ast, entry.locals, "columns[", "][i]");
+                    ss << ";\n";
+                    ss << "    }\n";
+                    ss << "}\n";
+                }
+
+                return ss.str();
+            }
+
+            // Variables in slot order, the order of the vars / columns arguments
+            const std::vector<std::string>        &Variables() const { return _variable_names; }
+            const std::vector<std::shared_ptr<T>> &Bindings()  const { return _variables; }
+
+            // Functions in slot order, the function argument of call
+            const std::vector<std::string>         &Functions()         const { return _function_names; }
+            const std::vector<std::function<T(T)>> &FunctionBindings()  const { return _functions; }
+
+        private:
+            struct Entry {
+                std::string                         symbol;
+                std::shared_ptr<_internal::Node<T>> ast;
+                std::vector<const T *>              locals; // Slots of let-bindings, declared as ep_l<index>
+            };
+
+            static const char *TypeName()
+            {
+                if (std::is_same<T, float>::value)  return "float";
+                if (std::is_same<T, double>::value) return "double";
+                return "long double";
+            }
+
+            static const char *ConstantSuffix()
+            {
+                if (std::is_same<T, float>::value)  return "f";
+                if (std::is_same<T, double>::value) return "";
+                return "L";
+            }
+
+            static std::size_t Slot(const std::vector<std::string> &names, const std::string &name)
+            {
+                return std::find(names.begin(), names.end(), name) - names.begin();
+            }
+
+            static void DeclareLocals(std::ostream &os, const Entry &entry, const char *indent)
+            {
+                for (std::size_t i = 0; i < entry.locals.size(); i++)
+                    os << indent << "ep_real ep_l" << i << ";\n";
+            }
+
+            static std::size_t Local(const std::vector<const T *> &locals, const T *slot)
+            {
+                return std::find(locals.begin(), locals.end(), slot) - locals.begin();
+            }
+
+            void CollectSymbols(const std::shared_ptr<_internal::Node<T>> &node, std::vector<const T *> &locals, Status &status)
+            {
+                using namespace _internal;
+
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                        CollectSymbols(op->Left(), locals, status);
+                        CollectSymbols(op->Right(), locals, status);
+                        break;
+                    }
+
+                    case NodeType::Variable: {
+                        auto var = std::static_pointer_cast<VariableNode<T>>(node);
+                        std::size_t slot = Slot(_variable_names, var->Name());
+                        if (slot == _variable_names.size()) {
+                            _variable_names.push_back(var->Name());
+                            _variables.push_back(var->Value());
+                        }
+                        else if (_variables[slot] != var->Value()) // Same name bound to another variable
+                            status = Error_Variable_Already_Registered;
+                        break;
+                    }
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                        if (Slot(_function_names, func->Name()) == _function_names.size()) {
+                            _function_names.push_back(func->Name());
+                            _functions.push_back(func->Function());
+                        }
+                        CollectSymbols(func->Argument(), locals, status);
+                        break;
+                    }
+
+                    case NodeType::Table: { // Called back like a registered function
+                        auto lookup = std::static_pointer_cast<TableNode<T>>(node);
+                        if (Slot(_function_names, lookup->Name()) == _function_names.size()) {
+                            auto table = lookup->GetTable();
+                            _function_names.push_back(lookup->Name());
+                            _functions.push_back([table](T x) { return table->Eval(x); });
+                        }
+                        CollectSymbols(lookup->Argument(), locals, status);
+                        break;
+                    }
+
+                    case NodeType::Cached:
+                        CollectSymbols(std::static_pointer_cast<CachedNode<T>>(node)->Inner(), locals, status);
+                        break;
+
+                    case NodeType::Element: // Arrays are not bound per row of the batch interface
+                    case NodeType::Reduction:
+                    case NodeType::Window:  // State is kept by the nodes of the expression
+                        status = Error_Unsupported;
+                        break;
+
+                    case NodeType::Let: {
+                        auto let = std::static_pointer_cast<LetNode<T>>(node);
+                        if (let->Output()) { // Variables are passed read-only
+                            status = Error_Unsupported;
+                            break;
+                        }
+
+                        locals.push_back(let->Slot().get());
+                        CollectSymbols(let->Value(), locals, status);
+                        CollectSymbols(let->Body(), locals, status);
+                        break;
+                    }
+
+                    case NodeType::Constant:
+                    case NodeType::Local:
+                        break;
+                }
+            }
+
+            void Emit(std::ostream &os, const std::shared_ptr<_internal::Node<T>> &node, const std::vector<const T *> &locals,
+                      const char *var_prefix, const char *var_suffix) const
+            {
+                using namespace _internal;
+
+                switch (node->Type()) {
+
+                    case NodeType::Operator: {
+                        auto op = std::static_pointer_cast<OperatorNode<T>>(node);
+                        if (op->Op() == OperatorNode<T>::Operator::Div && op->CheckDivisor()) {
+                            os << "ep_div(";
+                            Emit(os, op->Left(), locals, var_prefix, var_suffix);
+                            os << ", ";
+                            Emit(os, op->Right(), locals, var_prefix, var_suffix);
+                            os << ", status)";
+                            break;
+                        }
+
+                        os << "(";
+                        Emit(os, op->Left(), locals, var_prefix, var_suffix);
+                        switch (op->Op()) {
+                            case OperatorNode<T>::Operator::Add: os << " + "; break;
+                            case OperatorNode<T>::Operator::Sub: os << " - "; break;
+                            case OperatorNode<T>::Operator::Mul: os << " * "; break;
+                            default:                             os << " / "; break; // Divisor proven to be nonzero
+                        }
+                        Emit(os, op->Right(), locals, var_prefix, var_suffix);
+                        os << ")";
+                        break;
+                    }
+
+                    case NodeType::Variable: {
+                        auto var = std::static_pointer_cast<VariableNode<T>>(node);
+                        os << var_prefix << Slot(_variable_names, var->Name()) << var_suffix;
+                        break;
+                    }
+
+                    case NodeType::Constant: {
+                        auto constant = std::static_pointer_cast<ConstantNode<T>>(node);
+                        std::stringstream value; // Hexadecimal literal to reproduce the constant exactly
+                        value << std::hexfloat << constant->Value();
+                        os << "((ep_real)" << value.str() << ConstantSuffix() << ")";
+                        break;
+                    }
+
+                    case NodeType::Function: {
+                        auto func = std::static_pointer_cast<FunctionNode<T>>(node);
+                        os << "call(ctx, " << Slot(_function_names, func->Name()) << ", ";
+                        Emit(os, func->Argument(), locals, var_prefix, var_suffix);
+                        os << ")";
+                        break;
+                    }
+
+                    case NodeType::Table: {
+                        auto lookup = std::static_pointer_cast<TableNode<T>>(node);
+                        os << "call(ctx, " << Slot(_function_names, lookup->Name()) << ", ";
+                        Emit(os, lookup->Argument(), locals, var_prefix, var_suffix);
+                        os << ")";
+                        break;
+                    }
+
+                    case NodeType::Cached:
+                        Emit(os, std::static_pointer_cast<CachedNode<T>>(node)->Inner(), locals, var_prefix, var_suffix);
+                        break;
+
+                    case NodeType::Let: { // Comma expression, the value is assigned before the body is evaluated
+                        auto let = std::static_pointer_cast<LetNode<T>>(node);
+                        os << "(ep_l" << Local(locals, let->Slot().get()) << " = ";
+                        Emit(os, let->Value(), locals, var_prefix, var_suffix);
+                        os << ", ";
+                        Emit(os, let->Body(), locals, var_prefix, var_suffix);
+                        os << ")";
+                        break;
+                    }
+
+                    case NodeType::Local:
+                        os << "ep_l" << Local(locals, std::static_pointer_cast<LocalNode<T>>(node)->Slot().get());
+                        break;
+
+                    default: // Rejected by CollectSymbols
+                        break;
+                }
+            }
+
+        private:
+            std::vector<Entry> _entries;
+
+            std::vector<std::string>         _variable_names;
+            std::vector<std::shared_ptr<T>>  _variables;
+            std::vector<std::string>         _function_names;
+            std::vector<std::function<T(T)>> _functions;
+        };
+
+
+
+        struct Options {
+            std::string compiler  = "";     // Defaults to $CXX, then c++
+            std::string flags     = "-O2";  // Split at spaces into arguments, no shell quoting
+            std::string cache_dir = "";     // Defaults to $XDG_CACHE_HOME/exprparse, then ~/.cache/exprparse
+        };
+
+
+
+        template<typename T>
+        class Library;
+
+
+
+        // Expression evaluated by a loaded shared object, same interface as Expression<T>
+        template<typename T>
+        class NativeExpression {
+        public:
+            typedef T (*EvalFunction)(const T *const *, T (*)(void *, int, T), void *, int *);
+            typedef void (*BatchFunction)(const T *const *, std::size_t, T *, T (*)(void *, int, T), void *, int *);
+
+            T Eval(Status &status) const
+            {
+                if (!_eval) {
+                    status = Error_Not_Compiled;
+                    return T(0);
+                }
+
+                int result = Success;
+                T value = _eval(_vars.data(), &Call, _functions.get(), &result);
+                status = static_cast<Status>(result);
+                return value;
+            }
+
+            // Evaluates rows of column-major input, columns in the generator's variable slot order
+            void EvalBatch(const T *const *columns, std::size_t rows, T *out, Status &status) const
+            {
+                if (!_batch) {
+                    status = Error_Not_Compiled;
+                    return;
+                }
+
+                int result = Success;
+                _batch(columns, rows, out, &Call, _functions.get(), &result);
+                status = static_cast<Status>(result);
+            }
+
+        private:
+            friend class Library<T>;
+
+            static T Call(void *ctx, int function, T x)
+            {
+                return (*static_cast<const std::vector<std::function<T(T)>> *>(ctx))[function](x);
+            }
+
+        private:
+            std::shared_ptr<void> _handle;
+
+            EvalFunction  _eval  = nullptr;
+            BatchFunction _batch = nullptr;
+
+            std::vector<std::shared_ptr<T>>                   _bindings;
+            std::vector<const T *>                            _vars;
+            std::shared_ptr<std::vector<std::function<T(T)>>> _functions;
+        };
+
+
+
+        // Compiled and loaded translation unit of a generator
+        template<typename T>
+        class Library {
+        public:
+            // Compiles the generator's source, reusing a cached shared object with the same hash. The object
+            // embeds the source, compiler and flags it was built from, a cached one built from anything else
+            // (a hash collision or a stale file) is compiled again. Fails with Error_Load_Failed if the cache
+            // directory or a cached object could have been written by another user.
+            Status Load(const Generator<T> &generator, const Options &options = Options())
+            {
+                std::string compiler = options.compiler;
+                if (compiler.empty())
+                    compiler = std::getenv("CXX") ? std::getenv("CXX") : "c++";
+
+                std::string cache_dir = options.cache_dir;
+                if (cache_dir.empty()) {
+                    cache_dir = DefaultCacheDir();
+                    if (cache_dir.empty())
+                        return Error_Load_Failed;
+                }
+
+                // Only the user may write there, anything loaded from it is as trusted as the program
+                if (mkdir(cache_dir.c_str(), 0700) != 0 && errno != EEXIST)
+                    return Error_Load_Failed;
+                if (!Private(cache_dir, true))
+                    return Error_Load_Failed;
+
+                // The key covers everything that affects the shared object, and is compiled into it
+                std::string key    = generator.Source() + '\n' + compiler + '\n' + options.flags;
+                std::string source = generator.Source() + KeyDefinition(key);
+
+                char hash[17];
+                std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(Hash(key)));
+
+                std::string base   = cache_dir + "/ep_" + hash;
+                std::string object = base + ".so";
+
+                struct stat info;
+                bool cached = lstat(object.c_str(), &info) == 0;
+
+                void *handle = nullptr;
+                for (;;) {
+                    if (!cached) {
+                        Status status = Compile(compiler, options.flags, source, base, object);
+                        if (status != Success)
+                            return status;
+                    }
+
+                    if (!Private(object, false))
+                        return Error_Load_Failed;
+
+                    handle = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+                    if (handle) {
+                        auto embedded = static_cast<const char *>(dlsym(handle, "ep_cache_key"));
+                        if (embedded && key == embedded)
+                            break;
+                        dlclose(handle);
+                    }
+
+                    if (!cached) // Just compiled, and still not the expected object
+                        return Error_Load_Failed;
+                    cached = false;
+                }
+
+                _handle    = std::shared_ptr<void>(handle, [](void *h) { dlclose(h); });
+                _generator = generator;
+                _path      = object;
+                return Success;
+            }
+
+            // Binds an exported expression to the variables and functions it was generated from
+            Status Get(const std::string &symbol, NativeExpression<T> &expression) const
+            {
+                if (!_handle)
+                    return Error_Not_Compiled;
+
+                auto eval  = dlsym(_handle.get(), ("ep_" + symbol).c_str());
+                auto batch = dlsym(_handle.get(), ("ep_" + symbol + "_batch").c_str());
+                if (!eval || !batch)
+                    return Error_Unregistered_Symbol;
+
+                expression._handle    = _handle;
+                expression._eval      = reinterpret_cast<typename NativeExpression<T>::EvalFunction>(eval);
+                expression._batch     = reinterpret_cast<typename NativeExpression<T>::BatchFunction>(batch);
+                expression._bindings  = _generator.Bindings();
+                expression._functions = std::make_shared<std::vector<std::function<T(T)>>>(_generator.FunctionBindings());
+
+                expression._vars.clear();
+                for (auto &binding : expression._bindings)
+                    expression._vars.push_back(binding.get());
+
+                return Success;
+            }
+
+            // Path of the loaded shared object in the cache
+            const std::string &Path() const { return _path; }
+
+        private:
+            // Definition of ep_cache_key, the key as a string literal with octal escapes for anything but
+            // printable characters, and for backslashes, quotes and question marks
+            static std::string KeyDefinition(const std::string &key)
+            {
+                std::string definition = "\nextern \"C\" const char ep_cache_key[] =\n    \"";
+                for (unsigned char c : key) {
+                    if (c >= ' ' && c <= '~' && c != '\\' && c != '"' && c != '?') {
+                        definition += static_cast<char>(c);
+                    }
+                    else {
+                        char escape[5];
+                        std::snprintf(escape, sizeof(escape), "\\%03o", c);
+                        definition += escape;
+                        if (c == '\n')
+                            definition += "\"\n    \"";
+                    }
+                }
+                return definition + "\";\n";
+            }
+
+            static std::string DefaultCacheDir()
+            {
+                if (const char *xdg = std::getenv("XDG_CACHE_HOME"))
+                    if (*xdg == '/')
+                        return std::string(xdg) + "/exprparse";
+
+                const char *home = std::getenv("HOME");
+                if (!home || *home != '/') {
+                    const passwd *user = getpwuid(geteuid());
+                    home = user ? user->pw_dir : nullptr;
+                }
+                if (!home || *home != '/')
+                    return std::string();
+
+                std::string cache = std::string(home) + "/.cache";
+                mkdir(cache.c_str(), 0700);
+                return cache + "/exprparse";
+            }
+
+            // True if path is a directory or regular file, not a symbolic link, owned by the effective user
+            // and not writable by group or others
+            static bool Private(const std::string &path, bool directory)
+            {
+                struct stat info;
+                if (lstat(path.c_str(), &info) != 0)
+                    return false;
+                if (directory ? !S_ISDIR(info.st_mode) : !S_ISREG(info.st_mode))
+                    return false;
+                return info.st_uid == geteuid() && !(info.st_mode & (S_IWGRP | S_IWOTH));
+            }
+
+            // Writes the source to a unique file and compiles it without a shell, renaming the result to
+            // object so concurrent builders never load a partial object
+            static Status Compile(const std::string &compiler, const std::string &flags, const std::string &source,
+                const std::string &base, const std::string &object)
+            {
+                std::string source_file = base + ".XXXXXX.cpp";
+                int fd = mkstemps(&source_file[0], 4); // Created 0600 with O_EXCL
+                if (fd < 0)
+                    return Error_Compilation_Failed;
+
+                bool written = true;
+                for (std::size_t offset = 0; written && offset < source.size();) {
+                    ssize_t count = write(fd, source.data() + offset, source.size() - offset);
+                    if (count < 0 && errno == EINTR)
+                        continue;
+                    written = count > 0;
+                    offset += written ? static_cast<std::size_t>(count) : 0;
+                }
+                written = close(fd) == 0 && written;
+
+                std::string temporary = source_file.substr(0, source_file.size() - 4) + ".so";
+
+                std::vector<std::string> arguments = { compiler };
+                for (std::size_t begin = 0; begin < flags.size();) {
+                    while (begin < flags.size() && std::isspace(static_cast<unsigned char>(flags[begin])))
+                        begin++;
+                    std::size_t end = begin;
+                    while (end < flags.size() && !std::isspace(static_cast<unsigned char>(flags[end])))
+                        end++;
+                    if (end > begin)
+                        arguments.push_back(flags.substr(begin, end - begin));
+                    begin = end;
+                }
+                for (const char *argument : { "-shared", "-fPIC", "-o" })
+                    arguments.push_back(argument);
+                arguments.push_back(temporary);
+                arguments.push_back(source_file);
+
+                bool compiled = written && Run(arguments) && std::rename(temporary.c_str(), object.c_str()) == 0;
+
+                std::remove(source_file.c_str());
+                if (!compiled) {
+                    std::remove(temporary.c_str());
+                    return Error_Compilation_Failed;
+                }
+                return Success;
+            }
+
+            // Runs a program with arguments, true if it exited with status 0
+            static bool Run(const std::vector<std::string> &arguments)
+            {
+                std::vector<char *> argv;
+                for (auto &argument : arguments)
+                    argv.push_back(const_cast<char *>(argument.c_str()));
+                argv.push_back(nullptr);
+
+                pid_t pid = fork();
+                if (pid < 0)
+                    return false;
+                if (pid == 0) {
+                    execvp(argv[0], argv.data());
+                    _exit(127);
+                }
+
+                int status;
+                while (waitpid(pid, &status, 0) < 0)
+                    if (errno != EINTR)
+                        return false;
+                return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            }
+
+            static std::uint64_t Hash(const std::string &data) // FNV-1a, stable across runs
+            {
+                std::uint64_t hash = 14695981039346656037ull;
+                for (unsigned char c : data) {
+                    hash ^= c;
+                    hash *= 1099511628211ull;
+                }
+                return hash;
+            }
+
+        private:
+            std::shared_ptr<void> _handle;
+            Generator<T>          _generator;
+            std::string           _path;
+        };
+    }
+}
+
+#endif // _exprparse_codegen_h_
@@ -0,0 +1,789 @@
+#ifndef _exprparse_shm_h_
+#define _exprparse_shm_h_
+
+#include "exprparse.hpp"
+
+#include <atomic>       // std::atomic
+#include <cstddef>      // offsetof
+#include <cstdint>      // std::uint32_t, std::uint64_t
+#include <cstring>      // std::memcpy
+#include <new>          // placement new
+
+#include <fcntl.h>      // O_CREAT, O_RDWR, O_RDONLY
+#include <sys/mman.h>   // shm_open, shm_unlink, mmap, munmap
+#include <sys/stat.h>   // fstat, mode_t
+#include <unistd.h>     // ftruncate, close
+
+// Read-only store of compact expressions in POSIX shared memory, written by one loader process and
+// evaluated by worker processes directly from the mapped pages, without parsing or holding trees.
+//
+// A store /name is a small control object holding the published generation, and every generation is
+// a separate object /name.<generation> with the bytecode and constants of all expressions. The image
+// is position independent: symbols are indices into a table of names, bound by every worker to its
+// own variables, functions, tables, arrays and outputs. Publishing writes the next generation
+// completely, switches the counter with a release store and unlinks the previous generation, which
+// stays valid in the workers that still map it until they Refresh.
+//
+//     exprparse::shm::Publisher<double> publisher;            // Loader
+//     publisher.Add("margin", e);
+//     publisher.Publish("/pricing");
+//
+//     exprparse::shm::Store<double> store;                    // Workers, e has the same registrations
+//     store.Open("/pricing", e);
+//     store.Find("margin", index);
+//     store.Eval(index, status);
+
+namespace exprparse {
+
+    namespace _internal {
+
+        namespace shm {
+
+            // The version of the image in the low byte, the bytecode ABI and the number of opcodes above it, so
+            // that workers refuse images of a loader built with a different instruction set
+            const std::uint32_t magic   = 0x48535045; // "EPSH"
+            const std::uint32_t version = 3 | compact::abi << 8 | std::uint32_t(compact::UncheckedReverseDiv + 1) << 16;
+
+            enum SymbolKind { Variables, Functions, Tables, Arrays, Outputs, SymbolKinds };
+
+            struct Control {
+                std::uint32_t              magic;
+                std::uint32_t              version;
+                std::atomic<std::uint64_t> generation; // 0 until the first publication
+            };
+
+            static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "The generation counter is shared between processes");
+
+            // Offsets are from the start of the image
+            struct Header {
+                std::uint32_t magic;
+                std::uint32_t version;
+                std::uint32_t value_size;
+                std::uint32_t entry_count;
+                std::uint64_t generation;
+                std::uint64_t size;
+                std::uint32_t symbol_count[SymbolKinds];
+                std::uint32_t symbols; // Symbol records of all kinds in SymbolKind order
+                std::uint32_t entries; // Entry records sorted by name
+            };
+
+            struct Symbol {
+                std::uint32_t name;
+                std::uint32_t name_size;
+                std::uint64_t array_size; // Element count the bytecode was compiled for, arrays only
+            };
+
+            struct Entry {
+                std::uint32_t name;
+                std::uint32_t name_size;
+                std::uint32_t code;
+                std::uint32_t code_size;
+                std::uint32_t constants;
+                std::uint32_t constant_count;
+            };
+
+            // Calls visit(kind, operand) for every u16 symbol index of compact bytecode, following the
+            // operands listed in compact::Opcode
+            template<typename Visit>
+            void VisitSymbols(std::uint8_t *code, std::size_t size, Visit visit)
+            {
+                using namespace compact;
+
+                std::size_t pc = 0;
+                while (pc < size) {
+                    std::uint8_t *operands = code + pc + 1;
+
+                    switch (code[pc]) {
+                        case PushVariable: visit(Variables, operands); pc += 3; break;
+                        case Call:         visit(Functions, operands); pc += 3; break;
+                        case LookupTable:  visit(Tables, operands); pc += 3; break;
+                        case PushElement:  visit(Arrays, operands); pc += 7; break;
+                        case StoreOutput:  visit(Outputs, operands); pc += 4; break;
+
+                        case IndexElement:
+                        case UncheckedIndexElement:
+                            visit(Arrays, operands);
+                            pc += 3;
+                            break;
+
+                        case Reduce:
+                        case ReduceSlice:
+                            visit(Arrays, operands + 1);
+                            visit(Arrays, operands + 3);
+                            pc += code[pc] == Reduce ? 6 : 18;
+                            break;
+
+                        case PushConstant:
+                        case PushImmediate:
+                        case StoreLocal:
+                        case PushLocal:
+                            pc += 2;
+                            break;
+
+                        default: // Operators
+                            pc += 1;
+                            break;
+                    }
+                }
+            }
+
+            // Replaces the unchecked operations of compact bytecode by their checked forms. They were proven
+            // safe with the ranges declared in the loader, which the variables bound by workers need not keep to.
+            inline void CheckOperations(std::uint8_t *code, std::size_t size)
+            {
+                using namespace compact;
+
+                std::size_t pc = 0;
+                while (pc < size) {
+                    switch (code[pc]) {
+                        case UncheckedIndexElement: code[pc] = IndexElement; pc += 3; break;
+                        case UncheckedDiv:          code[pc] = Div; pc += 1; break;
+                        case UncheckedReverseDiv:   code[pc] = ReverseDiv; pc += 1; break;
+
+                        case PushVariable: case Call: case LookupTable: case IndexElement: pc += 3; break;
+                        case PushConstant: case PushImmediate: case StoreLocal: case PushLocal: pc += 2; break;
+                        case PushElement: pc += 7; break;
+                        case StoreOutput: pc += 4; break;
+                        case Reduce:      pc += 6; break;
+                        case ReduceSlice: pc += 18; break;
+
+                        default: // Operators
+                            pc += 1;
+                            break;
+                    }
+                }
+            }
+
+            // Checks bytecode read from an image before it is run: whole instructions of known opcodes, symbol,
+            // constant and local indices in range, constant elements and slices within the arrays the code was
+            // compiled for, and a stack that never underflows, stays within compact::max_stack and ends with
+            // the result. Unchecked operations are refused, as their proofs hold only for the loader's ranges.
+            inline bool Verify(const std::uint8_t *code, std::size_t size, std::uint64_t constant_count,
+                               const std::uint32_t (&symbol_count)[SymbolKinds], const std::vector<std::uint64_t> &array_sizes)
+            {
+                using namespace compact;
+
+                auto u16 = [](const std::uint8_t *p) { std::uint16_t v; std::memcpy(&v, p, sizeof(v)); return v; };
+                auto u32 = [](const std::uint8_t *p) { std::uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; };
+
+                std::size_t depth = 0;
+                std::size_t pc    = 0;
+                while (pc < size) {
+                    std::uint8_t        opcode   = code[pc];
+                    const std::uint8_t *operands = code + pc + 1;
+                    std::size_t         bytes    = 1, pops = 0, pushes = 0;
+
+                    switch (opcode) {
+                        case UncheckedIndexElement: case UncheckedDiv: case UncheckedReverseDiv: return false;
+                        case PushVariable: case Call: case LookupTable: case IndexElement: bytes = 3; break;
+                        case PushConstant: case PushImmediate: case StoreLocal: case PushLocal: bytes = 2; break;
+                        case PushElement: bytes = 7; break;
+                        case StoreOutput: bytes = 4; break;
+                        case Reduce:      bytes = 6; break;
+                        case ReduceSlice: bytes = 18; break;
+                        default:
+                            if (opcode > UncheckedReverseDiv)
+                                return false;
+                            break;
+                    }
+                    if (bytes > size - pc)
+                        return false;
+
+                    switch (opcode) {
+                        case PushVariable:
+                            pushes = 1;
+                            if (u16(operands) >= symbol_count[Variables])
+                                return false;
+                            break;
+
+                        case Call:
+                        case LookupTable:
+                            pops = pushes = 1;
+                            if (u16(operands) >= symbol_count[opcode == Call ? Functions : Tables])
+                                return false;
+                            break;
+
+                        case IndexElement:
+                            pops = pushes = 1;
+                            if (u16(operands) >= symbol_count[Arrays])
+                                return false;
+                            break;
+
+                        case PushElement:
+                            pushes = 1;
+                            if (u16(operands) >= symbol_count[Arrays] || u32(operands + 2) >= array_sizes[u16(operands)])
+                                return false;
+                            break;
+
+                        case Reduce:
+                        case ReduceSlice: {
+                            pushes = 1;
+                            std::uint16_t array = u16(operands + 1), other = u16(operands + 3);
+                            if (operands[0] > static_cast<std::uint8_t>(ReductionNode<double>::Kind::Max)
+                                || array >= symbol_count[Arrays] || other >= symbol_count[Arrays])
+                                return false;
+                            if (opcode == ReduceSlice) {
+                                std::uint64_t length = u32(operands + 13);
+                                if (u32(operands + 5) + length > array_sizes[array] || u32(operands + 9) + length > array_sizes[other])
+                                    return false;
+                            }
+                            break;
+                        }
+
+                        case PushConstant:
+                            pushes = 1;
+                            if (operands[0] >= constant_count)
+                                return false;
+                            break;
+
+                        case PushImmediate:
+                            pushes = 1;
+                            break;
+
+                        case PushLocal:
+                            pushes = 1;
+                            if (operands[0] >= max_locals)
+                                return false;
+                            break;
+
+                        case StoreLocal:
+                            pops = 1;
+                            if (operands[0] >= max_locals)
+                                return false;
+                            break;
+
+                        case StoreOutput:
+                            pops = 1;
+                            if (u16(operands) >= symbol_count[Outputs] || operands[2] >= max_locals)
+                                return false;
+                            break;
+
+                        default: // Operators
+                            pops   = 2;
+                            pushes = 1;
+                            break;
+                    }
+
+                    if (depth < pops)
+                        return false;
+                    depth = depth - pops + pushes;
+                    if (depth > max_stack)
+                        return false;
+
+                    pc += bytes;
+                }
+
+                return depth == 1;
+            }
+
+            inline std::shared_ptr<std::uint8_t> Map(const std::string &name, int flags, std::size_t &size)
+            {
+                int fd = shm_open(name.c_str(), flags, 0);
+                if (fd < 0)
+                    return nullptr;
+
+                struct stat info;
+                void *data = MAP_FAILED;
+                if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                    size = static_cast<std::size_t>(info.st_size);
+                    data = mmap(nullptr, size, flags == O_RDONLY ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                }
+                close(fd);
+
+                if (data == MAP_FAILED)
+                    return nullptr;
+
+                std::size_t length = size;
+                return std::shared_ptr<std::uint8_t>(static_cast<std::uint8_t *>(data), [length](std::uint8_t *p) { munmap(p, length); });
+            }
+        }
+    }
+
+    namespace shm {
+
+        // Removes a store and its published generation, workers mapping it keep evaluating it
+        inline Status Remove(const std::string &name)
+        {
+            std::size_t size = 0;
+            auto control = _internal::shm::Map(name, O_RDONLY, size);
+            if (!control || size < sizeof(_internal::shm::Control))
+                return Error_Load_Failed;
+
+            std::uint64_t generation = reinterpret_cast<const _internal::shm::Control *>(control.get())->generation.load();
+            if (generation)
+                shm_unlink((name + "." + std::to_string(generation)).c_str());
+
+            return shm_unlink(name.c_str()) == 0 ? Success : Error_Load_Failed;
+        }
+
+
+
+        // Collects compact expressions by name and publishes them as the next generation of a store.
+        // Symbols are renumbered over all added expressions, so workers bind each name once. Divisions and
+        // computed indices are published checked, whatever the ranges of the loader's variables.
+        template<typename T>
+        class Publisher {
+        public:
+            Status Add(const std::string &name, const Expression<T> &expression)
+            {
+                using namespace _internal::shm;
+
+                if (_entries.count(name))
+                    return Error_Function_Already_Registered;
+
+                CompactExpression<T> compact;
+                Status status = compact.Compile(expression);
+                if (status != Success)
+                    return status;
+
+                // Names of the symbols by the indices of the expression's symbol table
+                const _internal::SymbolTable<T> &symbols = *compact._symbols;
+                const std::map<std::string, std::uint16_t> *indices[SymbolKinds] = {
+                    &symbols.variable_index, &symbols.function_index, &symbols.table_index, &symbols.array_index, &symbols.output_index
+                };
+                std::vector<const std::string *> names[SymbolKinds];
+                for (int kind = 0; kind < SymbolKinds; kind++) {
+                    names[kind].resize(indices[kind]->size());
+                    for (auto &index : *indices[kind])
+                        names[kind][index.second] = &index.first;
+                }
+
+                auto header = compact.GetHeader();
+
+                Compiled entry;
+                entry.code.assign(compact.Code(), compact.Code() + header.code_size);
+                entry.constants.assign(compact.Constants(), compact.Constants() + header.constant_count);
+                CheckOperations(entry.code.data(), entry.code.size());
+
+                // Checks the new symbols before renumbering, so a failed Add leaves the publisher unchanged
+                std::set<std::string> added[SymbolKinds];
+                status = Success;
+                VisitSymbols(entry.code.data(), entry.code.size(), [&](SymbolKind kind, std::uint8_t *operand) {
+                    std::uint16_t index;
+                    std::memcpy(&index, operand, sizeof(index));
+
+                    const std::string &symbol = *names[kind][index];
+                    auto it = _index[kind].find(symbol);
+                    if (it == _index[kind].end())
+                        added[kind].insert(symbol);
+                    else if (kind == Arrays && _array_sizes[it->second] != symbols.arrays[index]->size())
+                        status = Error_Index_Out_Of_Bounds;
+                });
+                if (status != Success)
+                    return status;
+
+                for (int kind = 0; kind < SymbolKinds; kind++)
+                    if (_names[kind].size() + added[kind].size() > 0xFFFF)
+                        return Error_Limit_Exceeded;
+
+                VisitSymbols(entry.code.data(), entry.code.size(), [&](SymbolKind kind, std::uint8_t *operand) {
+                    std::uint16_t index;
+                    std::memcpy(&index, operand, sizeof(index));
+
+                    const std::string &symbol = *names[kind][index];
+                    auto it = _index[kind].find(symbol);
+                    if (it == _index[kind].end()) {
+                        it = _index[kind].emplace(symbol, static_cast<std::uint16_t>(_names[kind].size())).first;
+                        _names[kind].push_back(symbol);
+                        if (kind == Arrays)
+                            _array_sizes.push_back(symbols.arrays[index]->size());
+                    }
+                    std::memcpy(operand, &it->second, sizeof(it->second));
+                });
+
+                _entries.emplace(name, std::move(entry));
+                return Success;
+            }
+
+            // Writes the expressions as the next generation of the store, creating it readable for mode.
+            // Only one process may publish to a store at a time.
+            Status Publish(const std::string &name, mode_t mode = 0600)
+            {
+                using namespace _internal::shm;
+
+                std::vector<std::uint8_t> image;
+                if (!Image(image))
+                    return Error_Limit_Exceeded;
+
+                // Control object, zero filled by ftruncate when created
+                int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, mode);
+                if (fd < 0)
+                    return Error_Load_Failed;
+
+                struct stat info;
+                bool created = fstat(fd, &info) == 0 && info.st_size == 0;
+                if (created && ftruncate(fd, sizeof(Control)) != 0) {
+                    close(fd);
+                    return Error_Load_Failed;
+                }
+                close(fd);
+
+                std::size_t control_size = 0;
+                auto mapping = Map(name, O_RDWR, control_size);
+                if (!mapping || control_size < sizeof(Control))
+                    return Error_Load_Failed;
+
+                Control *control = reinterpret_cast<Control *>(mapping.get());
+                if (created) {
+                    new (&control->generation) std::atomic<std::uint64_t>(0);
+                    control->version = version;
+                    control->magic   = magic;
+                }
+                if (control->magic != magic || control->version != version)
+                    return Error_Load_Failed;
+
+                std::uint64_t generation = control->generation.load() + 1;
+                std::memcpy(image.data() + offsetof(Header, generation), &generation, sizeof(generation));
+
+                // A generation left over by a failed publication is replaced
+                std::string segment = name + "." + std::to_string(generation);
+                shm_unlink(segment.c_str());
+
+                fd = shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, mode);
+                if (fd < 0)
+                    return Error_Load_Failed;
+
+                bool written = ftruncate(fd, static_cast<off_t>(image.size())) == 0;
+                close(fd);
+
+                std::size_t size = 0;
+                auto data = written ? Map(segment, O_RDWR, size) : nullptr;
+                if (!data || size != image.size()) {
+                    shm_unlink(segment.c_str());
+                    return Error_Load_Failed;
+                }
+                std::memcpy(data.get(), image.data(), image.size());
+                data.reset();
+
+                control->generation.store(generation, std::memory_order_release);
+                if (generation > 1)
+                    shm_unlink((name + "." + std::to_string(generation - 1)).c_str());
+
+                _generation = generation;
+                _size       = image.size();
+                return Success;
+            }
+
+            // Generation and bytes of the last publication
+            std::uint64_t Generation() const { return _generation; }
+            std::size_t   PublishedBytes() const { return _size; }
+
+        private:
+            struct Compiled {
+                std::vector<std::uint8_t> code;
+                std::vector<T>            constants;
+            };
+
+            static std::uint32_t Append(std::vector<std::uint8_t> &image, const void *data, std::size_t size, std::size_t align = 1)
+            {
+                image.resize((image.size() + align - 1) / align * align);
+                std::size_t offset = image.size();
+                image.insert(image.end(), static_cast<const std::uint8_t *>(data), static_cast<const std::uint8_t *>(data) + size);
+                return static_cast<std::uint32_t>(offset);
+            }
+
+            // Serializes the image with generation 0, false if it exceeds 32-bit offsets
+            bool Image(std::vector<std::uint8_t> &image) const
+            {
+                using namespace _internal::shm;
+
+                Header header = {};
+                header.magic       = magic;
+                header.version     = version;
+                header.value_size  = sizeof(T);
+                header.entry_count = static_cast<std::uint32_t>(_entries.size());
+
+                std::size_t symbol_count = 0;
+                for (int kind = 0; kind < SymbolKinds; kind++) {
+                    header.symbol_count[kind] = static_cast<std::uint32_t>(_names[kind].size());
+                    symbol_count += _names[kind].size();
+                }
+
+                std::size_t bytes = 0;
+                for (auto &entry : _entries)
+                    bytes += entry.first.size() + entry.second.code.size() + entry.second.constants.size() * sizeof(T) + alignof(T);
+                for (int kind = 0; kind < SymbolKinds; kind++)
+                    for (auto &symbol : _names[kind])
+                        bytes += symbol.size();
+                bytes += sizeof(Header) + symbol_count * sizeof(Symbol) + _entries.size() * sizeof(Entry) + 16;
+                if (bytes > 0xFFFFFFFFu)
+                    return false;
+
+                image.clear();
+                image.reserve(bytes);
+                image.resize(sizeof(Header));
+                image.resize((image.size() + 7) / 8 * 8);
+
+                header.symbols = static_cast<std::uint32_t>(image.size());
+                image.resize(image.size() + symbol_count * sizeof(Symbol));
+                header.entries = static_cast<std::uint32_t>(image.size());
+                image.resize(image.size() + _entries.size() * sizeof(Entry));
+
+                std::size_t i = 0;
+                for (int kind = 0; kind < SymbolKinds; kind++) {
+                    for (std::size_t k = 0; k < _names[kind].size(); k++, i++) {
+                        Symbol symbol = {};
+                        symbol.name       = Append(image, _names[kind][k].data(), _names[kind][k].size());
+                        symbol.name_size  = static_cast<std::uint32_t>(_names[kind][k].size());
+                        symbol.array_size = kind == Arrays ? _array_sizes[k] : 0;
+                        std::memcpy(image.data() + header.symbols + i * sizeof(Symbol), &symbol, sizeof(symbol));
+                    }
+                }
+
+                i = 0;
+                for (auto &compiled : _entries) { // Sorted by name
+                    Entry entry = {};
+                    entry.name           = Append(image, compiled.first.data(), compiled.first.size());
+                    entry.name_size      = static_cast<std::uint32_t>(compiled.first.size());
+                    entry.constants      = Append(image, compiled.second.constants.data(), compiled.second.constants.size() * sizeof(T), alignof(T));
+                    entry.constant_count = static_cast<std::uint32_t>(compiled.second.constants.size());
+                    entry.code           = Append(image, compiled.second.code.data(), compiled.second.code.size());
+                    entry.code_size      = static_cast<std::uint32_t>(compiled.second.code.size());
+                    std::memcpy(image.data() + header.entries + i++ * sizeof(Entry), &entry, sizeof(entry));
+                }
+
+                header.size = image.size();
+                std::memcpy(image.data(), &header, sizeof(header));
+                return true;
+            }
+
+        private:
+            std::map<std::string, Compiled> _entries;
+
+            std::vector<std::string>             _names[_internal::shm::SymbolKinds];
+            std::map<std::string, std::uint16_t> _index[_internal::shm::SymbolKinds];
+            std::vector<std::uint64_t>           _array_sizes; // By index of the arrays
+
+            std::uint64_t _generation = 0;
+            std::size_t   _size       = 0;
+        };
+
+
+
+        // Maps the published generation of a store and evaluates its expressions from the shared pages,
+        // with symbols bound by name to those registered in an expression of the worker. Copies share
+        // the mapping; evaluation is as thread-safe as that of compact expressions.
+        template<typename T>
+        class Store {
+        public:
+            Status Open(const std::string &name, const Expression<T> &symbols)
+            {
+                using namespace _internal::shm;
+
+                *this = Store();
+
+                std::size_t size = 0;
+                auto control = Map(name, O_RDONLY, size);
+                if (!control || size < sizeof(Control))
+                    return Error_Load_Failed;
+
+                auto header = reinterpret_cast<const Control *>(control.get());
+                if (header->magic != magic || header->version != version)
+                    return Error_Load_Failed;
+
+                _name     = name;
+                _control  = control;
+                _bindings = symbols.Symbols();
+                return Refresh();
+            }
+
+            // True once a newer generation than the mapped one has been published
+            bool Stale() const
+            {
+                return _control && GetControl().generation.load(std::memory_order_acquire) != _generation;
+            }
+
+            // Maps and binds the published generation if it is newer, keeping the current one if that fails.
+            // Indices of expressions may change.
+            Status Refresh()
+            {
+                if (!_control)
+                    return Error_Not_Compiled;
+
+                for (int attempt = 0; attempt < 8; attempt++) {
+                    std::uint64_t generation = GetControl().generation.load(std::memory_order_acquire);
+                    if (generation == 0) // Nothing published yet
+                        return Error_Load_Failed;
+                    if (generation == _generation)
+                        return Success;
+
+                    std::size_t size = 0;
+                    auto image = _internal::shm::Map(_name + "." + std::to_string(generation), O_RDONLY, size);
+                    if (image)
+                        return Bind(image, size, generation);
+                    // Otherwise unlinked by a newer publication in between
+                }
+                return Error_Load_Failed;
+            }
+
+            // Index of an expression for Eval, valid until the next Refresh
+            Status Find(const std::string &name, std::size_t &index) const
+            {
+                std::size_t first = 0, last = Size();
+                while (first < last) {
+                    std::size_t middle = first + (last - first) / 2;
+                    if (Name(middle) < name)
+                        first = middle + 1;
+                    else
+                        last = middle;
+                }
+
+                if (first == Size() || Name(first) != name)
+                    return Error_Unregistered_Symbol;
+
+                index = first;
+                return Success;
+            }
+
+            T Eval(std::size_t index, Status &status) const
+            {
+                if (index >= Size()) {
+                    status = Error_Not_Compiled;
+                    return T(0);
+                }
+
+                _internal::shm::Entry entry = GetEntry(index);
+                const std::uint8_t *base = _image.get();
+
+                status = Success;
+                return _internal::compact::Run(base + entry.code, entry.code_size, reinterpret_cast<const T *>(base + entry.constants),
+                                               _variables.data(), _functions.data(), _tables.data(), _arrays.data(), _outputs.data(), status);
+            }
+
+            std::size_t Size() const { return _image ? GetHeader().entry_count : 0; }
+
+            std::string Name(std::size_t index) const
+            {
+                _internal::shm::Entry entry = GetEntry(index);
+                return std::string(reinterpret_cast<const char *>(_image.get()) + entry.name, entry.name_size);
+            }
+
+            // Mapped generation, 0 before Open
+            std::uint64_t Generation() const { return _generation; }
+
+            // Bytes of the mapped generation, shared with the other processes
+            std::size_t SharedMemoryUsage() const { return _size; }
+
+        private:
+            const _internal::shm::Control &GetControl() const { return *reinterpret_cast<const _internal::shm::Control *>(_control.get()); }
+
+            _internal::shm::Header GetHeader() const
+            {
+                _internal::shm::Header header;
+                std::memcpy(&header, _image.get(), sizeof(header));
+                return header;
+            }
+
+            _internal::shm::Entry GetEntry(std::size_t index) const
+            {
+                _internal::shm::Entry entry;
+                std::memcpy(&entry, _image.get() + GetHeader().entries + index * sizeof(entry), sizeof(entry));
+                return entry;
+            }
+
+            // Checks the image, its bytecode included, and resolves its symbols, then replaces the mapped generation
+            Status Bind(const std::shared_ptr<std::uint8_t> &image, std::size_t size, std::uint64_t generation)
+            {
+                using namespace _internal::shm;
+
+                auto within = [size](std::uint64_t offset, std::uint64_t bytes) { return offset <= size && bytes <= size - offset; };
+
+                Header header;
+                if (size < sizeof(header))
+                    return Error_Load_Failed;
+                std::memcpy(&header, image.get(), sizeof(header));
+
+                std::uint64_t symbol_count = 0;
+                for (int kind = 0; kind < SymbolKinds; kind++)
+                    symbol_count += header.symbol_count[kind];
+
+                if (header.magic != magic || header.version != version || header.value_size != sizeof(T) || header.generation != generation
+                    || header.size != size || !within(header.symbols, symbol_count * sizeof(Symbol))
+                    || !within(header.entries, std::uint64_t(header.entry_count) * sizeof(Entry)))
+                    return Error_Load_Failed;
+
+                for (std::size_t i = 0; i < header.entry_count; i++) {
+                    Entry entry;
+                    std::memcpy(&entry, image.get() + header.entries + i * sizeof(entry), sizeof(entry));
+                    if (!within(entry.name, entry.name_size) || !within(entry.code, entry.code_size)
+                        || !within(entry.constants, std::uint64_t(entry.constant_count) * sizeof(T)) || entry.constants % alignof(T))
+                        return Error_Load_Failed;
+                }
+
+                std::vector<const T *>                   variables;
+                std::vector<std::function<T(T)>>         functions;
+                std::vector<const Table<T> *>            tables;
+                std::vector<const std::vector<T> *>      arrays;
+                std::vector<T *>                         outputs;
+                std::vector<std::uint64_t>               array_sizes;
+
+                const _internal::SymbolTable<T> &bindings = *_bindings;
+                const std::map<std::string, std::uint16_t> *indices[SymbolKinds] = {
+                    &bindings.variable_index, &bindings.function_index, &bindings.table_index, &bindings.array_index, &bindings.output_index
+                };
+
+                const std::uint8_t *record = image.get() + header.symbols;
+                for (int kind = 0; kind < SymbolKinds; kind++) {
+                    for (std::size_t i = 0; i < header.symbol_count[kind]; i++, record += sizeof(Symbol)) {
+                        Symbol symbol;
+                        std::memcpy(&symbol, record, sizeof(symbol));
+                        if (!within(symbol.name, symbol.name_size))
+                            return Error_Load_Failed;
+
+                        auto it = indices[kind]->find(std::string(reinterpret_cast<const char *>(image.get()) + symbol.name, symbol.name_size));
+                        if (it == indices[kind]->end())
+                            return Error_Unregistered_Symbol;
+
+                        switch (kind) {
+                            case Variables: variables.push_back(bindings.variable_pointers[it->second]); break;
+                            case Functions: functions.push_back(bindings.functions[it->second]); break;
+                            case Tables:    tables.push_back(bindings.table_pointers[it->second]); break;
+                            case Outputs:   outputs.push_back(bindings.output_pointers[it->second]); break;
+
+                            case Arrays: // Constant indices and slices were checked against the loader's arrays
+                                if (bindings.array_pointers[it->second]->size() != symbol.array_size)
+                                    return Error_Index_Out_Of_Bounds;
+                                arrays.push_back(bindings.array_pointers[it->second]);
+                                array_sizes.push_back(symbol.array_size);
+                                break;
+                        }
+                    }
+                }
+
+                for (std::size_t i = 0; i < header.entry_count; i++) {
+                    Entry entry;
+                    std::memcpy(&entry, image.get() + header.entries + i * sizeof(entry), sizeof(entry));
+                    if (!Verify(image.get() + entry.code, entry.code_size, entry.constant_count, header.symbol_count, array_sizes))
+                        return Error_Load_Failed;
+                }
+
+                _image      = image;
+                _size       = size;
+                _generation = generation;
+                _variables  = std::move(variables);
+                _functions  = std::move(functions);
+                _tables     = std::move(tables);
+                _arrays     = std::move(arrays);
+                _outputs    = std::move(outputs);
+                return Success;
+            }
+
+        private:
+            std::string                   _name;
+            std::shared_ptr<std::uint8_t> _control;
+            std::shared_ptr<std::uint8_t> _image;
+            std::size_t                   _size       = 0;
+            std::uint64_t                 _generation = 0;
+
+            std::shared_ptr<const _internal::SymbolTable<T>> _bindings; // Keeps the bound symbols alive
+
+            std::vector<const T *>              _variables;
+            std::vector<std::function<T(T)>>    _functions;
+            std::vector<const Table<T> *>       _tables;
+            std::vector<const std::vector<T> *> _arrays;
+            std::vector<T *>                    _outputs;
+        };
+    }
+}
+
+#endif // _exprparse_shm_h_
@@ -0,0 +1,126 @@
+#include "exprparse.hpp"
+#include "exprparse_codegen.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Generates, compiles, loads and evaluates native code in a private cache directory, then replaces the cached
+// object by one built from other source, as after a hash collision, and checks that it is compiled again
+// instead of loaded. Needs the compiler of $CXX or c++. The exit code is nonzero if any check failed.
+
+namespace {
+
+    using namespace exprparse;
+
+    int failures = 0;
+
+    void Check(bool ok, const char *what, const std::string &detail)
+    {
+        if (!ok) {
+            failures++;
+            std::fprintf(stderr, "FAILED %s: %s\n", what, detail.c_str());
+        }
+    }
+
+    // Native evaluation of source against the expression, row by row and in a batch
+    void CheckNative(codegen::Library<double> &library, Expression<double> &e, std::vector<std::shared_ptr<double>> &variables,
+                     const std::string &source)
+    {
+        codegen::NativeExpression<double> native;
+        Status status = library.Get("expression", native);
+        Check(status == Success, "get", source);
+        if (status != Success)
+            return;
+
+        std::vector<double> column(16), out(16);
+        for (std::size_t row = 0; row < column.size(); row++) {
+            column[row] = row * 0.75 - 3;
+            *variables[0] = column[row];
+
+            Status expected_status, native_status;
+            double expected = e.Eval(expected_status);
+            double value    = native.Eval(native_status);
+            Check(value == expected && native_status == expected_status, "eval", source + ": " + std::to_string(value)
+                                                                                  + " instead of " + std::to_string(expected));
+        }
+
+        const double *columns[] = { column.data() };
+        native.EvalBatch(columns, column.size(), out.data(), status);
+        for (std::size_t row = 0; row < column.size(); row++) {
+            *variables[0] = column[row];
+            Check(out[row] == e.Eval(status), "batch", source + ", row " + std::to_string(row));
+        }
+    }
+}
+
+int main()
+{
+    char directory[] = "/tmp/exprparse_codegen_test.XXXXXX";
+    if (!mkdtemp(directory)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+
+    codegen::Options options;
+    options.cache_dir = std::string(directory) + "/cache";
+
+    auto x = std::make_shared<double>(0);
+    std::vector<std::shared_ptr<double>> variables = { x };
+
+    Expression<double> e;
+    e.RegisterVariable("x", x);
+    e.RegisterFunction("square", [](double v) { return v * v; });
+
+    // Two expressions, the second compiled into the path of the first below
+    const std::string sources[] = { "x * 2 + square(x - 1) / 3", "u = x + 0.5; u * u - 1 / (x + 3)" };
+    std::string paths[2];
+
+    for (int i = 0; i < 2; i++) {
+        Status status = e.Parse(sources[i]);
+        Check(status == Success, "parse", sources[i]);
+
+        codegen::Generator<double> generator;
+        status = generator.Add("expression", e);
+        Check(status == Success, "generate", sources[i]);
+
+        codegen::Library<double> library;
+        status = library.Load(generator, options);
+        Check(status == Success, "load", sources[i] + ": status " + std::to_string(status));
+        if (status != Success)
+            continue;
+
+        paths[i] = library.Path();
+        CheckNative(library, e, variables, sources[i]);
+    }
+
+    // A collision of the hash, or a stale object: the first path now holds the code of the second expression
+    if (!paths[0].empty() && !paths[1].empty() && std::rename(paths[1].c_str(), paths[0].c_str()) == 0) {
+        e.Parse(sources[0]);
+
+        codegen::Generator<double> generator;
+        generator.Add("expression", e);
+
+        codegen::Library<double> library;
+        Status status = library.Load(generator, options);
+        Check(status == Success, "reload", "status " + std::to_string(status));
+        Check(library.Path() == paths[0], "reload", library.Path() + " instead of " + paths[0]);
+        if (status == Success)
+            CheckNative(library, e, variables, sources[0] + " after a collision");
+    }
+    else {
+        Check(false, "collision", "could not replace the cached object");
+    }
+
+    for (auto &path : paths)
+        std::remove(path.c_str());
+    rmdir(options.cache_dir.c_str());
+    rmdir(directory);
+
+    std::printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+#include "exprparse.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Checks that EvalRealtime does not allocate: malloc and free of the whole program are interposed and count
+// the calls made while InRealtimeEval() is true. Expressions using every kind of node are evaluated many
+// times, and a registered function that allocates checks that the interposition actually sees allocations.
+// The exit code is nonzero if any check failed.
+
+// Sanitizers replace malloc themselves, the interposition is only built without them
+#if defined(__has_feature)
+#if __has_feature(thread_sanitizer) || __has_feature(address_sanitizer)
+#define EXPRPARSE_SANITIZED
+#endif
+#endif
+#if defined(__SANITIZE_THREAD__) || defined(__SANITIZE_ADDRESS__)
+#define EXPRPARSE_SANITIZED
+#endif
+
+#if defined(__GLIBC__) && !defined(EXPRPARSE_SANITIZED)
+
+extern "C" {
+    void *__libc_malloc(std::size_t size);
+    void *__libc_calloc(std::size_t count, std::size_t size);
+    void *__libc_realloc(void *pointer, std::size_t size);
+    void *__libc_memalign(std::size_t alignment, std::size_t size);
+    void  __libc_free(void *pointer);
+}
+
+namespace {
+
+    std::atomic<std::size_t> realtime_calls{ 0 };
+
+    void Count()
+    {
+        if (exprparse::InRealtimeEval())
+            realtime_calls++;
+    }
+}
+
+extern "C" {
+    void *malloc(std::size_t size)
+    {
+        Count();
+        return __libc_malloc(size);
+    }
+
+    void *calloc(std::size_t count, std::size_t size)
+    {
+        Count();
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *pointer, std::size_t size)
+    {
+        Count();
+        return __libc_realloc(pointer, size);
+    }
+
+    void *memalign(std::size_t alignment, std::size_t size)
+    {
+        Count();
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(std::size_t alignment, std::size_t size)
+    {
+        Count();
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void **pointer, std::size_t alignment, std::size_t size)
+    {
+        Count();
+        *pointer = __libc_memalign(alignment, size);
+        return *pointer ? 0 : 12; // ENOMEM
+    }
+
+    void free(void *pointer)
+    {
+        if (pointer)
+            Count();
+        __libc_free(pointer);
+    }
+}
+
+namespace {
+
+    using namespace exprparse;
+
+    int failures = 0;
+
+    void Check(bool ok, const char *what, const std::string &detail)
+    {
+        if (!ok) {
+            failures++;
+            std::fprintf(stderr, "FAILED %s: %s\n", what, detail.c_str());
+        }
+    }
+}
+
+int main()
+{
+    Expression<double> e;
+    e.RegisterIntrinsics();
+
+    auto x = std::make_shared<double>(0.5);
+    auto y = std::make_shared<double>(2);
+    auto out = std::make_shared<double>(0);
+    auto values = std::make_shared<std::vector<double>>(std::vector<double>{ 1, 2, 3, 4, 5, 6, 7, 8 });
+    auto weights = std::make_shared<std::vector<double>>(std::vector<double>{ 8, 7, 6, 5, 4, 3, 2, 1 });
+    auto table = std::make_shared<Table<double>>();
+    table->SetUniform(0, 0.25, { 1, 2, 4, 3, 0 }, Table<double>::Cubic);
+
+    // Captures more than std::function stores inline, so copying it would allocate
+    double scale[8] = { 1, 1, 1, 1, 1, 1, 1, 2 };
+    e.RegisterVariable("x", x);
+    e.RegisterVariable("y", y);
+    e.RegisterOutput("out", out);
+    e.RegisterArray("a", values);
+    e.RegisterArray("b", weights);
+    e.RegisterTable("t", table);
+    e.RegisterFunction("scaled", [scale](double v) { return v * scale[7]; });
+
+    Expression<double> inner;
+    auto z = std::make_shared<double>(3);
+    inner.RegisterVariable("z", z);
+    inner.Parse("z * z");
+
+    // Evaluates another expression in real time, the flag must still be set afterwards
+    bool nested_ok = true;
+    e.RegisterFunction("nested", [&](double v) {
+        Status status;
+        double value = inner.EvalRealtime(status);
+        nested_ok = nested_ok && InRealtimeEval();
+        return v + value;
+    });
+
+    std::vector<std::string> sources = {
+        "x + y * 3 - x / y",
+        "sin(x) + exp(-y) + scaled(x) + t(x)",
+        "a[3] + a[x * 4] + sum(a) + dot(a, b) + norm2(b) + min(a) + max(b)",
+        "u = x * y; v = u + 1; out = u * v; out + v",
+        "lag(x, 3) + ema(y, 0.1) + rolling_mean(x, 16) + rolling_min(y, 4) + rolling_max(x, 8)",
+        "nested(x) * 2",
+    };
+
+    for (auto &source : sources) {
+        Status status = e.Parse(source);
+        Check(status == Success, "parse", source);
+        if (status != Success)
+            continue;
+
+        realtime_calls = 0;
+        for (int i = 0; i < 10000; i++) {
+            *x = i * 0.001;
+            e.EvalRealtime(status);
+        }
+        std::size_t calls = realtime_calls;
+        Check(calls == 0, "allocation-free", source + ": " + std::to_string(calls) + " malloc/free calls");
+    }
+    Check(nested_ok, "nested EvalRealtime", "InRealtimeEval() cleared by the inner call");
+    Check(!InRealtimeEval(), "flag", "InRealtimeEval() still set after EvalRealtime");
+
+    // The interposition must see allocations of registered functions
+    e.RegisterFunction("allocating", [](double v) { return std::vector<double>(64, v).back(); });
+    e.Parse("allocating(x)");
+    realtime_calls = 0;
+    Status status;
+    e.EvalRealtime(status);
+    Check(realtime_calls > 0, "interposition", "an allocating function was not detected");
+
+    std::printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+#else
+
+int main()
+{
+    std::printf("skipped, malloc is only interposed with glibc and without sanitizers\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,391 @@
+#include "exprparse.hpp"
+#include "exprparse_shm.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// Checks of behaviour that crosses features: builder terms reused between expressions, interned and
+// epoch-cached trees, shared memory images. Every test registers its own symbols. The exit code is
+// nonzero if any check failed.
+
+namespace {
+
+    using namespace exprparse;
+
+    int failures = 0;
+
+    void Check(bool ok, const char *what, const std::string &detail)
+    {
+        if (!ok) {
+            failures++;
+            std::fprintf(stderr, "FAILED %s: %s\n", what, detail.c_str());
+        }
+    }
+
+    // Equal values, NaN included, as windows return NaN before they have enough rows
+    bool Same(double a, double b) { return a == b || (std::isnan(a) && std::isnan(b)); }
+
+    // A builder term built into a plain expression and then interned into another one with the epoch
+    // cache, both must keep evaluating their own trees
+    void TestInternedBuilderTerms()
+    {
+        InternStore<double> store;
+        store.EnableEpochCache(true);
+
+        auto x = std::make_shared<double>(1);
+
+        Expression<double> plain, interned;
+        plain.RegisterVariable("x", x);
+        interned.ShareSymbols(plain);
+        interned.SetInternStore(&store);
+
+        Builder<double> b(plain);
+        auto term = b.Mul(b.Add(b.Var("x"), b.Constant(1)), b.Constant(2));
+
+        Status status = plain.Build(term);
+        Check(status == Success, "intern build", "plain: status " + std::to_string(status));
+        status = interned.Build(term);
+        Check(status == Success, "intern build", "interned: status " + std::to_string(status));
+
+        for (double value : { 1.0, 10.0, -3.0 }) {
+            *x = value;
+            store.AdvanceEpoch();
+
+            double expected = (value + 1) * 2;
+            double a = plain.Eval(status);
+            double c = interned.Eval(status);
+            Check(a == expected, "intern plain", std::to_string(a) + " instead of " + std::to_string(expected));
+            Check(c == expected, "intern cached", std::to_string(c) + " instead of " + std::to_string(expected));
+        }
+
+        // Within one epoch the cached value is kept, the plain expression always reads x
+        *x = 5;
+        double cached = interned.Eval(status);
+        *x = 6;
+        Check(interned.Eval(status) == cached, "epoch cache", "value changed within an epoch");
+        Check(plain.Eval(status) == 14, "epoch cache", "plain expression reads a cached value");
+
+        // Equal subtrees of parsed expressions are shared
+        Expression<double> first, second;
+        first.ShareSymbols(plain);
+        second.ShareSymbols(plain);
+        first.SetInternStore(&store);
+        second.SetInternStore(&store);
+        first.Parse("(x + 1) * 2 + 3");
+        second.Parse("(x + 1) * 2 - 3");
+
+        InternStatistics statistics = store.Statistics();
+        Check(statistics.hits > 0, "intern sharing", "no subtree shared");
+    }
+
+    // A window term used twice, and in two expressions, has one state per use like the parsed text
+    void TestBuiltWindows()
+    {
+        auto x = std::make_shared<double>(0);
+
+        Expression<double> parsed, built, other;
+        parsed.RegisterVariable("x", x);
+        built.ShareSymbols(parsed);
+        other.ShareSymbols(parsed);
+
+        const char *source = "lag(x, 1) + lag(x, 1) + ema(x, 0.5) * rolling_max(x, 3)";
+        Status status = parsed.Parse(source);
+        Check(status == Success, "window parse", source);
+
+        Builder<double> b(parsed);
+        auto lag = b.Window("lag", b.Var("x"), 1);
+        auto term = b.Add(b.Add(lag, lag), b.Mul(b.Window("ema", b.Var("x"), 0.5), b.Window("rolling_max", b.Var("x"), 3)));
+        status = built.Build(term);
+        Check(status == Success, "window build", "status " + std::to_string(status));
+        status = other.Build(b.Add(lag, b.Constant(0)));
+        Check(status == Success, "window build", "status " + std::to_string(status));
+
+        for (int row = 1; row <= 8; row++) {
+            *x = row;
+            double expected = parsed.Eval(status);
+            double value    = built.Eval(status);
+            Check(Same(value, expected), "built windows", "row " + std::to_string(row) + ": " + std::to_string(value)
+                                                      + " instead of " + std::to_string(expected));
+
+            // Evaluated every other row, so it lags differently than the other expressions
+            if (row % 2 == 0) {
+                double lagged = other.Eval(status);
+                Check(Same(lagged, row == 2 ? std::nan("") : row - 2), "built windows", "shared state between expressions");
+            }
+        }
+    }
+
+    // Interned and epoch-cached subtrees print with the brackets of the nodes they cache, so the text
+    // parses back to the same expression
+    void TestInternedRoundTrip()
+    {
+        InternStore<double> store;
+        store.EnableEpochCache(true);
+
+        auto x = std::make_shared<double>(3);
+        auto y = std::make_shared<double>(0.25);
+
+        Expression<double> e, reparsed;
+        e.RegisterIntrinsics();
+        e.RegisterVariable("x", x);
+        e.RegisterVariable("y", y);
+        e.SetInternStore(&store);
+        reparsed.ShareSymbols(e);
+        reparsed.SetInternStore(&store);
+
+        const char *sources[] = {
+            "(x + 1) * 2", "2 / (x - y)", "x - (y - 1)", "-(x + y) * (x - y)", "(x * y) / (y * x)",
+            "exp(x + y) * (sin(x) - cos(y))", "(x + 1) * 2 + (x + 1) * 2 / (y + 1)",
+        };
+
+        for (const char *source : sources) {
+            Status status = e.Parse(source);
+            Check(status == Success, "round trip parse", source);
+
+            std::string text = e.ToString();
+            status = reparsed.Parse(text);
+            Check(status == Success, "round trip reparse", text);
+
+            store.AdvanceEpoch();
+            double expected = e.Eval(status);
+            double value    = reparsed.Eval(status);
+            Check(value == expected, "round trip", std::string(source) + " printed as " + text);
+            Check(reparsed.ToString() == text, "round trip", text + " printed as " + reparsed.ToString());
+        }
+    }
+
+    // Batches of compact bytecode give the results of Eval row by row, with every kind of instruction
+    void TestCompactBatch()
+    {
+        auto x   = std::make_shared<double>(0);
+        auto y   = std::make_shared<double>(0);
+        auto out = std::make_shared<double>(0);
+        auto a   = std::make_shared<std::vector<double>>(std::vector<double>{ 1, 2, 3, 4, 5, 6, 7, 8 });
+        auto t   = std::make_shared<Table<double>>();
+        t->SetUniform(0, 0.5, { 1, 3, 2, 5 }, Table<double>::Linear);
+
+        Expression<double> e;
+        e.RegisterIntrinsics();
+        e.RegisterVariable("x", x);
+        e.RegisterVariable("y", y);
+        e.RegisterOutput("out", out);
+        e.RegisterArray("a", a);
+        e.RegisterTable("t", t);
+
+        const char *sources[] = {
+            "x * 2 + y", "(x - y) / (y - x * 0.5) - 3 / (x + 1.5)", "sin(x) * exp(-y) + t(x / 10)",
+            "a[2] + a[x] * sum(a) - dot(a[1..4], a[4..7])", "u = x * y; out = u + 1; u / out",
+            "x - (y - (x * (y - 1.25)))",
+        };
+
+        const std::size_t rows = 150; // Two full blocks and a partial one
+        std::vector<double> xs(rows), ys(rows), batch(rows);
+        for (std::size_t row = 0; row < rows; row++) {
+            xs[row] = (row * 37 % 101) * 0.1 - 2;
+            ys[row] = (row * 53 % 89) * 0.05 - 1;
+        }
+
+        for (const char *source : sources) {
+            Status status = e.Parse(source);
+            Check(status == Success, "batch parse", source);
+
+            CompactExpression<double> compact;
+            status = compact.Compile(e);
+            Check(status == Success, "batch compile", source);
+
+            Status batch_status;
+            compact.EvalBatch({ { "x", xs.data() }, { "y", ys.data() } }, rows, batch.data(), batch_status);
+            double batch_out = *out;
+
+            Status row_status = Success;
+            for (std::size_t row = 0; row < rows; row++) {
+                *x = xs[row];
+                *y = ys[row];
+
+                Status status;
+                double value = compact.Eval(status);
+                if (status != Success)
+                    row_status = status;
+                Check(Same(batch[row], value), "compact batch", std::string(source) + ", row " + std::to_string(row) + ": "
+                                                                + std::to_string(batch[row]) + " instead of " + std::to_string(value));
+            }
+            Check(batch_status == row_status, "compact batch status", source);
+            Check(Same(batch_out, *out), "compact batch output", source);
+        }
+    }
+
+    // Terms resolve symbols in the registry of their builder and are refused by expressions with other symbols
+    void TestForeignTerms()
+    {
+        auto x = std::make_shared<double>(2);
+        auto y = std::make_shared<double>(3);
+
+        Expression<double> e, shared, other;
+        e.RegisterVariable("x", x);
+        shared.ShareSymbols(e);
+        other.RegisterVariable("x", y);
+
+        Builder<double> b(e), foreign(other);
+        auto term = b.Mul(b.Var("x"), b.Constant(2));
+
+        Status status = shared.Build(term);
+        Check(status == Success, "shared symbols", "status " + std::to_string(status));
+        Check(shared.Eval(status) == 4, "shared symbols", "wrong variable");
+
+        status = other.Build(term);
+        Check(status == Error_Foreign_Term, "foreign build", "status " + std::to_string(status));
+        Check(!other.AST(), "foreign build", "expression kept");
+
+        status = e.Build(b.Add(term, foreign.Var("x")));
+        Check(status == Error_Foreign_Term, "foreign operand", "status " + std::to_string(status));
+        status = e.Build(b.Call("missing", foreign.Var("x")));
+        Check(status == Error_Unregistered_Symbol, "foreign argument", "status " + std::to_string(status));
+        status = e.Build(b.Let("u", foreign.Var("x"), [&](const Builder<double>::Term &u) { return b.Add(u, term); }));
+        Check(status == Error_Foreign_Term, "foreign let", "status " + std::to_string(status));
+
+        CompactExpression<double> compact;
+        Check(compact.Compile(other) == Error_Not_Compiled, "foreign compact", "compiled a refused build");
+    }
+
+    // Layers respect the dependencies, and evaluating them on several threads gives the sequential results
+    void TestExpressionGraph()
+    {
+        auto a = std::make_shared<double>(1.5);
+        auto b = std::make_shared<double>(-0.25);
+
+        ExpressionGraph<double> sequential, parallel;
+        parallel.SetThreadCount(4);
+
+        std::vector<std::pair<std::string, std::string>> expressions = {
+            { "top", "left * right + mid" }, { "left", "base * 2 + sin(a)" }, { "right", "base - b / 3" },
+            { "mid", "left / (right * right + 1)" }, { "base", "a * a + b" }, { "side", "exp(b) - a" },
+        };
+        for (int i = 0; i < 24; i++) // A wide layer of independent expressions
+            expressions.emplace_back("w" + std::to_string(i), "base * " + std::to_string(i) + " + side / " + std::to_string(i + 1));
+
+        for (auto *graph : { &sequential, &parallel }) {
+            graph->RegisterVariable("a", a);
+            graph->RegisterVariable("b", b);
+            graph->RegisterFunction("sin", [](double x) { return std::sin(x); });
+            graph->RegisterFunction("exp", [](double x) { return std::exp(x); });
+            for (auto &expression : expressions)
+                graph->AddExpression(expression.first, expression.second);
+
+            Status status = graph->Compile();
+            Check(status == Success, "graph compile", "status " + std::to_string(status));
+        }
+
+        // Every expression comes after the expressions it references
+        std::map<std::string, std::size_t> layer_of;
+        auto layers = sequential.Layers();
+        for (std::size_t layer = 0; layer < layers.size(); layer++)
+            for (auto &name : layers[layer])
+                layer_of[name] = layer;
+
+        std::vector<std::pair<std::string, std::string>> edges = {
+            { "base", "left" }, { "base", "right" }, { "left", "mid" }, { "right", "mid" },
+            { "mid", "top" }, { "left", "top" }, { "base", "w0" }, { "side", "w23" },
+        };
+        for (auto &edge : edges)
+            Check(layer_of.at(edge.first) < layer_of.at(edge.second), "graph layers", edge.first + " not before " + edge.second);
+        Check(layers.size() == 4 && layers[0].size() == 2, "graph layers", std::to_string(layers.size()) + " layers");
+
+        for (int round = 0; round < 20; round++) {
+            *a = 1.5 + round * 0.125;
+            if (round % 3 == 0) {
+                *b = -0.25 * round;
+                sequential.Invalidate("b");
+                parallel.Invalidate("b");
+            }
+            sequential.Invalidate("a");
+            parallel.Invalidate("a");
+
+            Status s1 = sequential.Eval(), s2 = parallel.Eval();
+            Check(s1 == Success && s2 == Success, "graph eval", "status " + std::to_string(s1) + ", " + std::to_string(s2));
+
+            for (auto &expression : expressions) {
+                double x = *sequential.Output(expression.first), y = *parallel.Output(expression.first);
+                Check(x == y, "graph parallel", expression.first + ": " + std::to_string(y) + " instead of " + std::to_string(x));
+            }
+        }
+
+        // Checked against the formulas after the last round
+        double base = *a * *a + *b, left = base * 2 + std::sin(*a), right = base - *b / 3;
+        double top  = left * right + left / (right * right + 1);
+        Check(*parallel.Output("top") == top, "graph values", std::to_string(*parallel.Output("top")) + " instead of " + std::to_string(top));
+
+        ExpressionGraph<double> cycle;
+        cycle.AddExpression("p", "q + 1");
+        cycle.AddExpression("q", "p * 2");
+        Check(cycle.Compile() == Error_Dependency_Cycle, "graph cycle", "not reported");
+    }
+
+    // Checks removed by the loader's variable ranges must not be trusted by a worker whose variables
+    // have no ranges, or values outside them
+    void TestSharedMemoryRanges()
+    {
+        auto x     = std::make_shared<double>(1);
+        auto i     = std::make_shared<double>(0);
+        auto array = std::make_shared<std::vector<double>>(std::vector<double>{ 10, 20, 30 });
+
+        Expression<double> loader;
+        loader.RegisterVariable("x", x, Interval<double>{ 1, 100 });
+        loader.RegisterVariable("i", i, Interval<double>{ 0, 2 });
+        loader.RegisterArray("a", array);
+        Status status = loader.Parse("1 / x + a[i]");
+        Check(status == Success && loader.EliminatedChecks() == 2, "shm ranges", "checks not eliminated by the loader");
+
+        std::string name = "/exprparse_test." + std::to_string(getpid());
+        shm::Publisher<double> publisher;
+        status = publisher.Add("f", loader);
+        Check(status == Success, "shm publish", "add: status " + std::to_string(status));
+        status = publisher.Publish(name);
+        Check(status == Success, "shm publish", "status " + std::to_string(status));
+        if (status != Success)
+            return;
+
+        auto y = std::make_shared<double>(0);
+        auto j = std::make_shared<double>(0);
+        Expression<double> worker;
+        worker.RegisterVariable("x", y);
+        worker.RegisterVariable("i", j);
+        worker.RegisterArray("a", array);
+
+        shm::Store<double> store;
+        std::size_t index = 0;
+        status = store.Open(name, worker);
+        Check(status == Success && store.Find("f", index) == Success, "shm open", "status " + std::to_string(status));
+
+        store.Eval(index, status);
+        Check(status == Error_Division_By_Zero, "shm division", "status " + std::to_string(status));
+        *y = 4;
+        *j = 5;
+        store.Eval(index, status);
+        Check(status == Error_Index_Out_Of_Bounds, "shm index", "status " + std::to_string(status));
+        *j = 2;
+        double value = store.Eval(index, status);
+        Check(status == Success && value == 30.25, "shm value", std::to_string(value) + ", status " + std::to_string(status));
+
+        shm::Remove(name);
+    }
+}
+
+int main()
+{
+    TestInternedBuilderTerms();
+    TestBuiltWindows();
+    TestInternedRoundTrip();
+    TestCompactBatch();
+    TestForeignTerms();
+    TestExpressionGraph();
+    TestSharedMemoryRanges();
+
+    std::printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,265 @@
+#include "exprparse.hpp"
+#include "exprparse_protocol.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Load generator and test client of exprparse_server: compiles an expression on the server, then runs
+// concurrent connections that each keep a number of eval requests in flight. Every result is checked against
+// a local evaluation of the same expression; the exit code is nonzero if any request failed or differed.
+//
+//   exprparse_loadgen [--socket PATH] [--clients N] [--seconds S] [--rows N] [--pipeline N]
+//                     [--expression SOURCE] [--variables x,y,...]
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+    using namespace exprparse;
+
+    struct Options {
+        std::string socket     = protocol::DefaultSocket();
+        int         clients    = 8;
+        double      seconds    = 5;
+        std::size_t rows       = 1; // Per request
+        std::size_t pipeline   = 1; // Requests in flight per connection
+        std::string expression = "x * y + sin(x) / (1 + y * y) - exp(-x * x)";
+        std::vector<std::string> variables = { "x", "y" };
+    };
+
+    struct Result {
+        std::vector<double> latencies_us;
+        std::size_t         rows       = 0;
+        std::size_t         errors     = 0;
+        std::size_t         mismatches = 0;
+        bool                failed     = false;
+    };
+
+    std::vector<std::string> Split(const std::string &list)
+    {
+        std::vector<std::string> items;
+        std::size_t begin = 0;
+        while (begin <= list.size()) {
+            std::size_t end = list.find(',', begin);
+            if (end == std::string::npos)
+                end = list.size();
+            if (end > begin)
+                items.push_back(list.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        return items;
+    }
+
+    // Sends a request and waits for its response, for the setup requests
+    bool Call(int fd, protocol::Writer &request, std::vector<std::uint8_t> &response)
+    {
+        const std::vector<std::uint8_t> &frame = request.Finish();
+        return protocol::WriteAll(fd, frame.data(), frame.size()) && protocol::ReadFrame(fd, response);
+    }
+
+    // One connection keeping options.pipeline requests in flight until the deadline
+    void Run(const Options &options, unsigned seed, Clock::time_point deadline, Result &result)
+    {
+        int fd = protocol::Connect(options.socket);
+        if (fd < 0) {
+            result.failed = true;
+            return;
+        }
+
+        // Reference results of the same expression
+        Expression<double> reference;
+        reference.RegisterIntrinsics();
+        std::vector<std::shared_ptr<double>> variables;
+        for (auto &name : options.variables) {
+            variables.push_back(std::make_shared<double>(0));
+            reference.RegisterVariable(name, variables.back());
+        }
+        reference.Parse(options.expression);
+
+        struct InFlight {
+            Clock::time_point   sent;
+            std::vector<double> expected;
+        };
+        std::map<std::uint32_t, InFlight> in_flight;
+        std::uint32_t next_id = 0;
+
+        std::mt19937_64 random(seed);
+        std::uniform_real_distribution<double> uniform(-2, 2);
+        std::vector<std::uint8_t> response;
+
+        for (;;) {
+            while (in_flight.size() < options.pipeline && Clock::now() < deadline) {
+                protocol::Writer request(protocol::Eval, next_id);
+                request.String16("loadgen");
+                request.U32(static_cast<std::uint32_t>(options.rows));
+                request.U16(static_cast<std::uint16_t>(variables.size()));
+
+                std::vector<double> values(options.rows * variables.size());
+                for (auto &value : values) {
+                    value = uniform(random);
+                    request.F64(value);
+                }
+
+                InFlight &expected = in_flight[next_id++];
+                for (std::size_t row = 0; row < options.rows; row++) {
+                    for (std::size_t c = 0; c < variables.size(); c++)
+                        *variables[c] = values[c * options.rows + row];
+                    Status status;
+                    expected.expected.push_back(reference.Eval(status));
+                }
+
+                const std::vector<std::uint8_t> &frame = request.Finish();
+                expected.sent = Clock::now();
+                if (!protocol::WriteAll(fd, frame.data(), frame.size())) {
+                    result.failed = true;
+                    close(fd);
+                    return;
+                }
+            }
+
+            if (in_flight.empty())
+                break;
+
+            if (!protocol::ReadFrame(fd, response)) {
+                result.failed = true;
+                break;
+            }
+
+            protocol::Reader reader(response.data(), response.size());
+            reader.U8();
+            auto it = in_flight.find(reader.U32());
+            if (it == in_flight.end()) {
+                result.failed = true;
+                break;
+            }
+
+            result.latencies_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - it->second.sent).count());
+
+            Status status = static_cast<Status>(reader.I32());
+            std::size_t rows = reader.U32();
+            if (status != Success || rows != it->second.expected.size()) {
+                result.errors++;
+            }
+            else {
+                for (double expected : it->second.expected) {
+                    double value = reader.F64();
+                    if (value != expected && !(std::isnan(value) && std::isnan(expected)))
+                        result.mismatches++;
+                }
+                result.rows += rows;
+            }
+
+            in_flight.erase(it);
+        }
+
+        close(fd);
+    }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: exprparse_loadgen [--socket PATH] [--clients N] [--seconds S] [--rows N] [--pipeline N]\n"
+                             "                         [--expression SOURCE] [--variables x,y,...]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool value = i + 1 < argc;
+
+        if (arg == "--socket" && value)          options.socket = argv[++i];
+        else if (arg == "--clients" && value)    options.clients = std::atoi(argv[++i]);
+        else if (arg == "--seconds" && value)    options.seconds = std::atof(argv[++i]);
+        else if (arg == "--rows" && value)       options.rows = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--pipeline" && value)   options.pipeline = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--expression" && value) options.expression = argv[++i];
+        else if (arg == "--variables" && value)  options.variables = Split(argv[++i]);
+        else {
+            Usage();
+            return 2;
+        }
+    }
+    if (options.clients < 1 || options.rows < 1 || options.pipeline < 1) {
+        Usage();
+        return 2;
+    }
+
+    int fd = protocol::Connect(options.socket);
+    if (fd < 0) {
+        std::fprintf(stderr, "Cannot connect to %s\n", options.socket.c_str());
+        return 1;
+    }
+
+    std::vector<std::uint8_t> response;
+
+    protocol::Writer compile(protocol::Compile, 0);
+    compile.String16("loadgen");
+    compile.String32(options.expression);
+    compile.U16(static_cast<std::uint16_t>(options.variables.size()));
+    for (auto &variable : options.variables)
+        compile.String16(variable);
+
+    if (!Call(fd, compile, response)) {
+        std::fprintf(stderr, "Connection lost\n");
+        return 1;
+    }
+    protocol::Reader compiled(response.data(), response.size());
+    compiled.U8();
+    compiled.U32();
+    if (int status = compiled.I32()) {
+        std::fprintf(stderr, "Compiling \"%s\" failed with status %d\n", options.expression.c_str(), status);
+        return 1;
+    }
+
+    protocol::Writer reset(protocol::Stats, 0); // Starts the server's report over
+    Call(fd, reset, response);
+
+    std::vector<Result> results(options.clients);
+    std::vector<std::thread> threads;
+    auto start    = Clock::now();
+    auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    for (int i = 0; i < options.clients; i++)
+        threads.emplace_back(Run, std::cref(options), 1000u + i, deadline, std::ref(results[i]));
+    for (auto &thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Result total;
+    for (auto &result : results) {
+        total.latencies_us.insert(total.latencies_us.end(), result.latencies_us.begin(), result.latencies_us.end());
+        total.rows       += result.rows;
+        total.errors     += result.errors;
+        total.mismatches += result.mismatches;
+        total.failed     |= result.failed;
+    }
+
+    std::size_t requests = total.latencies_us.size();
+    std::printf("%d clients, %zu rows per request, %zu in flight per client, %.1f s\n", options.clients, options.rows, options.pipeline, seconds);
+    std::printf("%zu requests (%.0f/s), %zu rows (%.0f/s), %zu errors, %zu mismatches%s\n", requests, requests / seconds,
+        total.rows, total.rows / seconds, total.errors, total.mismatches, total.failed ? ", connection failures" : "");
+    std::printf("round trip us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+        protocol::Percentile(total.latencies_us, 0.5), protocol::Percentile(total.latencies_us, 0.9), protocol::Percentile(total.latencies_us, 0.99),
+        protocol::Percentile(total.latencies_us, 0.999), protocol::Percentile(total.latencies_us, 1.0));
+
+    protocol::Writer stats(protocol::Stats, 0);
+    if (Call(fd, stats, response)) {
+        protocol::Reader reader(response.data(), response.size());
+        reader.U8();
+        reader.U32();
+        reader.I32();
+        std::printf("server %s", reader.String32().c_str());
+    }
+    close(fd);
+
+    return total.failed || total.errors || total.mismatches || requests == 0 ? 1 : 0;
+}
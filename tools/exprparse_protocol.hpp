@@ -0,0 +1,252 @@
+#ifndef _exprparse_protocol_h_
+#define _exprparse_protocol_h_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Binary protocol of exprparse_server over a Unix domain stream socket, shared with exprparse_loadgen.
+// All integers are little-endian and values are IEEE 754 doubles, so clients in other languages only
+// need to pack and unpack frames:
+//
+//   Request   u32 size, u8 type, u32 id, body            size counts the bytes after itself
+//   Response  u32 size, u8 type, u32 id, i32 status, body
+//
+//   Compile   request:  u16 name size, name, u32 source size, source, u16 variables, { u16 size, name }
+//             response: empty, status of parsing; replaces an expression of the same name once
+//                       compiled, eval requests sent before the response may use the previous one
+//   Eval      request:  u16 name size, name, u32 rows, u16 columns, f64 values column by column,
+//                       one column per variable in the order given when compiling; at most the
+//                       server's --max-batch rows, Error_Limit_Exceeded otherwise
+//             response: u32 rows, f64 values; status of the first failing row
+//   Stats     request:  empty
+//             response: u32 size, text of the server's report
+//
+// Responses carry the id of their request. Requests of one connection are answered in order for the
+// same expression, but may be answered out of order across expressions.
+
+namespace exprparse {
+    namespace protocol {
+
+        enum Type : std::uint8_t { Compile = 1, Eval = 2, Stats = 3 };
+
+        const std::uint32_t max_frame = 64u << 20;
+
+        // Appends a frame, the size is filled in by Finish
+        class Writer {
+        public:
+            Writer(Type type, std::uint32_t id)
+            {
+                U32(0);
+                U8(type);
+                U32(id);
+            }
+
+            void U8(std::uint8_t value) { _data.push_back(value); }
+            void U16(std::uint16_t value) { Bytes(value, 2); }
+            void U32(std::uint32_t value) { Bytes(value, 4); }
+            void I32(std::int32_t value) { Bytes(static_cast<std::uint32_t>(value), 4); }
+
+            void F64(double value)
+            {
+                std::uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                Bytes(bits, 8);
+            }
+
+            void String16(const std::string &value)
+            {
+                U16(static_cast<std::uint16_t>(value.size()));
+                _data.insert(_data.end(), value.begin(), value.end());
+            }
+
+            void String32(const std::string &value)
+            {
+                U32(static_cast<std::uint32_t>(value.size()));
+                _data.insert(_data.end(), value.begin(), value.end());
+            }
+
+            const std::vector<std::uint8_t> &Finish()
+            {
+                std::uint32_t size = static_cast<std::uint32_t>(_data.size() - 4);
+                for (int i = 0; i < 4; i++)
+                    _data[i] = static_cast<std::uint8_t>(size >> (8 * i));
+                return _data;
+            }
+
+        private:
+            void Bytes(std::uint64_t value, int count)
+            {
+                for (int i = 0; i < count; i++)
+                    _data.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+            }
+
+            std::vector<std::uint8_t> _data;
+        };
+
+        // Reads the fields of a frame after its size, Ok() is false once a read went past the end
+        class Reader {
+        public:
+            Reader(const std::uint8_t *data, std::size_t size) : _data(data), _end(data + size) {}
+
+            std::uint8_t  U8()  { return static_cast<std::uint8_t>(Bytes(1)); }
+            std::uint16_t U16() { return static_cast<std::uint16_t>(Bytes(2)); }
+            std::uint32_t U32() { return static_cast<std::uint32_t>(Bytes(4)); }
+            std::int32_t  I32() { return static_cast<std::int32_t>(static_cast<std::uint32_t>(Bytes(4))); }
+
+            double F64()
+            {
+                std::uint64_t bits = Bytes(8);
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return value;
+            }
+
+            std::string String16() { return String(U16()); }
+            std::string String32() { return String(U32()); }
+
+            bool        Ok() const { return _ok; }
+            std::size_t Remaining() const { return static_cast<std::size_t>(_end - _data); }
+
+        private:
+            std::uint64_t Bytes(std::size_t count)
+            {
+                if (Remaining() < count) {
+                    _ok   = false;
+                    _data = _end;
+                    return 0;
+                }
+
+                std::uint64_t value = 0;
+                for (std::size_t i = 0; i < count; i++)
+                    value |= std::uint64_t(_data[i]) << (8 * i);
+                _data += count;
+                return value;
+            }
+
+            std::string String(std::size_t size)
+            {
+                if (Remaining() < size) {
+                    _ok   = false;
+                    _data = _end;
+                    return std::string();
+                }
+
+                std::string value(reinterpret_cast<const char *>(_data), size);
+                _data += size;
+                return value;
+            }
+
+            const std::uint8_t *_data;
+            const std::uint8_t *_end;
+            bool                _ok = true;
+        };
+
+        // Size of the frame at the start of data, 0 if the size field is incomplete
+        inline std::uint32_t FrameSize(const std::uint8_t *data, std::size_t size)
+        {
+            return size < 4 ? 0 : Reader(data, 4).U32();
+        }
+
+        inline bool WriteAll(int fd, const std::uint8_t *data, std::size_t size)
+        {
+            while (size) {
+                ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written <= 0)
+                    return false;
+                data += written;
+                size -= static_cast<std::size_t>(written);
+            }
+            return true;
+        }
+
+        inline bool ReadAll(int fd, std::uint8_t *data, std::size_t size)
+        {
+            while (size) {
+                ssize_t count = recv(fd, data, size, 0);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    return false;
+                data += count;
+                size -= static_cast<std::size_t>(count);
+            }
+            return true;
+        }
+
+        // Blocking read of the next frame without its size field
+        inline bool ReadFrame(int fd, std::vector<std::uint8_t> &frame)
+        {
+            std::uint8_t size[4];
+            if (!ReadAll(fd, size, sizeof(size)))
+                return false;
+
+            std::uint32_t bytes = FrameSize(size, sizeof(size));
+            if (bytes > max_frame)
+                return false;
+
+            frame.resize(bytes);
+            return ReadAll(fd, frame.data(), frame.size());
+        }
+
+        inline bool Address(const std::string &path, sockaddr_un &address)
+        {
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+                return false;
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+
+        // Socket in the user's runtime directory, or one named after the user in /tmp without it
+        inline std::string DefaultSocket()
+        {
+            const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+            if (runtime && *runtime == '/')
+                return std::string(runtime) + "/exprparse.sock";
+            return "/tmp/exprparse-" + std::to_string(geteuid()) + ".sock";
+        }
+
+        // Connected socket, -1 on failure
+        inline int Connect(const std::string &path)
+        {
+            sockaddr_un address;
+            if (!Address(path, address))
+                return -1;
+
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0)
+                return -1;
+
+            if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        // Value below which a fraction p of the samples falls, sorts the samples
+        inline double Percentile(std::vector<double> &samples, double p)
+        {
+            if (samples.empty())
+                return 0;
+
+            std::sort(samples.begin(), samples.end());
+            std::size_t index = static_cast<std::size_t>(p * (samples.size() - 1) + 0.5);
+            return samples[std::min(index, samples.size() - 1)];
+        }
+    }
+}
+
+#endif // _exprparse_protocol_h_
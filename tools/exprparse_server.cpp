@@ -0,0 +1,710 @@
+#include "exprparse.hpp"
+#include "exprparse_codegen.hpp"
+#include "exprparse_protocol.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Evaluation daemon for services outside C++: keeps a registry of compiled expressions and answers the
+// requests of exprparse_protocol.hpp over a Unix domain socket. Eval requests for the same expression that
+// arrive together are evaluated as one batch, column-wise by compact bytecode or by native code; the report
+// lists throughput, batch sizes and the latency from the arrival of a request to its response. Expressions
+// are compiled on a separate thread, so a Compile never stalls the requests of other clients. The socket is
+// only accessible to the user running the server.
+//
+//   exprparse_server [--socket PATH] [--native] [--max-batch ROWS] [--batch-delay-ms MS] [--report SECONDS]
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+    using namespace exprparse;
+
+    volatile std::sig_atomic_t stop = 0;
+
+    struct Options {
+        std::string socket         = protocol::DefaultSocket();
+        bool        native         = false; // Evaluate batches with generated code instead of compact bytecode
+        std::size_t max_batch      = 4096;  // Rows that flush a batch at once
+        int         batch_delay_ms = 0;     // Time a batch waits for more requests, 0 flushes after every poll
+        int         report_seconds = 0;     // Period of the report on stderr, 0 reports only on exit
+    };
+
+    // Compiled expression of the registry, kept alive by pending requests when replaced
+    struct Entry {
+        std::vector<std::string>             variable_names; // Columns of eval requests
+        std::vector<std::shared_ptr<double>> variables;
+
+        Expression<double>        expression;
+        CompactExpression<double> compact;
+
+        bool                                has_native = false;
+        codegen::Library<double>            library;
+        codegen::NativeExpression<double>   native;
+        std::vector<std::size_t>            native_columns; // Request column of every variable of the generator
+    };
+
+    struct Request {
+        std::uint64_t       client;
+        std::uint32_t       id;
+        std::uint32_t       rows;
+        std::vector<double> values; // Column-major
+        Clock::time_point   arrival;
+    };
+
+    struct Batch {
+        std::shared_ptr<Entry> entry;
+        std::vector<Request>   requests;
+        std::size_t            rows = 0;
+        Clock::time_point      oldest;
+    };
+
+    struct Client {
+        int                       fd = -1;
+        std::vector<std::uint8_t> input;
+        std::vector<std::uint8_t> output;
+        bool                      closed = false;
+    };
+
+    // Compile request handed to the compiler thread, and its result
+    struct Compilation {
+        std::uint64_t            client = 0;
+        std::uint32_t            id     = 0;
+        std::string              name;
+        std::string              source;
+        std::vector<std::string> variables;
+
+        Status                 status = Success;
+        std::shared_ptr<Entry> entry;
+    };
+
+    class Stats {
+    public:
+        void Request(double latency_us, std::size_t rows, bool failed)
+        {
+            // Uniform sample of the latencies for the percentiles, so memory stays bounded between reports
+            if (_latencies.size() < samples)
+                _latencies.push_back(latency_us);
+            else if (std::size_t slot = _random() % (_requests + 1); slot < samples)
+                _latencies[slot] = latency_us;
+
+            _requests++;
+            _rows   += rows;
+            _errors += failed;
+        }
+
+        void Batch(std::size_t rows)
+        {
+            _batches++;
+            _batch_rows += rows;
+        }
+
+        // Report since the last one, then starts over
+        std::string Report()
+        {
+            double seconds = std::chrono::duration<double>(Clock::now() - _since).count();
+            std::size_t requests = _requests;
+
+            char text[512];
+            std::snprintf(text, sizeof(text),
+                "%.1f s: %zu requests (%.0f/s), %zu rows (%.0f/s), %zu batches (%.1f rows/batch), %zu errors\n"
+                "latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+                seconds, requests, requests / seconds, _rows, _rows / seconds,
+                _batches, _batches ? double(_batch_rows) / _batches : 0.0, _errors,
+                protocol::Percentile(_latencies, 0.5), protocol::Percentile(_latencies, 0.9), protocol::Percentile(_latencies, 0.99),
+                protocol::Percentile(_latencies, 0.999), protocol::Percentile(_latencies, 1.0));
+
+            *this = Stats();
+            return text;
+        }
+
+    private:
+        static const std::size_t samples = 1u << 16;
+
+        std::vector<double> _latencies;
+        std::size_t         _requests = 0, _rows = 0, _errors = 0, _batches = 0, _batch_rows = 0;
+        Clock::time_point   _since = Clock::now();
+        std::mt19937_64     _random;
+    };
+
+    class Server {
+    public:
+        explicit Server(const Options &options) : _options(options) {}
+
+        int Run()
+        {
+            sockaddr_un address;
+            if (!protocol::Address(_options.socket, address)) {
+                std::fprintf(stderr, "Socket path too long: %s\n", _options.socket.c_str());
+                return 1;
+            }
+
+            // Replaces only a socket left over by a server that did not exit cleanly
+            struct stat info;
+            if (lstat(_options.socket.c_str(), &info) == 0) {
+                int live = protocol::Connect(_options.socket);
+                if (!S_ISSOCK(info.st_mode) || live >= 0) {
+                    if (live >= 0)
+                        close(live);
+                    std::fprintf(stderr, "%s is in use\n", _options.socket.c_str());
+                    return 1;
+                }
+                unlink(_options.socket.c_str());
+            }
+
+            _listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            mode_t mask = umask(0077); // Connecting takes write permission on the socket
+            bool bound = _listener >= 0 && bind(_listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+            umask(mask);
+            if (!bound || listen(_listener, 128) != 0) {
+                std::perror("exprparse_server: listen");
+                return 1;
+            }
+            fcntl(_listener, F_SETFL, O_NONBLOCK);
+
+            if (pipe(_wake) != 0) {
+                std::perror("exprparse_server: pipe");
+                return 1;
+            }
+            fcntl(_wake[0], F_SETFL, O_NONBLOCK);
+            std::thread compiler([this] { Compiler(); });
+
+            std::fprintf(stderr, "Listening on %s (%s batches)\n", _options.socket.c_str(), _options.native ? "native" : "compact");
+
+            auto next_report = Clock::now() + std::chrono::seconds(_options.report_seconds);
+
+            while (!stop) {
+                std::vector<pollfd> fds = { pollfd{ _listener, POLLIN, 0 }, pollfd{ _wake[0], POLLIN, 0 } };
+                std::vector<std::uint64_t> ids(2, 0);
+                for (auto &client : _clients) {
+                    short events = client.second.output.size() < backlog ? POLLIN : 0; // Stop reading from clients that do not read
+                    if (!client.second.output.empty())
+                        events |= POLLOUT;
+                    fds.push_back(pollfd{ client.second.fd, events, 0 });
+                    ids.push_back(client.first);
+                }
+
+                if (poll(fds.data(), fds.size(), Timeout(next_report)) < 0 && errno != EINTR) {
+                    std::perror("exprparse_server: poll");
+                    break;
+                }
+
+                if (fds[0].revents & POLLIN)
+                    Accept();
+
+                if (fds[1].revents & POLLIN)
+                    Compiled();
+
+                for (std::size_t i = 2; i < fds.size(); i++)
+                    if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                        Receive(ids[i]);
+
+                Flush(false);
+
+                for (auto it = _clients.begin(); it != _clients.end();) {
+                    Send(it->second);
+                    if (it->second.closed) {
+                        close(it->second.fd);
+                        it = _clients.erase(it);
+                    }
+                    else {
+                        it++;
+                    }
+                }
+
+                if (_options.report_seconds > 0 && Clock::now() >= next_report) {
+                    std::fputs(_stats.Report().c_str(), stderr);
+                    next_report = Clock::now() + std::chrono::seconds(_options.report_seconds);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _pending.notify_one();
+            compiler.join();
+            close(_wake[0]);
+            close(_wake[1]);
+
+            Flush(true);
+            for (auto &client : _clients) {
+                Send(client.second);
+                close(client.second.fd);
+            }
+
+            std::fputs(_stats.Report().c_str(), stderr);
+            close(_listener);
+            unlink(_options.socket.c_str());
+            return 0;
+        }
+
+    private:
+        static const std::size_t backlog          = 16u << 20;               // Bytes of unsent responses per client
+        static const std::size_t max_input        = 4 + protocol::max_frame; // Bytes of received requests per client
+        static const std::size_t max_compilations = 256;                     // Compile requests waiting for the compiler thread
+
+        int Timeout(Clock::time_point next_report) const
+        {
+            Clock::time_point until = Clock::time_point::max();
+            if (_options.report_seconds > 0)
+                until = next_report;
+            for (auto &batch : _batches)
+                until = std::min(until, batch.second.oldest + std::chrono::milliseconds(_options.batch_delay_ms));
+
+            if (until == Clock::time_point::max())
+                return -1;
+
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(until - Clock::now()).count() + 1;
+            return ms > 0 ? static_cast<int>(std::min<long long>(ms, 1000)) : 0;
+        }
+
+        void Accept()
+        {
+            for (;;) {
+                int fd = accept(_listener, nullptr, nullptr);
+                if (fd < 0)
+                    return;
+
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                _clients[++_last_client].fd = fd;
+            }
+        }
+
+        void Receive(std::uint64_t id)
+        {
+            Client &client = _clients[id];
+
+            // Buffers at most one frame of the largest size, the rest stays in the socket until the next poll.
+            // Frames over the limit close the connection below, so the buffer never holds more.
+            std::uint8_t buffer[65536];
+            while (client.input.size() < max_input) {
+                ssize_t count = recv(client.fd, buffer, std::min(sizeof(buffer), max_input - client.input.size()), 0);
+                if (count > 0) {
+                    client.input.insert(client.input.end(), buffer, buffer + count);
+                    continue;
+                }
+                if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                    client.closed = true;
+                if (count == 0 || errno != EINTR)
+                    break;
+            }
+
+            // Complete frames, a frame over the limit closes the connection
+            std::size_t offset = 0;
+            while (!client.closed && client.input.size() - offset >= 4) {
+                std::uint32_t size = protocol::FrameSize(client.input.data() + offset, client.input.size() - offset);
+                if (size > protocol::max_frame) {
+                    client.closed = true;
+                    break;
+                }
+                if (client.input.size() - offset - 4 < size)
+                    break;
+
+                // Requests the server cannot allocate for fail alone
+                const std::uint8_t *frame = client.input.data() + offset + 4;
+                try {
+                    Dispatch(id, frame, size);
+                }
+                catch (const std::bad_alloc &) {
+                    protocol::Reader reader(frame, size);
+                    std::uint8_t type = reader.U8();
+                    Reply(id, static_cast<protocol::Type>(type), reader.U32(), Error_Limit_Exceeded);
+                }
+                offset += 4 + size;
+            }
+            client.input.erase(client.input.begin(), client.input.begin() + offset);
+        }
+
+        void Dispatch(std::uint64_t client, const std::uint8_t *data, std::size_t size)
+        {
+            protocol::Reader reader(data, size);
+            std::uint8_t  type = reader.U8();
+            std::uint32_t id   = reader.U32();
+
+            switch (type) {
+                case protocol::Compile: {
+                    std::string name   = reader.String16();
+                    std::string source = reader.String32();
+                    std::vector<std::string> variables(reader.U16());
+                    for (auto &variable : variables)
+                        variable = reader.String16();
+
+                    if (!reader.Ok() || reader.Remaining()) {
+                        Reply(client, protocol::Compile, id, Error_Syntax_Error);
+                        break;
+                    }
+
+                    // Answered when compiled, evals arriving before use the previous version
+                    bool queued = false;
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        if (_compilations.size() < max_compilations) {
+                            Compilation compilation;
+                            compilation.client    = client;
+                            compilation.id        = id;
+                            compilation.name      = name;
+                            compilation.source    = source;
+                            compilation.variables = variables;
+                            _compilations.push_back(std::move(compilation));
+                            queued = true;
+                        }
+                    }
+                    if (queued)
+                        _pending.notify_one();
+                    else
+                        Reply(client, protocol::Compile, id, Error_Limit_Exceeded);
+                    break;
+                }
+
+                case protocol::Eval: {
+                    Request request;
+                    request.client  = client;
+                    request.id      = id;
+                    request.arrival = Clock::now();
+
+                    std::string name = reader.String16();
+                    request.rows = reader.U32();
+                    std::size_t columns = reader.U16();
+
+                    auto it = _registry.find(name);
+                    Status status = Success;
+                    if (!reader.Ok() || reader.Remaining() != std::uint64_t(request.rows) * columns * sizeof(double))
+                        status = Error_Syntax_Error;
+                    else if (request.rows > _options.max_batch || std::uint64_t(request.rows) * sizeof(double) > protocol::max_frame)
+                        status = Error_Limit_Exceeded; // The response would not fit in a frame
+                    else if (it == _registry.end())
+                        status = Error_Unregistered_Symbol;
+                    else if (columns != it->second->variables.size())
+                        status = Error_Syntax_Error;
+
+                    if (status != Success || request.rows == 0) {
+                        Reply(client, protocol::Eval, id, status);
+                        _stats.Request(0, 0, status != Success);
+                        break;
+                    }
+
+                    request.values.resize(std::size_t(request.rows) * columns);
+                    for (auto &value : request.values)
+                        value = reader.F64();
+
+                    Batch &batch = _batches[it->second.get()];
+                    if (batch.requests.empty()) {
+                        batch.entry  = it->second;
+                        batch.oldest = request.arrival;
+                    }
+                    batch.rows += request.rows;
+                    batch.requests.push_back(std::move(request));
+
+                    if (batch.rows >= _options.max_batch) {
+                        Evaluate(batch);
+                        _batches.erase(it->second.get());
+                    }
+                    break;
+                }
+
+                case protocol::Stats: {
+                    protocol::Writer writer(protocol::Stats, id);
+                    writer.I32(Success);
+                    writer.String32(_stats.Report());
+                    Respond(client, writer);
+                    break;
+                }
+
+                default:
+                    Reply(client, static_cast<protocol::Type>(type), id, Error_Unsupported);
+                    break;
+            }
+        }
+
+        // Response carrying only a status, with no values for an eval
+        void Reply(std::uint64_t client, protocol::Type type, std::uint32_t id, Status status)
+        {
+            protocol::Writer writer(type, id);
+            writer.I32(status);
+            if (type == protocol::Eval)
+                writer.U32(0);
+            Respond(client, writer);
+        }
+
+        // Compiles the queued expressions until the server stops
+        void Compiler()
+        {
+            for (;;) {
+                Compilation compilation;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _pending.wait(lock, [this] { return _stopping || !_compilations.empty(); });
+                    if (_stopping)
+                        return;
+                    compilation = std::move(_compilations.front());
+                    _compilations.pop_front();
+                }
+
+                compilation.entry = std::make_shared<Entry>();
+                try {
+                    compilation.status = CompileEntry(compilation.name, compilation.source, compilation.variables, *compilation.entry);
+                }
+                catch (const std::bad_alloc &) {
+                    compilation.status = Error_Limit_Exceeded;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _compiled.push_back(std::move(compilation));
+                }
+                char wake = 0;
+                while (write(_wake[1], &wake, 1) < 0 && errno == EINTR) {}
+            }
+        }
+
+        // Registers the expressions compiled since the last poll and answers their requests
+        void Compiled()
+        {
+            char buffer[256];
+            while (read(_wake[0], buffer, sizeof(buffer)) > 0) {}
+
+            std::deque<Compilation> compiled;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                compiled.swap(_compiled);
+            }
+
+            for (auto &compilation : compiled) {
+                // Requests already queued for the previous version are evaluated with it
+                if (compilation.status == Success)
+                    _registry[compilation.name] = compilation.entry;
+
+                Reply(compilation.client, protocol::Compile, compilation.id, compilation.status);
+            }
+        }
+
+        // Runs on the compiler thread, reads only the options
+        Status CompileEntry(const std::string &name, const std::string &source, const std::vector<std::string> &variables, Entry &entry) const
+        {
+            entry.expression.RegisterIntrinsics();
+
+            for (auto &variable : variables) {
+                entry.variable_names.push_back(variable);
+                entry.variables.push_back(std::make_shared<double>(0));
+
+                Status status = entry.expression.RegisterVariable(variable, entry.variables.back());
+                if (status != Success)
+                    return status;
+            }
+
+            Status status = entry.expression.Parse(source);
+            if (status == Success)
+                status = entry.compact.Compile(entry.expression);
+            if (status != Success)
+                return status;
+
+            if (_options.native) {
+                codegen::Generator<double> generator;
+                if (generator.Add("expression", entry.expression) == Success && entry.library.Load(generator) == Success
+                    && entry.library.Get("expression", entry.native) == Success) {
+                    for (auto &variable : generator.Variables())
+                        entry.native_columns.push_back(std::find(variables.begin(), variables.end(), variable) - variables.begin());
+                    entry.has_native = true;
+                }
+                else {
+                    std::fprintf(stderr, "No native code for %s, evaluating compact bytecode\n", name.c_str());
+                }
+            }
+
+            return Success;
+        }
+
+        void Flush(bool all)
+        {
+            auto now = Clock::now();
+            for (auto it = _batches.begin(); it != _batches.end();) {
+                if (all || now - it->second.oldest >= std::chrono::milliseconds(_options.batch_delay_ms)) {
+                    Evaluate(it->second);
+                    it = _batches.erase(it);
+                }
+                else {
+                    it++;
+                }
+            }
+        }
+
+        // Evaluates the rows of all requests of a batch at once and answers them
+        void Evaluate(Batch &batch)
+        {
+            try {
+                EvaluateRows(batch);
+            }
+            catch (const std::bad_alloc &) {
+                for (auto &request : batch.requests) {
+                    Reply(request.client, protocol::Eval, request.id, Error_Limit_Exceeded);
+                    _stats.Request(0, 0, true);
+                }
+            }
+        }
+
+        void EvaluateRows(Batch &batch)
+        {
+            Entry &entry = *batch.entry;
+            std::size_t rows = batch.rows, columns = entry.variables.size();
+
+            // Columns of the whole batch
+            std::vector<double> input(columns * rows);
+            std::size_t first = 0;
+            for (auto &request : batch.requests) {
+                for (std::size_t c = 0; c < columns; c++)
+                    std::copy(request.values.begin() + c * request.rows, request.values.begin() + (c + 1) * request.rows,
+                              input.begin() + c * rows + first);
+                first += request.rows;
+            }
+
+            std::vector<double> out(rows);
+            std::vector<Status> statuses(rows, Success);
+
+            bool evaluated = false;
+            if (entry.has_native) {
+                std::vector<const double *> native_columns;
+                for (std::size_t column : entry.native_columns)
+                    native_columns.push_back(input.data() + column * rows);
+
+                Status status;
+                entry.native.EvalBatch(native_columns.data(), rows, out.data(), status);
+                evaluated = status == Success; // Otherwise evaluated again row by row to find the failing requests
+            }
+            else {
+                std::map<std::string, const double *> compact_columns;
+                for (std::size_t c = 0; c < columns; c++)
+                    compact_columns.emplace(entry.variable_names[c], input.data() + c * rows);
+
+                Status status;
+                entry.compact.EvalBatch(compact_columns, rows, out.data(), status);
+                evaluated = status == Success;
+            }
+
+            if (!evaluated) {
+                for (std::size_t row = 0; row < rows; row++) {
+                    for (std::size_t c = 0; c < columns; c++)
+                        *entry.variables[c] = input[c * rows + row];
+                    out[row] = entry.compact.Eval(statuses[row]);
+                }
+            }
+
+            _stats.Batch(rows);
+
+            auto now = Clock::now();
+            first = 0;
+            for (auto &request : batch.requests) {
+                Status status = Success;
+                for (std::size_t row = first; row < first + request.rows && status == Success; row++)
+                    status = statuses[row];
+
+                protocol::Writer writer(protocol::Eval, request.id);
+                writer.I32(status);
+                writer.U32(request.rows);
+                for (std::size_t row = first; row < first + request.rows; row++)
+                    writer.F64(out[row]);
+                Respond(request.client, writer);
+
+                _stats.Request(std::chrono::duration<double, std::micro>(now - request.arrival).count(), request.rows, status != Success);
+                first += request.rows;
+            }
+        }
+
+        void Respond(std::uint64_t id, protocol::Writer &writer)
+        {
+            auto it = _clients.find(id);
+            if (it == _clients.end()) // Disconnected while the request was queued
+                return;
+
+            const std::vector<std::uint8_t> &frame = writer.Finish();
+            it->second.output.insert(it->second.output.end(), frame.begin(), frame.end());
+        }
+
+        void Send(Client &client)
+        {
+            std::size_t sent = 0;
+            while (sent < client.output.size()) {
+                ssize_t count = send(client.fd, client.output.data() + sent, client.output.size() - sent, MSG_NOSIGNAL);
+                if (count > 0) {
+                    sent += static_cast<std::size_t>(count);
+                    continue;
+                }
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    client.closed = true;
+                break;
+            }
+            client.output.erase(client.output.begin(), client.output.begin() + sent);
+        }
+
+    private:
+        Options _options;
+        int     _listener = -1;
+        int     _wake[2]  = { -1, -1 }; // Written by the compiler thread when a compilation is done
+
+        std::mutex                _mutex; // Guards the queues between the poll loop and the compiler thread
+        std::condition_variable   _pending;
+        std::deque<Compilation>   _compilations;
+        std::deque<Compilation>   _compiled;
+        bool                      _stopping = false;
+
+        std::map<std::string, std::shared_ptr<Entry>> _registry;
+        std::map<const Entry *, Batch>                _batches; // Requests waiting to be evaluated, by expression
+        std::map<std::uint64_t, Client>               _clients;
+        std::uint64_t                                 _last_client = 0;
+
+        Stats _stats;
+    };
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: exprparse_server [--socket PATH] [--native] [--max-batch ROWS] [--batch-delay-ms MS] [--report SECONDS]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool value = i + 1 < argc;
+
+        if (arg == "--socket" && value)              options.socket = argv[++i];
+        else if (arg == "--native")                  options.native = true;
+        else if (arg == "--max-batch" && value)      options.max_batch = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--batch-delay-ms" && value) options.batch_delay_ms = std::atoi(argv[++i]);
+        else if (arg == "--report" && value)         options.report_seconds = std::atoi(argv[++i]);
+        else {
+            Usage();
+            return 2;
+        }
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = [](int) { stop = 1; };
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    return Server(options).Run();
+}
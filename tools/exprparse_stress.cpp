@@ -0,0 +1,199 @@
+#include "exprparse.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Stress test of symbol registration concurrent with parsing: registrar threads keep registering ranged
+// variables and functions while parser threads parse, build and compile expressions using them, all through
+// expressions sharing one set of symbols. Parsers check that every symbol registered before a parse started is
+// found, and that a parse never sees half of a registration. Build with -fsanitize=thread to check for races,
+// the exit code is nonzero if any check failed.
+//
+//   exprparse_stress [--parsers N] [--registrars N] [--seconds S]
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+    using namespace exprparse;
+
+    struct Options {
+        int    parsers    = 4;
+        int    registrars = 2;
+        double seconds    = 2;
+    };
+
+    // Registers v<k>_<i> within [1, 2] and f<k>_<i>(x) = x + i for i = 0, 1, ..., count is the number done
+    struct Registrar {
+        Expression<double>       expression;
+        std::atomic<std::size_t> count{ 0 };
+        std::vector<std::shared_ptr<double>> values; // Owned by the registrar thread
+
+        void Run(int k, Clock::time_point deadline, std::atomic<std::size_t> &failures)
+        {
+            for (std::size_t i = 0; Clock::now() < deadline; i++) {
+                std::string suffix = std::to_string(k) + "_" + std::to_string(i);
+
+                values.push_back(std::make_shared<double>(1 + 1.0 / (i + 2)));
+                double offset = static_cast<double>(i);
+                if (expression.RegisterVariable("v" + suffix, values.back(), Interval<double>{ 1, 2 }) != Success ||
+                    expression.RegisterFunction("f" + suffix, [offset](double x) { return x + offset; }) != Success)
+                    failures++;
+
+                count.store(i + 1, std::memory_order_release);
+            }
+        }
+    };
+
+    struct Totals {
+        std::size_t parses   = 0;
+        std::size_t found    = 0; // Symbols seen while being registered
+        std::size_t compiles = 0;
+    };
+
+    void Parse(const Expression<double> &shared, std::vector<std::unique_ptr<Registrar>> &registrars, unsigned seed,
+        Clock::time_point deadline, Totals &totals, std::atomic<std::size_t> &failures)
+    {
+        Expression<double> expression;
+        expression.ShareSymbols(shared);
+
+        std::mt19937 random(seed);
+        Status status;
+
+        auto fail = [&](const char *what, const std::string &source, Status result) {
+            if (failures++ < 10)
+                std::fprintf(stderr, "%s: \"%s\" status %d\n", what, source.c_str(), result);
+        };
+
+        while (Clock::now() < deadline) {
+            std::size_t k = random() % registrars.size();
+            auto &registrar = *registrars[k];
+
+            std::size_t count = registrar.count.load(std::memory_order_acquire);
+            if (count == 0)
+                continue;
+
+            // Registered before this parse, must be found with its range and function
+            std::size_t i      = random() % count;
+            std::string suffix = std::to_string(k) + "_" + std::to_string(i);
+            std::string source = "f" + suffix + "(1 / v" + suffix + ")";
+
+            Status result = expression.Parse(source);
+            totals.parses++;
+            if (result != Success) {
+                fail("registered symbol not found", source, result);
+                continue;
+            }
+            if (expression.EliminatedChecks() != 1)
+                fail("range of registered variable not applied", source, result);
+
+            double expected = 1 / (1 + 1.0 / (i + 2)) + static_cast<double>(i);
+            double value    = expression.Eval(status);
+            if (status != Success || value != expected)
+                fail("wrong value", source, status);
+
+            // Possibly being registered right now, a variable is never seen without its range
+            source = "1 / v" + std::to_string(k) + "_" + std::to_string(count);
+
+            result = expression.Parse(source);
+            totals.parses++;
+            if (result == Success) {
+                totals.found++;
+                if (expression.EliminatedChecks() != 1)
+                    fail("variable seen without its range", source, result);
+            }
+            else if (result != Error_Unregistered_Symbol && result != Error_Syntax_Error) {
+                fail("unexpected status", source, result);
+            }
+
+            // Symbol tables are built lazily per version, by whichever thread asks first
+            if (random() % 64 == 0) {
+                Builder<double> builder(expression);
+                std::string variable = "v" + std::to_string(k) + "_" + std::to_string(i);
+                result = expression.Build(builder.Mul(builder.Var(variable), builder.Constant(2)));
+
+                CompactExpression<double> compact;
+                if (result != Success || compact.Compile(expression) != Success) {
+                    fail("build and compile", variable, result);
+                    continue;
+                }
+                totals.compiles++;
+
+                value = compact.Eval(status);
+                if (status != Success || value != 2 * (1 + 1.0 / (i + 2)))
+                    fail("wrong compact value", variable, status);
+            }
+        }
+    }
+
+    void Usage()
+    {
+        std::fprintf(stderr, "usage: exprparse_stress [--parsers N] [--registrars N] [--seconds S]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool value = i + 1 < argc;
+
+        if (arg == "--parsers" && value)         options.parsers = std::atoi(argv[++i]);
+        else if (arg == "--registrars" && value) options.registrars = std::atoi(argv[++i]);
+        else if (arg == "--seconds" && value)    options.seconds = std::atof(argv[++i]);
+        else {
+            Usage();
+            return 2;
+        }
+    }
+    if (options.parsers < 1 || options.registrars < 1) {
+        Usage();
+        return 2;
+    }
+
+    Expression<double> shared;
+
+    std::vector<std::unique_ptr<Registrar>> registrars;
+    for (int k = 0; k < options.registrars; k++) {
+        registrars.emplace_back(new Registrar());
+        registrars.back()->expression.ShareSymbols(shared);
+    }
+
+    std::atomic<std::size_t> failures{ 0 };
+    std::vector<Totals>      totals(options.parsers);
+    std::vector<std::thread> threads;
+
+    auto start    = Clock::now();
+    auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    for (int k = 0; k < options.registrars; k++)
+        threads.emplace_back(&Registrar::Run, registrars[k].get(), k, deadline, std::ref(failures));
+    for (int i = 0; i < options.parsers; i++)
+        threads.emplace_back(Parse, std::cref(shared), std::ref(registrars), 1000u + i, deadline, std::ref(totals[i]), std::ref(failures));
+    for (auto &thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Totals total;
+    for (auto &t : totals) {
+        total.parses   += t.parses;
+        total.found    += t.found;
+        total.compiles += t.compiles;
+    }
+    std::size_t registered = 0;
+    for (auto &registrar : registrars)
+        registered += 2 * registrar->count.load();
+
+    std::printf("%d parsers, %d registrars, %.1f s\n", options.parsers, options.registrars, seconds);
+    std::printf("%zu parses (%.0f/s), %zu symbols registered (%.0f/s), %zu symbols seen while being registered, %zu compiles\n",
+        total.parses, total.parses / seconds, registered, registered / seconds, total.found, total.compiles);
+    std::printf("%zu failures\n", failures.load());
+
+    return failures.load() || total.parses == 0 ? 1 : 0;
+}